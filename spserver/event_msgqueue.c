@@ -9,8 +9,19 @@
  * 
  */
 
+/*
+ * The queue is a lock-free multi-producer/single-consumer list:
+ * producers push onto a CAS-linked stack, the event loop thread takes
+ * the whole stack with one atomic swap, reverses it to restore FIFO
+ * order and runs the callback for every item. Only the push that finds
+ * the stack empty wakes up the event loop, through an eventfd if it is
+ * available, otherwise through a socketpair.
+ */
+
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "spthread.hpp"
@@ -18,178 +29,109 @@
 #include "spporting.hpp"
 #include "event_msgqueue.h"
 
-struct circqueue {
-   unsigned int head;
-   unsigned int tail;
-   unsigned int count;
-   unsigned int max_entries;
-   unsigned int array_elements;
-   void **entries;
-};
+#if defined( __linux__ ) && !defined( SP_NO_EVENTFD )
+#include <sys/eventfd.h>
+#define HAVE_EVENTFD 1
+#endif
 
-#define DEFAULT_UNBOUNDED_QUEUE_SIZE 1024
+struct msgnode {
+   struct msgnode *next;
+   void *data;
+};
 
 struct event_msgqueue {
    int push_fd;
    int pop_fd;
-   int unlock_between_callbacks;
 
    struct event queue_ev;
 
-   sp_thread_mutex_t lock;
    void (*callback)(void *, void *);
    void *cbarg;
-   struct circqueue *queue;
-};
 
-static unsigned int nextpow2(unsigned int num) {
-    --num;
-    num |= num >> 1;
-    num |= num >> 2;
-    num |= num >> 4;
-    num |= num >> 8;
-    num |= num >> 16;
-    return ++num;
-}
-
-#define circqueue_get_length(q) ((q)->count)
-#define circqueue_is_empty(q) (!circqueue_get_length(q))
-#define circqueue_is_full(q) ((q)->count == (q)->array_elements)
-
-static struct circqueue *circqueue_new(unsigned int size) {
-   struct circqueue *cq;
-
-   if (!(cq = calloc(1, sizeof(struct circqueue))))
-      return(NULL);
+   unsigned int max_entries;
+   volatile long count;
+   struct msgnode * volatile head;
+};
 
-   cq->max_entries = size;
-   if (!size || !(cq->array_elements = nextpow2(size)))
-      cq->array_elements = DEFAULT_UNBOUNDED_QUEUE_SIZE;
-   cq->entries = malloc(sizeof(void *) * cq->array_elements);
-   if (!cq->entries) {
-      free(cq);
-      return(NULL);
+static void msgqueue_wakeup(struct event_msgqueue *msgq) {
+#ifdef HAVE_EVENTFD
+   if (msgq->push_fd == msgq->pop_fd) {
+      uint64_t one = 1;
+      while (write(msgq->push_fd, &one, sizeof(one)) < 0 && EINTR == errno);
+      return;
    }
-
-   return(cq);
-}
-
-static void circqueue_destroy(struct circqueue *cq) {
-   free(cq->entries);
-   free(cq);
-}
-
-static int circqueue_grow(struct circqueue *cq) {
-   void **newents;
-   unsigned int newsize = cq->array_elements << 1;
-   unsigned int headchunklen = 0, tailchunklen = 0;
-   
-   if (!(newents = malloc(sizeof(void *) * newsize)))
-      return(-1);
-
-   if (cq->head < cq->tail)
-      headchunklen = cq->tail - cq->head;
-   else {
-      headchunklen = cq->array_elements - cq->head;
-      tailchunklen = cq->tail;
+#endif
+   {
+      const char buf[1] = { 0 };
+      send(msgq->push_fd, buf, 1, 0);
    }
-
-   memcpy(newents, &cq->entries[cq->head], sizeof(void *) * headchunklen);
-   if (tailchunklen)
-      memcpy(&newents[headchunklen], cq->entries, sizeof(void *) * tailchunklen);
-
-   cq->head = 0;
-   cq->tail = headchunklen + tailchunklen;
-   cq->array_elements = newsize;
-
-   free(cq->entries);
-   cq->entries = newents;
-
-   return(0);
-}
-
-static int circqueue_push_tail(struct circqueue *cq, void *elem) {
-   if (cq->max_entries) {
-      if (cq->count == cq->max_entries)
-         return(-1);
-   } else if (circqueue_is_full(cq) && circqueue_grow(cq) != 0) 
-      return(-1);
-
-   cq->count++;
-   cq->entries[cq->tail++] = elem;
-   cq->tail &= cq->array_elements - 1;
-
-   return(0);
-}
-
-static void *circqueue_pop_head(struct circqueue *cq) {
-   void *data;
-
-   if (!cq->count)
-      return(NULL);
-
-   cq->count--;
-   data = cq->entries[cq->head++];
-   cq->head &= cq->array_elements - 1;
-
-   return(data);
 }
 
 static void msgqueue_pop(int fd, short flags, void *arg) {
    struct event_msgqueue *msgq = arg;
-   char buf[64];
-
-   recv(fd, buf, sizeof(buf),0);
+   struct msgnode *list, *node, *prev = NULL;
+
+#ifdef HAVE_EVENTFD
+   if (msgq->push_fd == msgq->pop_fd) {
+      uint64_t value = 0;
+      read(fd, &value, sizeof(value));
+   } else
+#endif
+   {
+      char buf[64];
+      recv(fd, buf, sizeof(buf), 0);
+   }
 
-   sp_thread_mutex_lock(&msgq->lock);
-   while(!circqueue_is_empty(msgq->queue)) {
-      void *qdata;
+   /* take all the pending items at once */
+   list = sp_atomic_swap_ptr(&msgq->head, NULL);
 
-      qdata = circqueue_pop_head(msgq->queue);
+   /* the stack is LIFO, reverse it to deliver in push order */
+   while (list) {
+      node = list->next;
+      list->next = prev;
+      prev = list;
+      list = node;
+   }
 
-      if (msgq->unlock_between_callbacks)
-         sp_thread_mutex_unlock(&msgq->lock);
+   while (prev) {
+      node = prev;
+      prev = prev->next;
 
-      msgq->callback(qdata, msgq->cbarg);
+      sp_atomic_add(&msgq->count, -1);
 
-      if (msgq->unlock_between_callbacks)
-         sp_thread_mutex_lock(&msgq->lock);
+      msgq->callback(node->data, msgq->cbarg);
+      free(node);
    }
-   sp_thread_mutex_unlock(&msgq->lock);
 }
 
 struct event_msgqueue *msgqueue_new(struct event_base *base, unsigned int max_size, void (*callback)(void *, void *), void *cbarg) {
    struct event_msgqueue *msgq;
-   struct circqueue *cq;
-   int fds[2];
+   int fds[2] = { -1, -1 };
 
-   if (!(cq = circqueue_new(max_size)))
-      return(NULL);
+#ifdef HAVE_EVENTFD
+   fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
 
-   if (sp_socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
-      circqueue_destroy(cq);
+   if (fds[0] < 0 && sp_socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
       return(NULL);
-   }
 
-   if (!(msgq = malloc(sizeof(struct event_msgqueue)))) {
-      circqueue_destroy(cq);
+   if (!(msgq = calloc(1, sizeof(struct event_msgqueue)))) {
       sp_close(fds[0]);
-      sp_close(fds[1]);
+      if (fds[1] != fds[0]) sp_close(fds[1]);
       return(NULL);
    }
 
    msgq->push_fd = fds[0];
    msgq->pop_fd = fds[1];
-   msgq->queue = cq;
+   msgq->max_entries = max_size;
+   msgq->count = 0;
+   msgq->head = NULL;
    msgq->callback = callback;
    msgq->cbarg = cbarg;
-   sp_thread_mutex_init(&msgq->lock, NULL);
    event_set(&msgq->queue_ev, msgq->pop_fd, EV_READ | EV_PERSIST, msgqueue_pop, msgq);
    event_base_set(base, &msgq->queue_ev);
    event_add(&msgq->queue_ev, NULL);
 
-   msgq->unlock_between_callbacks = 1;
-   
    return(msgq);
 }
 
@@ -200,33 +142,38 @@ void msgqueue_destroy(struct event_msgqueue *msgq)
    }
 
    event_del(&msgq->queue_ev);
-   circqueue_destroy(msgq->queue);
    sp_close(msgq->push_fd);
-   sp_close(msgq->pop_fd);
+   if (msgq->pop_fd != msgq->push_fd)
+      sp_close(msgq->pop_fd);
    free(msgq);
 }
 
 int msgqueue_push(struct event_msgqueue *msgq, void *msg) {
-   const char buf[1] = { 0 };
-   int r = 0;
+   struct msgnode *node, *head;
 
-   sp_thread_mutex_lock(&msgq->lock);
-   if ((r = circqueue_push_tail(msgq->queue, msg)) == 0) {
-      if (circqueue_get_length(msgq->queue) == 1)
-         send(msgq->push_fd, buf, 1,0);
-   }
-   sp_thread_mutex_unlock(&msgq->lock);
+   if (msgq->max_entries && (unsigned int)sp_atomic_get(&msgq->count) >= msgq->max_entries)
+      return(-1);
 
-   return(r);
-}
+   if (!(node = malloc(sizeof(struct msgnode))))
+      return(-1);
 
-unsigned int msgqueue_length(struct event_msgqueue *msgq) {
-   unsigned int len;
+   node->data = msg;
+
+   sp_atomic_add(&msgq->count, 1);
 
-   sp_thread_mutex_lock(&msgq->lock);
-   len = circqueue_get_length(msgq->queue);
-   sp_thread_mutex_unlock(&msgq->lock);
+   do {
+      head = msgq->head;
+      node->next = head;
+   } while (!sp_atomic_cas_ptr(&msgq->head, head, node));
 
-   return(len);
+   /* only the push which makes the queue non-empty needs to wake up the loop */
+   if (NULL == head)
+      msgqueue_wakeup(msgq);
+
+   return(0);
+}
+
+unsigned int msgqueue_length(struct event_msgqueue *msgq) {
+   return((unsigned int)sp_atomic_get(&msgq->count));
 }
 
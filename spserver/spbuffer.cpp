@@ -11,6 +11,8 @@
 #include "spporting.hpp"
 
 #include "spbuffer.hpp"
+#include "sputils.hpp"
+#include "spscan.hpp"
 
 #ifdef WIN32
 
@@ -26,7 +28,6 @@
 #define sp_evbuffer_drain       evbuffer_drain
 #define sp_evbuffer_expand      evbuffer_expand
 #define sp_evbuffer_remove      evbuffer_remove
-#define sp_evbuffer_readline    evbuffer_readline
 #define sp_evbuffer_add_vprintf evbuffer_add_vprintf
 
 #endif
@@ -52,7 +53,7 @@ int SP_Buffer :: append( const void * buffer, int len )
 int SP_Buffer :: append( const SP_Buffer * buffer )
 {
 	if( buffer->getSize() > 0 ) {
-		return append( buffer->getBuffer(), buffer->getSize() );
+		return append( buffer->getRawBuffer(), buffer->getSize() );
 	} else {
 		return 0;
 	}
@@ -104,6 +105,18 @@ int SP_Buffer :: getCapacity()
 	return mBuffer->totallen;
 }
 
+char * SP_Buffer :: getWritable( int len )
+{
+	if( 0 != sp_evbuffer_expand( mBuffer, len ) ) return NULL;
+
+	return ((char*)EVBUFFER_DATA( mBuffer )) + getSize();
+}
+
+void SP_Buffer :: commit( int len )
+{
+	EVBUFFER_LENGTH( mBuffer ) += len;
+}
+
 const void * SP_Buffer :: getBuffer() const
 {
 	if( NULL != EVBUFFER_DATA( mBuffer ) ) {
@@ -127,7 +140,26 @@ size_t SP_Buffer :: getSize() const
 
 char * SP_Buffer :: getLine()
 {
-	return sp_evbuffer_readline( mBuffer );
+	// the same as evbuffer_readline, the line ends with "\r", "\n", "\r\n" or "\n\r"
+	const char * data = (char*)getRawBuffer();
+	size_t len = getSize();
+
+	const char * pos = SP_Scanner::findEither( data, len, '\r', '\n' );
+	if( NULL == pos ) return NULL;
+
+	size_t lineLen = pos - data;
+
+	char * line = (char*)malloc( lineLen + 1 );
+	memcpy( line, data, lineLen );
+	line[ lineLen ] = '\0';
+
+	size_t drain = lineLen + 1;
+	if( drain < len && ( '\r' == data[ drain ] || '\n' == data[ drain ] )
+			&& data[ drain ] != *pos ) drain++;
+
+	erase( drain );
+
+	return line;
 }
 
 int SP_Buffer :: take( char * buffer, int len )
@@ -151,26 +183,101 @@ SP_Buffer * SP_Buffer :: take()
 
 const void * SP_Buffer :: find( const void * key, size_t len )
 {
-	//return (void*)evbuffer_find( mBuffer, (u_char*)key, len );
+	return SP_Scanner::find( (char*)getRawBuffer(), getSize(), (char*)key, len );
+}
+
+//-------------------------------------------------------------------
+
+SP_BufferSlice :: SP_BufferSlice( SP_Buffer * buffer )
+{
+	mBuffer = buffer;
+
+	mData = (const char*)buffer->getRawBuffer();
+	mSize = buffer->getSize();
+}
+
+SP_BufferSlice :: ~SP_BufferSlice()
+{
+	delete mBuffer;
+	mBuffer = NULL;
+}
+
+const void * SP_BufferSlice :: getData() const
+{
+	return mData;
+}
+
+size_t SP_BufferSlice :: getSize() const
+{
+	return mSize;
+}
+
+//-------------------------------------------------------------------
+
+SP_BufferChain :: SP_BufferChain()
+{
+	mList = new SP_ArrayList();
+	mSize = 0;
+}
 
-	sp_evbuffer_t * buffer = mBuffer;
-	u_char * what = (u_char*)key;
+SP_BufferChain :: ~SP_BufferChain()
+{
+	reset();
 
-	size_t remain = buffer->off;
-	u_char *search = buffer->buffer;
-	u_char *p;
+	delete mList;
+	mList = NULL;
+}
 
-	while (remain >= len) {
-		if ((p = (u_char*)memchr(search, *what, (remain - len) + 1)) == NULL)
-			break;
+int SP_BufferChain :: append( SP_Buffer * buffer )
+{
+	if( buffer->getSize() <= 0 ) return 0;
 
-		if (memcmp(p, what, len) == 0)
-			return (p);
+	return append( new SP_BufferSlice( buffer->take() ) );
+}
 
-		search = p + 1;
-		remain = buffer->off - (size_t)(search - buffer->buffer);
+int SP_BufferChain :: append( SP_BufferSlice * slice )
+{
+	if( slice->getSize() <= 0 ) {
+		delete slice;
+		return 0;
 	}
 
-	return (NULL);
+	mSize += slice->getSize();
+
+	return mList->append( slice );
 }
 
+size_t SP_BufferChain :: getSize() const
+{
+	return mSize;
+}
+
+int SP_BufferChain :: getCount() const
+{
+	return mList->getCount();
+}
+
+const SP_BufferSlice * SP_BufferChain :: getItem( int index ) const
+{
+	return (SP_BufferSlice*)mList->getItem( index );
+}
+
+SP_BufferSlice * SP_BufferChain :: takeItem( int index )
+{
+	SP_BufferSlice * slice = (SP_BufferSlice*)mList->takeItem( index );
+
+	if( NULL != slice ) mSize -= slice->getSize();
+
+	return slice;
+}
+
+void SP_BufferChain :: reset()
+{
+	for( int i = 0; i < mList->getCount(); i++ ) {
+		SP_BufferSlice * slice = (SP_BufferSlice*)mList->getItem( i );
+		delete slice;
+	}
+
+	mList->clean();
+	mSize = 0;
+}
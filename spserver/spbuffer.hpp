@@ -32,7 +32,14 @@ public:
 	void reserve( int len );
 	int getCapacity();
 
+	// make room for len more bytes and return the end of the data,
+	// the bytes written there are added by commit, NULL if out of memory
+	char * getWritable( int len );
+	void commit( int len );
+
+	// NUL-terminated, may grow the buffer to make room for the '\0'
 	const void * getBuffer() const;
+	// not terminated, never touches the buffer, use it with getSize()
 	const void * getRawBuffer() const;
 	size_t getSize() const;
 	int take( char * buffer, int len );
@@ -49,5 +56,55 @@ private:
 	friend class SP_IocpEventCallback;
 };
 
+class SP_ArrayList;
+
+// a read-only view of a segment, the segment is released with the slice
+class SP_BufferSlice {
+public:
+	// take over the buffer, the slice covers all the data of it
+	SP_BufferSlice( SP_Buffer * buffer );
+
+	~SP_BufferSlice();
+
+	const void * getData() const;
+	size_t getSize() const;
+
+private:
+	SP_BufferSlice( SP_BufferSlice & );
+	SP_BufferSlice & operator=( SP_BufferSlice & );
+
+	SP_Buffer * mBuffer;
+	const char * mData;
+	size_t mSize;
+};
+
+// a list of slices, data is moved in without copying
+class SP_BufferChain {
+public:
+	SP_BufferChain();
+	~SP_BufferChain();
+
+	// move all the data of buffer into the chain, buffer becomes empty
+	int append( SP_Buffer * buffer );
+
+	// take over the slice
+	int append( SP_BufferSlice * slice );
+
+	size_t getSize() const;
+
+	int getCount() const;
+	const SP_BufferSlice * getItem( int index ) const;
+	SP_BufferSlice * takeItem( int index );
+
+	void reset();
+
+private:
+	SP_BufferChain( SP_BufferChain & );
+	SP_BufferChain & operator=( SP_BufferChain & );
+
+	SP_ArrayList * mList;
+	size_t mSize;
+};
+
 #endif
 
@@ -23,6 +23,8 @@
 #include "spiochannel.hpp"
 #include "spioutils.hpp"
 #include "sprequest.hpp"
+#include "sprelay.hpp"
+#include "sptimerwheel.hpp"
 
 #include "event_msgqueue.h"
 
@@ -42,7 +44,13 @@ SP_Dispatcher :: SP_Dispatcher( SP_CompletionHandler * completionHandler, int ma
 
 	mCompletionHandler = completionHandler;
 
-	mPushQueue = msgqueue_new( mEventArg->getEventBase(), 0, onPush, mEventArg );
+	mPushQueue = msgqueue_new( mEventArg->getEventBase(), 0, onPush, this );
+
+	mTimerWheel = new SP_TimerWheel( eTimerTickMsec );
+	mTickEvent = (struct event*)malloc( sizeof( struct event ) );
+	mTicking = 0;
+
+	mExpiredList = new SP_ArrayList();
 }
 
 SP_Dispatcher :: ~SP_Dispatcher()
@@ -55,6 +63,16 @@ SP_Dispatcher :: ~SP_Dispatcher()
 
 	//msgqueue_destroy( (struct event_msgqueue*)mPushQueue );
 
+	if( mTicking ) event_del( mTickEvent );
+	free( mTickEvent );
+	mTickEvent = NULL;
+
+	delete mTimerWheel;
+	mTimerWheel = NULL;
+
+	delete mExpiredList;
+	mExpiredList = NULL;
+
 	delete mEventArg;
 	mEventArg = NULL;
 }
@@ -161,33 +179,53 @@ int SP_Dispatcher :: start()
 }
 
 typedef struct tagSP_PushArg {
-	int mType;      // 0 : fd, 1 : timer
+	int mType;      // 0 : fd, 1 : timer, 2 : relay, 3 : connect, 4 : expired timers
 
 	// for push fd
 	int mFd;
+	int mRelayFd;
+	SP_RelayHandler * mRelayHandler;
 	SP_Handler * mHandler;
 	SP_IOChannel * mIOChannel;
 	int mNeedStart;
 
 	// for push timer
 	struct timeval mTimeout;
-	struct event mTimerEvent;
+	SP_TimerNode_t mTimerNode;
 	SP_TimerHandler * mTimerHandler;
+	int mRunInLoop;
+	SP_Dispatcher * mDispatcher;
 	SP_EventArg * mEventArg;
 	void * mPushQueue;
+
+	// for expired timers, a chunk of the timers expired in one tick, handled by one task
+	SP_ArrayList * mTimerList;
+
+	// for connect, mFd/mTimeout/mEventArg are used too
+	struct event mConnectEvent;
+	SP_ConnectHandler * mConnectHandler;
+	int mError;
 } SP_PushArg_t;
 
 void SP_Dispatcher :: onPush( void * queueData, void * arg )
 {
 	SP_PushArg_t * pushArg = (SP_PushArg_t*)queueData;
-	SP_EventArg * eventArg = (SP_EventArg*)arg;
+	SP_Dispatcher * dispatcher = (SP_Dispatcher*)arg;
+	SP_EventArg * eventArg = dispatcher->mEventArg;
 
 	if( 0 == pushArg->mType ) {
 		SP_Sid_t sid;
 		sid.mKey = eventArg->getSessionManager()->allocKey( &sid.mSeq );
-		assert( sid.mKey > 0 );
+		if( 0 == sid.mKey ) {
+			sp_syslog( LOG_WARNING, "Cannot allocate session key, refuse fd %d", pushArg->mFd );
+			delete pushArg->mHandler;
+			delete pushArg->mIOChannel;
+			sp_close( pushArg->mFd );
+			free( pushArg );
+			return;
+		}
 
-		SP_Session * session = new SP_Session( sid );
+		SP_Session * session = eventArg->getSessionPool()->get( sid );
 
 		char clientIP[ 32 ] = { 0 };
 		{
@@ -210,6 +248,7 @@ void SP_Dispatcher :: onPush( void * queueData, void * arg )
 				SP_EventCallback::onRead, session );
 		event_set( session->getWriteEvent(), pushArg->mFd, EV_WRITE,
 				SP_EventCallback::onWrite, session );
+		SP_TimerWheel::initNode( session->getTimerNode(), SP_EventCallback::onTimeout, session );
 
 		if( pushArg->mNeedStart ) {
 			SP_EventHelper::doStart( session );
@@ -219,10 +258,21 @@ void SP_Dispatcher :: onPush( void * queueData, void * arg )
 		}
 
 		free( pushArg );
+	} else if( 2 == pushArg->mType ) {
+		SP_Relay::start( eventArg, pushArg->mFd, pushArg->mRelayFd, pushArg->mRelayHandler );
+		free( pushArg );
+	} else if( 3 == pushArg->mType ) {
+		if( 0 == pushArg->mError ) {
+			event_set( &( pushArg->mConnectEvent ), pushArg->mFd, EV_WRITE, onConnect, pushArg );
+			event_base_set( eventArg->getEventBase(), &( pushArg->mConnectEvent ) );
+			event_add( &( pushArg->mConnectEvent ),
+					pushArg->mTimeout.tv_sec > 0 ? &( pushArg->mTimeout ) : NULL );
+		} else {
+			eventArg->getInputResultQueue()->push( new SP_SimpleTask( connected, pushArg, 1 ) );
+		}
 	} else {
-		event_set( &( pushArg->mTimerEvent ), -1, 0, onTimer, pushArg );
-		event_base_set( eventArg->getEventBase(), &( pushArg->mTimerEvent ) );
-		event_add( &( pushArg->mTimerEvent ), &( pushArg->mTimeout ) );
+		SP_TimerWheel::initNode( &( pushArg->mTimerNode ), onTimer, pushArg );
+		dispatcher->addTimer( pushArg );
 	}
 }
 
@@ -247,41 +297,141 @@ int SP_Dispatcher :: push( int fd, SP_Handler * handler,
 	return msgqueue_push( (struct event_msgqueue*)mPushQueue, arg );
 }
 
-void SP_Dispatcher :: onTimer( int, short, void * arg )
+void SP_Dispatcher :: addTimer( void * arg )
 {
 	SP_PushArg_t * pushArg = (SP_PushArg_t*)arg;
 
-	pushArg->mEventArg->getInputResultQueue()->push(
-		new SP_SimpleTask( timer, pushArg, 1 ) );
+	// the wheel stops when it is empty, bring it up to date first
+	if( 0 == mTicking ) mTimerWheel->advance();
+
+	long long msec = pushArg->mTimeout.tv_sec * 1000LL + pushArg->mTimeout.tv_usec / 1000;
+	mTimerWheel->schedule( &( pushArg->mTimerNode ), msec < 0x7fffffff ? (int)msec : 0x7fffffff );
+
+	// the new timer may expire before the armed tick
+	addTick();
 }
 
-void SP_Dispatcher :: timer( void * arg )
+void SP_Dispatcher :: addTick()
+{
+	int msec = mTimerWheel->getNextTimeout();
+
+	if( msec < 0 ) {
+		if( mTicking ) event_del( mTickEvent );
+		mTicking = 0;
+		return;
+	}
+
+	if( 0 == mTicking ) {
+		event_set( mTickEvent, -1, 0, onTick, this );
+		event_base_set( mEventArg->getEventBase(), mTickEvent );
+		mTicking = 1;
+	}
+
+	struct timeval tick = { msec / 1000, ( msec % 1000 ) * 1000 };
+	event_add( mTickEvent, &tick );
+}
+
+void SP_Dispatcher :: onTick( int, short, void * arg )
+{
+	SP_Dispatcher * dispatcher = (SP_Dispatcher*)arg;
+
+	dispatcher->mTimerWheel->advance();
+
+	// the timers expired in this tick are split into one chunk per worker,
+	// a few timers are kept in one task
+	SP_ArrayList * expiredList = dispatcher->mExpiredList;
+	int count = expiredList->getCount();
+
+	int chunkSize = ( count + dispatcher->mMaxThreads - 1 ) / dispatcher->mMaxThreads;
+	if( chunkSize < eTimerChunkMin ) chunkSize = eTimerChunkMin;
+
+	for( int begin = 0; begin < count; begin += chunkSize ) {
+		int end = begin + chunkSize < count ? begin + chunkSize : count;
+
+		SP_PushArg_t * batch = (SP_PushArg_t*)malloc( sizeof( SP_PushArg_t ) );
+		batch->mType = 4;
+		batch->mTimerList = new SP_ArrayList( end - begin );
+		batch->mEventArg = dispatcher->mEventArg;
+		batch->mPushQueue = dispatcher->mPushQueue;
+
+		for( int i = begin; i < end; i++ ) {
+			batch->mTimerList->append( (void*)expiredList->getItem( i ) );
+		}
+
+		dispatcher->mEventArg->getInputResultQueue()->push(
+			new SP_SimpleTask( timer, batch, 1 ) );
+	}
+
+	expiredList->clean();
+
+	dispatcher->addTick();
+}
+
+void SP_Dispatcher :: onTimer( SP_TimerNode_t * node, void * arg )
 {
 	SP_PushArg_t * pushArg = (SP_PushArg_t*)arg;
-	SP_TimerHandler * handler = pushArg->mTimerHandler;
-	SP_EventArg * eventArg = pushArg->mEventArg;
+	SP_Dispatcher * dispatcher = pushArg->mDispatcher;
+
+	if( 0 == pushArg->mRunInLoop ) {
+		dispatcher->mExpiredList->append( pushArg );
+		return;
+	}
 
 	SP_Sid_t sid;
 	sid.mKey = SP_Sid_t::eTimerKey;
 	sid.mSeq = SP_Sid_t::eTimerSeq;
 	SP_Response * response = new SP_Response( sid );
-	if( 0 == handler->handle( response, &( pushArg->mTimeout ) ) ) {
-		msgqueue_push( (struct event_msgqueue*)pushArg->mPushQueue, arg );
+
+	if( 0 == pushArg->mTimerHandler->handle( response, &( pushArg->mTimeout ) ) ) {
+		dispatcher->addTimer( pushArg );
 	} else {
 		delete pushArg->mTimerHandler;
 		free( pushArg );
 	}
 
+	// already in the event loop thread
+	SP_EventCallback::onResponse( response, dispatcher->mEventArg );
+}
+
+void SP_Dispatcher :: timer( void * arg )
+{
+	SP_PushArg_t * batch = (SP_PushArg_t*)arg;
+	SP_ArrayList * timerList = batch->mTimerList;
+	SP_EventArg * eventArg = batch->mEventArg;
+
+	// the timers in one chunk share one response, all of them send from the timer sid
+	SP_Sid_t sid;
+	sid.mKey = SP_Sid_t::eTimerKey;
+	sid.mSeq = SP_Sid_t::eTimerSeq;
+	SP_Response * response = new SP_Response( sid );
+
+	for( int i = 0; i < timerList->getCount(); i++ ) {
+		SP_PushArg_t * pushArg = (SP_PushArg_t*)timerList->getItem( i );
+
+		// re-arm at once, a slow handler must not delay the other timers of the chunk
+		if( 0 == pushArg->mTimerHandler->handle( response, &( pushArg->mTimeout ) ) ) {
+			msgqueue_push( (struct event_msgqueue*)batch->mPushQueue, pushArg );
+		} else {
+			delete pushArg->mTimerHandler;
+			free( pushArg );
+		}
+	}
+
+	delete timerList;
+	free( batch );
+
 	msgqueue_push( (struct event_msgqueue*)eventArg->getResponseQueue(), response );
 }
 
-int SP_Dispatcher :: push( const struct timeval * timeout, SP_TimerHandler * handler )
+int SP_Dispatcher :: push( const struct timeval * timeout, SP_TimerHandler * handler, int runInLoop )
 {
 	SP_PushArg_t * arg = (SP_PushArg_t*)malloc( sizeof( SP_PushArg_t ) );
 
 	arg->mType = 1;
 	arg->mTimeout = *timeout;
 	arg->mTimerHandler = handler;
+	arg->mRunInLoop = runInLoop;
+	arg->mDispatcher = this;
 	arg->mEventArg = mEventArg;
 	arg->mPushQueue = mPushQueue;
 
@@ -293,3 +443,106 @@ int SP_Dispatcher :: push( SP_Response * response )
 	return msgqueue_push( (struct event_msgqueue*)mEventArg->getResponseQueue(), response );
 }
 
+int SP_Dispatcher :: relay( int fd1, int fd2, SP_RelayHandler * handler )
+{
+	SP_PushArg_t * arg = (SP_PushArg_t*)malloc( sizeof( SP_PushArg_t ) );
+	arg->mType = 2;
+	arg->mFd = fd1;
+	arg->mRelayFd = fd2;
+	arg->mRelayHandler = handler;
+
+	SP_IOUtils::setNonblock( fd1 );
+	SP_IOUtils::setNonblock( fd2 );
+
+	int ret = msgqueue_push( (struct event_msgqueue*)mPushQueue, arg );
+	if( 0 != ret ) {
+		if( NULL != handler ) delete handler;
+		free( arg );
+	}
+
+	return ret;
+}
+
+
+int SP_Dispatcher :: connect( const char * ip, int port, int timeout, SP_ConnectHandler * handler )
+{
+	SP_PushArg_t * arg = (SP_PushArg_t*)malloc( sizeof( SP_PushArg_t ) );
+
+	arg->mType = 3;
+	arg->mTimeout.tv_sec = timeout > 0 ? timeout : 0;
+	arg->mTimeout.tv_usec = 0;
+	arg->mEventArg = mEventArg;
+	arg->mPushQueue = mPushQueue;
+	arg->mConnectHandler = handler;
+	arg->mError = 0;
+
+	arg->mFd = socket( AF_INET, SOCK_STREAM, IPPROTO_IP );
+	if( arg->mFd >= 0 ) {
+		SP_IOUtils::setNonblock( arg->mFd );
+
+		struct sockaddr_in inAddr;
+		memset( &inAddr, 0, sizeof( inAddr ) );
+		inAddr.sin_family = AF_INET;
+		inAddr.sin_addr.s_addr = inet_addr( ip );
+		inAddr.sin_port = htons( port );
+
+		if( 0 != ::connect( arg->mFd, (struct sockaddr*)&inAddr, sizeof( inAddr ) )
+				&& EINPROGRESS != errno ) {
+			arg->mError = errno;
+		}
+	} else {
+		arg->mError = errno;
+	}
+
+	// the result is reported by a worker thread even if connect fails at once
+	int ret = msgqueue_push( (struct event_msgqueue*)mPushQueue, arg );
+
+	if( 0 != ret ) {
+		if( arg->mFd >= 0 ) sp_close( arg->mFd );
+		delete handler;
+		free( arg );
+	}
+
+	return ret;
+}
+
+void SP_Dispatcher :: onConnect( int fd, short events, void * arg )
+{
+	SP_PushArg_t * pushArg = (SP_PushArg_t*)arg;
+
+	if( EV_TIMEOUT & events ) {
+		pushArg->mError = ETIMEDOUT;
+	} else {
+		int error = 0;
+		socklen_t len = sizeof( error );
+		if( 0 != getsockopt( fd, SOL_SOCKET, SO_ERROR, (char*)&error, &len ) ) error = errno;
+		pushArg->mError = error;
+	}
+
+	pushArg->mEventArg->getInputResultQueue()->push(
+		new SP_SimpleTask( connected, pushArg, 1 ) );
+}
+
+void SP_Dispatcher :: connected( void * arg )
+{
+	SP_PushArg_t * pushArg = (SP_PushArg_t*)arg;
+	SP_EventArg * eventArg = pushArg->mEventArg;
+
+	int fd = pushArg->mFd;
+	if( 0 != pushArg->mError && fd >= 0 ) {
+		sp_close( fd );
+		fd = -1;
+	}
+
+	SP_Sid_t sid;
+	sid.mKey = SP_Sid_t::ePushKey;
+	sid.mSeq = SP_Sid_t::ePushSeq;
+	SP_Response * response = new SP_Response( sid );
+
+	pushArg->mConnectHandler->handle( fd, pushArg->mError, response );
+
+	delete pushArg->mConnectHandler;
+	free( pushArg );
+
+	msgqueue_push( (struct event_msgqueue*)eventArg->getResponseQueue(), response );
+}
@@ -14,10 +14,17 @@ class SP_Handler;
 class SP_Message;
 class SP_BlockingQueue;
 class SP_TimerHandler;
+class SP_ConnectHandler;
+class SP_RelayHandler;
 class SP_IOChannel;
 class SP_Response;
 
 class SP_EventArg;
+class SP_TimerWheel;
+class SP_ArrayList;
+
+struct event;
+typedef struct tagSP_TimerNode SP_TimerNode_t;
 
 class SP_Dispatcher {
 public:
@@ -50,16 +57,40 @@ public:
 
 	/**
 	 * @brief register a timer into dispatcher
-	 * @param timeout : the interval for the timer
+	 * @param timeout : the interval for the timer, rounded up to 10 milliseconds
+	 * @param runInLoop : 0 - call handler in a worker thread, the timers which expire
+	 *                    at the same tick are split into one task per worker
+	 *                    1 - call handler in the event loop thread, for cheap handlers
+	 *                    which never block
 	 * @note  handler will be deleted by dispatcher when the timer is terminated
 	 */
-	int push( const struct timeval * timeout, SP_TimerHandler * handler );
+	int push( const struct timeval * timeout, SP_TimerHandler * handler, int runInLoop = 0 );
 
 	/**
 	 * @brief push a response
 	 */
 	int push( SP_Response * response );
 
+	/**
+	 * @brief forward the data between fd1 and fd2 in the event loop,
+	 *        with splice when it is available, no worker is involved
+	 * @param handler : optional, told when the relay is finished
+	 * @return 0 : OK, -1 : Fail
+	 * @note  both fds will be closed by dispatcher when the relay is finished,
+	 *        handler will be deleted by dispatcher after its close is called,
+	 *        or at once without close on Fail
+	 */
+	int relay( int fd1, int fd2, SP_RelayHandler * handler = NULL );
+
+	/**
+	 * @brief connect to ip:port without blocking, the event loop waits for the result
+	 * @param timeout : seconds, 0 for no timeout
+	 * @return 0 : OK, -1 : Fail
+	 * @note  handler is called by a worker thread with the result,
+	 *        and will be deleted by dispatcher after that, or at once on Fail
+	 */
+	int connect( const char * ip, int port, int timeout, SP_ConnectHandler * handler );
+
 private:
 	int mIsShutdown;
 	int mIsRunning;
@@ -70,6 +101,16 @@ private:
 
 	void * mPushQueue;
 
+	// the timers pushed by push( timeout, handler ), only used by the event loop thread,
+	// the tick event is armed for the next expiry of the wheel, not for every tick
+	enum { eTimerTickMsec = 10, eTimerChunkMin = 16 };
+	SP_TimerWheel * mTimerWheel;
+	struct event * mTickEvent;
+	int mTicking;
+
+	// the timers expired in one tick, handed to the workers in chunks of eTimerChunkMin at least
+	SP_ArrayList * mExpiredList;
+
 	int start();
 
 	static sp_thread_result_t SP_THREAD_CALL eventLoop( void * arg );
@@ -78,8 +119,17 @@ private:
 
 	static void outputCompleted( void * arg );
 
-	static void onTimer( int, short, void * arg );
+	static void onTick( int, short, void * arg );
+	static void onTimer( SP_TimerNode_t * node, void * arg );
 	static void timer( void * arg );
+
+	void addTimer( void * pushArg );
+
+	// arm the tick event for the next expiry, or stop it when the wheel is empty
+	void addTick();
+
+	static void onConnect( int fd, short events, void * arg );
+	static void connected( void * arg );
 };
 
 #endif
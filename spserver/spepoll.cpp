@@ -0,0 +1,239 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "spporting.hpp"
+
+#include "spepoll.hpp"
+#include "speventcb.hpp"
+#include "spsession.hpp"
+#include "spresponse.hpp"
+
+#include "event.h"
+
+#if defined( __linux__ ) && ! defined( SP_NO_EPOLL )
+#include <sys/epoll.h>
+#define SP_HAVE_EPOLL
+#endif
+
+#ifndef EPOLLRDHUP
+#define EPOLLRDHUP 0
+#endif
+
+struct tagSP_ReadyEntry {
+	SP_Session * mSession;
+	SP_Sid_t mSid;
+};
+
+#ifdef SP_HAVE_EPOLL
+
+SP_EpollReactor * SP_EpollReactor :: create( SP_EventArg * eventArg )
+{
+	int epollFd = epoll_create( 1024 );
+	if( epollFd < 0 ) {
+		sp_syslog( LOG_WARNING, "epoll_create failed, errno %d, %s", errno, strerror( errno ) );
+		return NULL;
+	}
+
+	return new SP_EpollReactor( eventArg, epollFd );
+}
+
+#else
+
+SP_EpollReactor * SP_EpollReactor :: create( SP_EventArg * eventArg )
+{
+	return NULL;
+}
+
+#endif
+
+SP_EpollReactor :: SP_EpollReactor( SP_EventArg * eventArg, int epollFd )
+{
+	mEventArg = eventArg;
+	mEpollFd = epollFd;
+
+	mPollEvent = (struct event*)malloc( sizeof( struct event ) );
+	event_set( mPollEvent, mEpollFd, EV_READ | EV_PERSIST, onPoll, this );
+	event_base_set( mEventArg->getEventBase(), mPollEvent );
+	event_add( mPollEvent, NULL );
+
+	mReadyEvent = (struct event*)malloc( sizeof( struct event ) );
+	event_set( mReadyEvent, -1, 0, onReady, this );
+	event_base_set( mEventArg->getEventBase(), mReadyEvent );
+	mScheduled = 0;
+
+	mReadyMax = mProcessMax = 64;
+	mReadyCount = 0;
+	mReadyList = (SP_ReadyEntry_t*)malloc( sizeof( SP_ReadyEntry_t ) * mReadyMax );
+	mProcessList = (SP_ReadyEntry_t*)malloc( sizeof( SP_ReadyEntry_t ) * mProcessMax );
+}
+
+SP_EpollReactor :: ~SP_EpollReactor()
+{
+	event_del( mPollEvent );
+	free( mPollEvent );
+
+	event_del( mReadyEvent );
+	free( mReadyEvent );
+
+	sp_close( mEpollFd );
+
+	free( mReadyList );
+	free( mProcessList );
+}
+
+int SP_EpollReactor :: add( SP_Session * session, int fd )
+{
+	session->setReady( 0 );
+
+#ifdef SP_HAVE_EPOLL
+	struct epoll_event event;
+	memset( &event, 0, sizeof( event ) );
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = session;
+
+	if( 0 != epoll_ctl( mEpollFd, EPOLL_CTL_ADD, fd, &event ) ) {
+		sp_syslog( LOG_WARNING, "epoll_ctl add fd %d failed, errno %d, %s",
+				fd, errno, strerror( errno ) );
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+void SP_EpollReactor :: del( SP_Session * session, int fd )
+{
+#ifdef SP_HAVE_EPOLL
+	// the fd is closed by a worker later, the session may be reused before that
+	struct epoll_event event;
+	memset( &event, 0, sizeof( event ) );
+	epoll_ctl( mEpollFd, EPOLL_CTL_DEL, fd, &event );
+#endif
+
+	session->setReady( 0 );
+}
+
+void SP_EpollReactor :: want( SP_Session * session, short events )
+{
+	if( session->getReady() & events ) append( session );
+}
+
+void SP_EpollReactor :: append( SP_Session * session )
+{
+	if( mReadyCount >= mReadyMax ) {
+		mReadyMax = mReadyMax * 2;
+		mReadyList = (SP_ReadyEntry_t*)realloc( mReadyList, sizeof( SP_ReadyEntry_t ) * mReadyMax );
+	}
+
+	SP_ReadyEntry_t * entry = &( mReadyList[ mReadyCount++ ] );
+	entry->mSession = session;
+	entry->mSid = session->getSid();
+
+	schedule();
+}
+
+void SP_EpollReactor :: schedule()
+{
+	if( mScheduled ) return;
+
+	// a zero timeout, run at the next loop without blocking
+	struct timeval timeout = { 0, 0 };
+	event_add( mReadyEvent, &timeout );
+	mScheduled = 1;
+}
+
+void SP_EpollReactor :: onPoll( int fd, short events, void * arg )
+{
+	SP_EpollReactor * reactor = (SP_EpollReactor*)arg;
+
+	reactor->poll();
+	reactor->process();
+}
+
+void SP_EpollReactor :: onReady( int fd, short events, void * arg )
+{
+	SP_EpollReactor * reactor = (SP_EpollReactor*)arg;
+
+	reactor->mScheduled = 0;
+	reactor->process();
+}
+
+void SP_EpollReactor :: poll()
+{
+#ifdef SP_HAVE_EPOLL
+	struct epoll_event eventList[ eMaxEvents ];
+
+	for( ; ; ) {
+		int count = epoll_wait( mEpollFd, eventList, eMaxEvents, 0 );
+
+		for( int i = 0; i < count; i++ ) {
+			SP_Session * session = (SP_Session*)eventList[ i ].data.ptr;
+			int flags = eventList[ i ].events;
+
+			short ready = 0;
+			if( flags & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) ready |= EV_READ;
+			if( flags & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) ) ready |= EV_WRITE;
+
+			// only the new edges, a session which was ready is in the list already
+			short edge = ready & ~session->getReady();
+			session->setReady( session->getReady() | ready );
+
+			short wanted = 0;
+			if( session->getReading() ) wanted |= EV_READ;
+			if( session->getWriting() ) wanted |= EV_WRITE;
+
+			if( edge & wanted ) append( session );
+		}
+
+		if( count < eMaxEvents ) break;
+	}
+#endif
+}
+
+void SP_EpollReactor :: process()
+{
+	SP_ReadyEntry_t * list = mReadyList;
+	int count = mReadyCount, max = mReadyMax;
+
+	mReadyList = mProcessList;
+	mReadyMax = mProcessMax;
+	mReadyCount = 0;
+
+	mProcessList = list;
+	mProcessMax = max;
+
+	SP_SessionManager * manager = mEventArg->getSessionManager();
+
+	for( int i = 0; i < count; i++ ) {
+		SP_ReadyEntry_t * entry = &( list[ i ] );
+
+		// the session may be closed by an entry before
+		uint16_t seq = 0;
+		SP_Session * session = manager->get( entry->mSid.mKey, &seq );
+		if( session != entry->mSession || seq != entry->mSid.mSeq ) continue;
+
+		int fd = EVENT_FD( session->getWriteEvent() );
+
+		if( session->getWriting() && ( session->getReady() & EV_WRITE ) ) {
+			SP_EventCallback::onWrite( fd, EV_WRITE, session );
+
+			session = manager->get( entry->mSid.mKey, &seq );
+			if( session != entry->mSession || seq != entry->mSid.mSeq ) continue;
+		}
+
+		// the read event is removed when the session is going to exit
+		if( session->getReading() && ( session->getReady() & EV_READ )
+				&& SP_Session::eNormal == session->getStatus() ) {
+			SP_EventCallback::onRead( fd, EV_READ, session );
+		}
+	}
+
+	if( mReadyCount > 0 ) schedule();
+}
+
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spepoll_hpp__
+#define __spepoll_hpp__
+
+class SP_EventArg;
+class SP_Session;
+
+struct event;
+
+typedef struct tagSP_ReadyEntry SP_ReadyEntry_t;
+
+// linux edge-triggered epoll for the sessions of one event loop, the epoll fd is
+// watched by libevent as a normal fd; each session is registered once when it is
+// accepted, and the readiness of its fd is kept in the session, so reading and
+// writing need no epoll_ctl
+class SP_EpollReactor {
+public:
+	// return NULL if edge-triggered epoll is not supported
+	static SP_EpollReactor * create( SP_EventArg * eventArg );
+
+	~SP_EpollReactor();
+
+	// return 0 : OK, -1 : Fail
+	int add( SP_Session * session, int fd );
+	void del( SP_Session * session, int fd );
+
+	// the session waits for events, the ready ones are handled in this loop,
+	// the others when their edges come
+	void want( SP_Session * session, short events );
+
+private:
+	SP_EpollReactor( SP_EventArg * eventArg, int epollFd );
+
+	SP_EpollReactor( SP_EpollReactor & );
+	SP_EpollReactor & operator=( SP_EpollReactor & );
+
+	enum { eMaxEvents = 256 };
+
+	static void onPoll( int fd, short events, void * arg );
+	static void onReady( int fd, short events, void * arg );
+
+	void poll();
+
+	void append( SP_Session * session );
+
+	// handle the ready sessions once, the ones which are ready again are left to
+	// the next loop, so the other events and the worker tasks are not starved
+	void process();
+
+	void schedule();
+
+	SP_EventArg * mEventArg;
+	int mEpollFd;
+
+	struct event * mPollEvent;
+	struct event * mReadyEvent;
+	int mScheduled;
+
+	SP_ReadyEntry_t * mReadyList;
+	int mReadyCount, mReadyMax;
+
+	// the list in process, entries appended meanwhile go to mReadyList
+	SP_ReadyEntry_t * mProcessList;
+	int mProcessMax;
+};
+
+#endif
+
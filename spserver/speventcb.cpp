@@ -11,6 +11,7 @@
 #include <stdlib.h>
 
 #include "spporting.hpp"
+#include "spthread.hpp"
 
 #include "speventcb.hpp"
 #include "spexecutor.hpp"
@@ -24,32 +25,61 @@
 #include "spmsgblock.hpp"
 #include "spiochannel.hpp"
 #include "spioutils.hpp"
+#include "sptimerwheel.hpp"
+#include "spepoll.hpp"
 
 #include "event_msgqueue.h"
 #include "event.h"
 
-SP_EventArg :: SP_EventArg( int timeout )
+SP_EventArg :: SP_EventArg( int timeout, int edgeTriggered )
 {
 	mEventBase = (struct event_base*)event_init();
 
 	mResponseQueue = msgqueue_new( mEventBase, 0,
 			SP_EventCallback::onResponse, this );
 
-	mInputResultQueue = new SP_BlockingQueue();
+	// both queues are pushed and popped by the event loop thread only
+	mInputResultQueue = new SP_BlockingQueue( SP_BlockingQueue::eSPSC );
 
-	mOutputResultQueue = new SP_BlockingQueue();
+	mOutputResultQueue = new SP_BlockingQueue( SP_BlockingQueue::eSPSC );
 
 	mSessionManager = new SP_SessionManager();
+	mSessionPool = new SP_SessionPool();
 
 	mTimeout = timeout;
+
+	mTimerWheel = new SP_TimerWheel( 1000 );
+
+	mTickEvent = (struct event*)malloc( sizeof( struct event ) );
+	addTick();
+
+	mEpollReactor = NULL;
+	if( edgeTriggered ) {
+		mEpollReactor = SP_EpollReactor::create( this );
+		if( NULL == mEpollReactor ) {
+			sp_syslog( LOG_WARNING, "edge-triggered epoll is not available, use libevent" );
+		}
+	}
+
+	mReactorList = NULL;
+	mReactorCount = 1;
+	mReactorIndex = 0;
 }
 
 SP_EventArg :: ~SP_EventArg()
 {
+	if( NULL != mEpollReactor ) delete mEpollReactor;
+
+	event_del( mTickEvent );
+	free( mTickEvent );
+
+	delete mTimerWheel;
+
 	delete mInputResultQueue;
 	delete mOutputResultQueue;
 
 	delete mSessionManager;
+	delete mSessionPool;
 
 	//msgqueue_destroy( (struct event_msgqueue*)mResponseQueue );
 	//event_base_free( mEventBase );
@@ -80,6 +110,11 @@ SP_SessionManager * SP_EventArg :: getSessionManager() const
 	return mSessionManager;
 }
 
+SP_SessionPool * SP_EventArg :: getSessionPool() const
+{
+	return mSessionPool;
+}
+
 void SP_EventArg :: setTimeout( int timeout )
 {
 	mTimeout = timeout;
@@ -90,8 +125,73 @@ int SP_EventArg :: getTimeout() const
 	return mTimeout;
 }
 
+SP_TimerWheel * SP_EventArg :: getTimerWheel() const
+{
+	return mTimerWheel;
+}
+
+SP_EpollReactor * SP_EventArg :: getEpollReactor() const
+{
+	return mEpollReactor;
+}
+
+void SP_EventArg :: addTick()
+{
+	struct timeval timeout;
+	timeout.tv_sec = mTimerWheel->getTickMsec() / 1000;
+	timeout.tv_usec = ( mTimerWheel->getTickMsec() % 1000 ) * 1000;
+
+	event_set( mTickEvent, -1, 0, onTick, this );
+	event_base_set( mEventBase, mTickEvent );
+	event_add( mTickEvent, &timeout );
+}
+
+void SP_EventArg :: onTick( int fd, short events, void * arg )
+{
+	SP_EventArg * eventArg = (SP_EventArg*)arg;
+
+	eventArg->mTimerWheel->advance();
+
+	eventArg->addTick();
+}
+
+void SP_EventArg :: setReactorList( SP_EventArg ** reactorList, int reactorCount, int reactorIndex )
+{
+	mReactorList = reactorList;
+	mReactorCount = reactorCount;
+	mReactorIndex = reactorIndex;
+
+	mSessionManager->setKeyPrefix( reactorIndex );
+}
+
+int SP_EventArg :: getReactorCount() const
+{
+	return mReactorCount;
+}
+
+int SP_EventArg :: getReactorIndex() const
+{
+	return mReactorIndex;
+}
+
+SP_EventArg * SP_EventArg :: getReactor( int reactorIndex ) const
+{
+	if( reactorIndex == mReactorIndex ) return (SP_EventArg*)this;
+
+	if( NULL != mReactorList && reactorIndex >= 0 && reactorIndex < mReactorCount ) {
+		return mReactorList[ reactorIndex ];
+	}
+
+	return NULL;
+}
+
 //-------------------------------------------------------------------
 
+typedef struct tagSP_HandoffArg {
+	int mFd;
+	struct sockaddr_in mAddr;
+} SP_HandoffArg_t;
+
 void SP_EventCallback :: onAccept( int fd, short events, void * arg )
 {
 	int clientFD;
@@ -99,64 +199,70 @@ void SP_EventCallback :: onAccept( int fd, short events, void * arg )
 	socklen_t addrLen = sizeof( addr );
 
 	SP_AcceptArg_t * acceptArg = (SP_AcceptArg_t*)arg;
-	SP_EventArg * eventArg = acceptArg->mEventArg;
-
-	clientFD = accept( fd, (struct sockaddr *)&addr, &addrLen );
-	if( -1 == clientFD ) {
-		sp_syslog( LOG_WARNING, "accept failed" );
-		return;
-	}
-
-	if( SP_IOUtils::setNonblock( clientFD ) < 0 ) {
-		sp_syslog( LOG_WARNING, "failed to set client socket non-blocking" );
-	}
 
-	SP_Sid_t sid;
-	sid.mKey = eventArg->getSessionManager()->allocKey( &sid.mSeq );
-	assert( sid.mKey > 0 );
+	// drain the backlog, but not more than mAcceptBatch connections per wakeup
+	for( int count = 0; count < acceptArg->mAcceptBatch; ) {
+		addrLen = sizeof( addr );
+
+#if defined( SOCK_NONBLOCK ) && defined( SOCK_CLOEXEC )
+		clientFD = accept4( fd, (struct sockaddr *)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC );
+#else
+		clientFD = accept( fd, (struct sockaddr *)&addr, &addrLen );
+#endif
+
+		if( -1 == clientFD ) {
+#ifdef WIN32
+			int isEmpty = ( WSAEWOULDBLOCK == WSAGetLastError() );
+#else
+			if( EINTR == errno ) continue;
+			int isEmpty = ( EAGAIN == errno || EWOULDBLOCK == errno );
+#endif
+			if( ! isEmpty ) {
+				sp_syslog( LOG_WARNING, "accept failed, errno %d, %s", errno, strerror( errno ) );
+			}
+			break;
+		}
 
-	SP_Session * session = new SP_Session( sid );
+		count++;
 
-	char strip[ 32 ] = { 0 };
-	SP_IOUtils::inetNtoa( &( addr.sin_addr ), strip, sizeof( strip ) );
-	session->getRequest()->setClientIP( strip );
-	session->getRequest()->setClientPort( ntohs( addr.sin_port ) );
+#if !defined( SOCK_NONBLOCK ) || !defined( SOCK_CLOEXEC )
+		if( SP_IOUtils::setNonblock( clientFD ) < 0 ) {
+			sp_syslog( LOG_WARNING, "failed to set client socket non-blocking" );
+		}
+#endif
 
-	if( 0 == getsockname( clientFD, (struct sockaddr*)&addr, &addrLen ) ) {
-		SP_IOUtils::inetNtoa( &( addr.sin_addr ), strip, sizeof( strip ) );
-		session->getRequest()->setServerIP( strip );
-	}
+		if( acceptArg->mReactorCount > 1 ) {
+			SP_AcceptArg_t * target = acceptArg->mReactorList[
+					acceptArg->mReactorIndex++ % acceptArg->mReactorCount ];
 
-	if( NULL != session ) {
-		eventArg->getSessionManager()->put( sid.mKey, sid.mSeq, session );
+			if( target != acceptArg ) {
+				SP_HandoffArg_t * handoff = (SP_HandoffArg_t*)malloc( sizeof( SP_HandoffArg_t ) );
+				handoff->mFd = clientFD;
+				handoff->mAddr = addr;
 
-		session->setHandler( acceptArg->mHandlerFactory->create() );
-		session->setIOChannel( acceptArg->mIOChannelFactory->create() );
-		session->setArg( eventArg );
+				if( 0 != msgqueue_push( (struct event_msgqueue*)target->mHandoffQueue, handoff ) ) {
+					sp_syslog( LOG_WARNING, "cannot hand off fd %d to reactor", clientFD );
+					sp_close( clientFD );
+					free( handoff );
+				}
 
-		event_set( session->getReadEvent(), clientFD, EV_READ, onRead, session );
-		event_set( session->getWriteEvent(), clientFD, EV_WRITE, onWrite, session );
+				continue;
+			}
+		}
 
-		if( eventArg->getSessionManager()->getCount() > acceptArg->mMaxConnections
-				|| eventArg->getInputResultQueue()->getLength() >= acceptArg->mReqQueueSize ) {
-			sp_syslog( LOG_WARNING, "System busy, session.count %d [%d], queue.length %d [%d]",
-				eventArg->getSessionManager()->getCount(), acceptArg->mMaxConnections,
-				eventArg->getInputResultQueue()->getLength(), acceptArg->mReqQueueSize );
+		SP_EventHelper::doAccept( acceptArg, clientFD, &addr );
+	}
+}
 
-			SP_Message * msg = new SP_Message();
-			msg->getMsg()->append( acceptArg->mRefusedMsg );
-			msg->getMsg()->append( "\r\n" );
-			session->getOutList()->append( msg );
-			session->setStatus( SP_Session::eExit );
+void SP_EventCallback :: onHandoff( void * queueData, void * arg )
+{
+	SP_HandoffArg_t * handoff = (SP_HandoffArg_t*)queueData;
+	SP_AcceptArg_t * acceptArg = (SP_AcceptArg_t*)arg;
 
-			addEvent( session, EV_WRITE, clientFD );
-		} else {
-			SP_EventHelper::doStart( session );
-		}
-	} else {
-		eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
-		sp_close( clientFD );
-		sp_syslog( LOG_WARNING, "Out of memory, cannot allocate session object!" );
+	// NULL is pushed to wake up the event loop on shutdown
+	if( NULL != handoff ) {
+		SP_EventHelper::doAccept( acceptArg, handoff->mFd, &( handoff->mAddr ) );
+		free( handoff );
 	}
 }
 
@@ -198,18 +304,11 @@ void SP_EventCallback :: onRead( int fd, short events, void * arg )
 					// It will be processed as write fail at the last. So no need to re-add event here.
 				}
 			} else {
+				// wait for the next edge
+				session->setReady( session->getReady() & ~EV_READ );
 				addEvent( session, EV_READ, -1 );
 			}
 		}
-	} else {
-		if( 0 == session->getRunning() ) {
-			SP_EventHelper::doTimeout( session );
-		} else {
-			sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session timeout later",
-					sid.mKey, sid.mSeq );
-			// If this session is running, then onResponse will add write event for this session.
-			// It will be processed as write fail at the last. So no need to re-add event here.
-		}
 	}
 }
 
@@ -246,6 +345,7 @@ void SP_EventCallback :: onWrite( int fd, short events, void * arg )
 						// It will be processed as write fail at the last. So no need to re-add event here.
 					}
 				} else {
+					session->setReady( session->getReady() & ~EV_WRITE );
 					addEvent( session, EV_WRITE, -1 );
 				}
 			}
@@ -277,15 +377,21 @@ void SP_EventCallback :: onWrite( int fd, short events, void * arg )
 				// So no need to add write event here.
 			}
 		}
+	}
+}
+
+void SP_EventCallback :: onTimeout( SP_TimerNode_t * node, void * arg )
+{
+	SP_Session * session = (SP_Session*)arg;
+
+	if( 0 == session->getRunning() ) {
+		SP_EventHelper::doTimeout( session );
 	} else {
-		if( 0 == session->getRunning() ) {
-			SP_EventHelper::doTimeout( session );
-		} else {
-			sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session timeout later",
-					sid.mKey, sid.mSeq );
-			// If this session is running, then onResponse will add write event for this session.
-			// It will be processed as write fail at the last. So no need to re-add event here.
-		}
+		SP_Sid_t sid = session->getSid();
+		sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session timeout later",
+				sid.mKey, sid.mSeq );
+		// If this session is running, then onResponse will add events for this session,
+		// and the timer is armed again.
 	}
 }
 
@@ -324,6 +430,8 @@ void SP_EventCallback :: onResponse( void * queueData, void * arg )
 
 		SP_SidList * sidList = msg->getToList();
 
+		if( eventArg->getReactorCount() > 1 ) SP_EventHelper::doForward( eventArg, msg );
+
 		if( msg->getTotalSize() > 0 ) {
 			for( int i = sidList->getCount() - 1; i >= 0; i-- ) {
 				SP_Sid_t sid = sidList->get( i );
@@ -355,6 +463,10 @@ void SP_EventCallback :: onResponse( void * queueData, void * arg )
 		}
 	}
 
+	if( eventArg->getReactorCount() > 1 ) {
+		SP_EventHelper::doForward( eventArg, response->getToCloseList() );
+	}
+
 	for( int i = 0; i < response->getToCloseList()->getCount(); i++ ) {
 		SP_Sid_t sid = response->getToCloseList()->get( i );
 		SP_Session * session = manager->get( sid.mKey, &seq );
@@ -373,6 +485,23 @@ void SP_EventCallback :: addEvent( SP_Session * session, short events, int fd )
 {
 	SP_EventArg * eventArg = (SP_EventArg*)session->getArg();
 
+	// every read, write and response pushes the idle timeout back, usually without
+	// touching the wheel, the events themselves are added without timeout
+	if( eventArg->getTimeout() > 0 ) {
+		eventArg->getTimerWheel()->schedule( session->getTimerNode(),
+				eventArg->getTimeout() * 1000 );
+	}
+
+	// the fd is registered once, only the interest is kept in the session
+	SP_EpollReactor * reactor = eventArg->getEpollReactor();
+	if( NULL != reactor ) {
+		if( events & EV_WRITE ) session->setWriting( 1 );
+		if( events & EV_READ ) session->setReading( 1 );
+
+		reactor->want( session, events );
+		return;
+	}
+
 	if( ( events & EV_WRITE ) && 0 == session->getWriting() ) {
 		session->setWriting( 1 );
 
@@ -380,11 +509,7 @@ void SP_EventCallback :: addEvent( SP_Session * session, short events, int fd )
 
 		event_set( session->getWriteEvent(), fd, events, onWrite, session );
 		event_base_set( eventArg->getEventBase(), session->getWriteEvent() );
-
-		struct timeval timeout;
-		memset( &timeout, 0, sizeof( timeout ) );
-		timeout.tv_sec = eventArg->getTimeout();
-		event_add( session->getWriteEvent(), &timeout );
+		event_add( session->getWriteEvent(), NULL );
 	}
 
 	if( events & EV_READ && 0 == session->getReading() ) {
@@ -394,16 +519,89 @@ void SP_EventCallback :: addEvent( SP_Session * session, short events, int fd )
 
 		event_set( session->getReadEvent(), fd, events, onRead, session );
 		event_base_set( eventArg->getEventBase(), session->getReadEvent() );
+		event_add( session->getReadEvent(), NULL );
+	}
+}
+
+void SP_EventCallback :: delEvent( SP_Session * session )
+{
+	SP_EventArg * eventArg = (SP_EventArg*)session->getArg();
 
-		struct timeval timeout;
-		memset( &timeout, 0, sizeof( timeout ) );
-		timeout.tv_sec = eventArg->getTimeout();
-		event_add( session->getReadEvent(), &timeout );
+	event_del( session->getWriteEvent() );
+	event_del( session->getReadEvent() );
+	eventArg->getTimerWheel()->cancel( session->getTimerNode() );
+
+	if( NULL != eventArg->getEpollReactor() ) {
+		eventArg->getEpollReactor()->del( session, EVENT_FD( session->getWriteEvent() ) );
 	}
 }
 
 //-------------------------------------------------------------------
 
+void SP_EventHelper :: doAccept( SP_AcceptArg_t * acceptArg, int clientFD, struct sockaddr_in * addr )
+{
+	SP_EventArg * eventArg = acceptArg->mEventArg;
+
+	SP_Sid_t sid;
+	sid.mKey = eventArg->getSessionManager()->allocKey( &sid.mSeq );
+	if( 0 == sid.mKey ) {
+		sp_syslog( LOG_WARNING, "Cannot allocate session key, refuse fd %d", clientFD );
+		sp_close( clientFD );
+		return;
+	}
+
+	SP_Session * session = eventArg->getSessionPool()->get( sid );
+
+	char strip[ 32 ] = { 0 };
+	SP_IOUtils::inetNtoa( &( addr->sin_addr ), strip, sizeof( strip ) );
+	session->getRequest()->setClientIP( strip );
+	session->getRequest()->setClientPort( ntohs( addr->sin_port ) );
+
+	// server ip is resolved when SP_Request::getServerIP is called
+	session->getRequest()->setServerFd( clientFD );
+
+	if( NULL != session ) {
+		eventArg->getSessionManager()->put( sid.mKey, sid.mSeq, session );
+
+		session->setHandler( acceptArg->mHandlerFactory->create() );
+		session->setIOChannel( acceptArg->mIOChannelFactory->create() );
+		session->setArg( eventArg );
+
+		event_set( session->getReadEvent(), clientFD, EV_READ, SP_EventCallback::onRead, session );
+		event_set( session->getWriteEvent(), clientFD, EV_WRITE, SP_EventCallback::onWrite, session );
+		SP_TimerWheel::initNode( session->getTimerNode(), SP_EventCallback::onTimeout, session );
+
+		if( NULL != eventArg->getEpollReactor()
+				&& 0 != eventArg->getEpollReactor()->add( session, clientFD ) ) {
+			eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+			eventArg->getSessionPool()->giveBack( session );
+			sp_close( clientFD );
+			return;
+		}
+
+		if( eventArg->getSessionManager()->getCount() > acceptArg->mMaxConnections
+				|| eventArg->getInputResultQueue()->getLength() >= acceptArg->mReqQueueSize ) {
+			sp_syslog( LOG_WARNING, "System busy, session.count %d [%d], queue.length %d [%d]",
+				eventArg->getSessionManager()->getCount(), acceptArg->mMaxConnections,
+				eventArg->getInputResultQueue()->getLength(), acceptArg->mReqQueueSize );
+
+			SP_Message * msg = new SP_Message();
+			msg->getMsg()->append( acceptArg->mRefusedMsg );
+			msg->getMsg()->append( "\r\n" );
+			session->getOutList()->append( msg );
+			session->setStatus( SP_Session::eExit );
+
+			SP_EventCallback::addEvent( session, EV_WRITE, clientFD );
+		} else {
+			doStart( session );
+		}
+	} else {
+		eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+		sp_close( clientFD );
+		sp_syslog( LOG_WARNING, "Out of memory, cannot allocate session object!" );
+	}
+}
+
 int SP_EventHelper :: isSystemSid( SP_Sid_t * sid )
 {
 	return ( sid->mKey == SP_Sid_t::eTimerKey && sid->mSeq == SP_Sid_t::eTimerSeq )
@@ -447,8 +645,7 @@ void SP_EventHelper :: doError( SP_Session * session )
 {
 	SP_EventArg * eventArg = (SP_EventArg *)session->getArg();
 
-	event_del( session->getWriteEvent() );
-	event_del( session->getReadEvent() );
+	SP_EventCallback::delEvent( session );
 
 	SP_Sid_t sid = session->getSid();
 
@@ -492,15 +689,14 @@ void SP_EventHelper :: error( void * arg )
 	// onResponse will ignore this session, so it's safe to destroy session here
 	session->getHandler()->close();
 	sp_close( EVENT_FD( session->getWriteEvent() ) );
-	delete session;
+	eventArg->getSessionPool()->giveBack( session );
 }
 
 void SP_EventHelper :: doTimeout( SP_Session * session )
 {
 	SP_EventArg * eventArg = (SP_EventArg*)session->getArg();
 
-	event_del( session->getWriteEvent() );
-	event_del( session->getReadEvent() );
+	SP_EventCallback::delEvent( session );
 
 	SP_Sid_t sid = session->getSid();
 
@@ -543,15 +739,14 @@ void SP_EventHelper :: timeout( void * arg )
 	// onResponse will ignore this session, so it's safe to destroy session here
 	session->getHandler()->close();
 	sp_close( EVENT_FD( session->getWriteEvent() ) );
-	delete session;
+	eventArg->getSessionPool()->giveBack( session );
 }
 
 void SP_EventHelper :: doClose( SP_Session * session )
 {
 	SP_EventArg * eventArg = (SP_EventArg*)session->getArg();
 
-	event_del( session->getWriteEvent() );
-	event_del( session->getReadEvent() );
+	SP_EventCallback::delEvent( session );
 
 	SP_Sid_t sid = session->getSid();
 
@@ -574,7 +769,7 @@ void SP_EventHelper :: myclose( void * arg )
 
 	session->getHandler()->close();
 	sp_close( EVENT_FD( session->getWriteEvent() ) );
-	delete session;
+	eventArg->getSessionPool()->giveBack( session );
 }
 
 void SP_EventHelper :: doStart( SP_Session * session )
@@ -614,6 +809,98 @@ void SP_EventHelper :: start( void * arg )
 
 void SP_EventHelper :: doCompletion( SP_EventArg * eventArg, SP_Message * msg )
 {
-	eventArg->getOutputResultQueue()->push( msg );
+	SP_Message * completed = msg->complete();
+	if( NULL != completed ) eventArg->getOutputResultQueue()->push( completed );
+}
+
+void SP_EventHelper :: doForward( SP_EventArg * eventArg, SP_Message * msg )
+{
+	SP_SidList * sidList = msg->getToList();
+	SP_Message * origin = NULL != msg->mOrigin ? msg->mOrigin : msg;
+
+	for( int reactor = 0; reactor < eventArg->getReactorCount(); reactor++ ) {
+		SP_EventArg * peer = eventArg->getReactor( reactor );
+		if( eventArg == peer || NULL == peer ) continue;
+
+		SP_Message * copy = NULL;
+
+		for( int i = sidList->getCount() - 1; i >= 0; i-- ) {
+			SP_Sid_t sid = sidList->get( i );
+			if( (int)( sid.mKey >> SP_SessionManager::eKeyPrefixShift ) != reactor ) continue;
+
+			if( NULL == copy ) copy = new SP_Message( msg->getCompletionKey() );
+			copy->getToList()->add( sidList->take( i ) );
+		}
+
+		if( NULL == copy ) continue;
+
+		// the peer reactor owns the copy, so the content is duplicated
+		if( msg->getMsg()->getSize() > 0 ) copy->getMsg()->append( msg->getMsg() );
+
+		SP_MsgBlockList * blockList = msg->getFollowBlockList();
+		for( int i = 0; i < blockList->getCount(); i++ ) {
+			const SP_MsgBlock * block = blockList->getItem( i );
+			if( block->getSize() <= 0 ) continue;
+
+			// the file is shared, the copy owns another descriptor of it
+			if( block->getFd() >= 0 ) {
+				int fd = dup( block->getFd() );
+				if( fd >= 0 ) {
+					copy->getFollowBlockList()->append( new SP_FileMsgBlock(
+							fd, block->getOffset(), block->getSize(), 1 ) );
+				} else {
+					sp_syslog( LOG_WARNING, "cannot dup file block, errno %d", errno );
+				}
+				continue;
+			}
+
+			SP_BufferMsgBlock * dup = new SP_BufferMsgBlock();
+			dup->append( block->getData(), block->getSize() );
+			copy->getFollowBlockList()->append( dup );
+		}
+
+		// the copy reports to the origin, which is held until the copy is completed
+		copy->mOrigin = origin;
+		copy->mNextCopy = origin->mNextCopy;
+		origin->mNextCopy = copy;
+		sp_atomic_add( &( origin->mPending ), 1 );
+
+		SP_Sid_t sid;
+		sid.mKey = SP_Sid_t::ePushKey;
+		sid.mSeq = SP_Sid_t::ePushSeq;
+
+		SP_Response * response = new SP_Response( sid );
+		response->addMessage( copy );
+
+		msgqueue_push( (struct event_msgqueue*)peer->getResponseQueue(), response );
+	}
+}
+
+void SP_EventHelper :: doForward( SP_EventArg * eventArg, SP_SidList * toCloseList )
+{
+	for( int reactor = 0; reactor < eventArg->getReactorCount(); reactor++ ) {
+		SP_EventArg * peer = eventArg->getReactor( reactor );
+		if( eventArg == peer || NULL == peer ) continue;
+
+		SP_Response * response = NULL;
+
+		for( int i = toCloseList->getCount() - 1; i >= 0; i-- ) {
+			SP_Sid_t sid = toCloseList->get( i );
+			if( (int)( sid.mKey >> SP_SessionManager::eKeyPrefixShift ) != reactor ) continue;
+
+			if( NULL == response ) {
+				SP_Sid_t pushSid;
+				pushSid.mKey = SP_Sid_t::ePushKey;
+				pushSid.mSeq = SP_Sid_t::ePushSeq;
+				response = new SP_Response( pushSid );
+			}
+
+			response->getToCloseList()->add( toCloseList->take( i ) );
+		}
+
+		if( NULL != response ) {
+			msgqueue_push( (struct event_msgqueue*)peer->getResponseQueue(), response );
+		}
+	}
 }
 
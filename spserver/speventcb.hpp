@@ -8,17 +8,25 @@
 
 class SP_HandlerFactory;
 class SP_SessionManager;
+class SP_SessionPool;
 class SP_Session;
 class SP_BlockingQueue;
 class SP_Message;
+class SP_SidList;
 class SP_IOChannelFactory;
+class SP_TimerWheel;
+class SP_EpollReactor;
 
 struct event_base;
+struct event;
+struct sockaddr_in;
 typedef struct tagSP_Sid SP_Sid_t;
+typedef struct tagSP_TimerNode SP_TimerNode_t;
 
 class SP_EventArg {
 public:
-	SP_EventArg( int timeout );
+	// edgeTriggered is only supported on linux, fall back to libevent if it fails
+	SP_EventArg( int timeout, int edgeTriggered = 0 );
 	~SP_EventArg();
 
 	struct event_base * getEventBase() const;
@@ -26,10 +34,23 @@ public:
 	SP_BlockingQueue * getInputResultQueue() const;
 	SP_BlockingQueue * getOutputResultQueue() const;
 	SP_SessionManager * getSessionManager() const;
+	SP_SessionPool * getSessionPool() const;
 
 	void setTimeout( int timeout );
 	int getTimeout() const;
 
+	// the idle timeouts of the sessions, driven by a tick event of the event loop
+	SP_TimerWheel * getTimerWheel() const;
+
+	// NULL if the sessions are driven by the one-shot libevent events
+	SP_EpollReactor * getEpollReactor() const;
+
+	// for multi-reactor, messages to the sessions of other reactors are forwarded
+	void setReactorList( SP_EventArg ** reactorList, int reactorCount, int reactorIndex );
+	int getReactorCount() const;
+	int getReactorIndex() const;
+	SP_EventArg * getReactor( int reactorIndex ) const;
+
 private:
 	struct event_base * mEventBase;
 	void * mResponseQueue;
@@ -38,8 +59,21 @@ private:
 	SP_BlockingQueue * mOutputResultQueue;
 
 	SP_SessionManager * mSessionManager;
+	SP_SessionPool * mSessionPool;
 
 	int mTimeout;
+
+	static void onTick( int fd, short events, void * arg );
+	void addTick();
+
+	SP_TimerWheel * mTimerWheel;
+	struct event * mTickEvent;
+
+	SP_EpollReactor * mEpollReactor;
+
+	SP_EventArg ** mReactorList;
+	int mReactorCount;
+	int mReactorIndex;
 };
 
 typedef struct tagSP_AcceptArg {
@@ -50,6 +84,13 @@ typedef struct tagSP_AcceptArg {
 	int mReqQueueSize;
 	int mMaxConnections;
 	char * mRefusedMsg;
+	int mAcceptBatch;
+
+	// for multi-reactor, accepted fds are handed to mReactorList round-robin
+	int mReactorCount;
+	struct tagSP_AcceptArg ** mReactorList;
+	unsigned int mReactorIndex;
+	void * mHandoffQueue;
 } SP_AcceptArg_t;
 
 class SP_EventCallback {
@@ -57,10 +98,14 @@ public:
 	static void onAccept( int fd, short events, void * arg );
 	static void onRead( int fd, short events, void * arg );
 	static void onWrite( int fd, short events, void * arg );
+	static void onTimeout( SP_TimerNode_t * node, void * arg );
 
 	static void onResponse( void * queueData, void * arg );
 
+	static void onHandoff( void * queueData, void * arg );
+
 	static void addEvent( SP_Session * session, short events, int fd );
+	static void delEvent( SP_Session * session );
 
 private:
 	SP_EventCallback();
@@ -69,6 +114,8 @@ private:
 
 class SP_EventHelper {
 public:
+	static void doAccept( SP_AcceptArg_t * acceptArg, int fd, struct sockaddr_in * addr );
+
 	static void doStart( SP_Session * session );
 	static void start( void * arg );
 
@@ -86,6 +133,9 @@ public:
 
 	static void doCompletion( SP_EventArg * eventArg, SP_Message * msg );
 
+	static void doForward( SP_EventArg * eventArg, SP_Message * msg );
+	static void doForward( SP_EventArg * eventArg, SP_SidList * toCloseList );
+
 	static int isSystemSid( SP_Sid_t * sid );
 
 private:
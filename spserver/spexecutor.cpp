@@ -6,11 +6,12 @@
 
 #include <sys/types.h>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "spporting.hpp"
 
 #include "spexecutor.hpp"
-#include "spthreadpool.hpp"
 
 #include "sputils.hpp"
 
@@ -44,49 +45,82 @@ void SP_SimpleTask :: run()
 SP_Executor :: SP_Executor( int maxThreads, const char * tag )
 {
 	tag = NULL == tag ? "unknown" : tag;
+	snprintf( mTag, sizeof( mTag ), "%s", tag );
 
-	mThreadPool = new SP_ThreadPool( maxThreads, tag );
+	mMaxThreads = maxThreads > 0 ? maxThreads : 1;
 
-	mQueue = new SP_BlockingQueue();
+	mQueueList = (SP_RingQueue**)malloc( sizeof( void * ) * mMaxThreads );
+	mWorkerList = (SP_ExecutorWorker_t*)malloc( sizeof( SP_ExecutorWorker_t ) * mMaxThreads );
+	for( int i = 0; i < mMaxThreads; i++ ) {
+		mQueueList[ i ] = new SP_RingQueue( SP_RingQueue::eMPMC, 1024 );
+		mWorkerList[ i ].mExecutor = this;
+		mWorkerList[ i ].mIndex = i;
+	}
+	mNextQueue = 0;
+
+	mOverflow = new SP_CircleQueue();
+	mOverflowCount = 0;
+	sp_thread_mutex_init( &mOverflowMutex, NULL );
 
 	mIsShutdown = 0;
+	mRunning = 0;
+	mSleeping = 0;
 
 	sp_thread_mutex_init( &mMutex, NULL );
 	sp_thread_cond_init( &mCond, NULL );
+	sp_thread_cond_init( &mExitCond, NULL );
 
 	sp_thread_attr_t attr;
 	sp_thread_attr_init( &attr );
 	assert( sp_thread_attr_setstacksize( &attr, 1024 * 1024 ) == 0 );
 	sp_thread_attr_setdetachstate( &attr, SP_THREAD_CREATE_DETACHED );
 
-	sp_thread_t thread;
-	int ret = sp_thread_create( &thread, &attr, eventLoop, this );
-	sp_thread_attr_destroy( &attr );
-	if( 0 == ret ) {
-		sp_syslog( LOG_NOTICE, "[ex@%s] Thread #%ld has been created for executor", tag, thread );
-	} else {
-		sp_syslog( LOG_WARNING, "[ex@%s] Unable to create a thread for executor", tag );
+	for( int i = 0; i < mMaxThreads; i++ ) {
+		sp_thread_mutex_lock( &mMutex );
+		mRunning++;
+		sp_thread_mutex_unlock( &mMutex );
+
+		sp_thread_t thread;
+		int ret = sp_thread_create( &thread, &attr, workerLoop, &( mWorkerList[ i ] ) );
+		if( 0 == ret ) {
+			sp_syslog( LOG_NOTICE, "[ex@%s] Thread #%ld has been created for executor", mTag, thread );
+		} else {
+			sp_thread_mutex_lock( &mMutex );
+			mRunning--;
+			sp_thread_mutex_unlock( &mMutex );
+			sp_syslog( LOG_WARNING, "[ex@%s] Unable to create a thread for executor", mTag );
+		}
 	}
+
+	sp_thread_attr_destroy( &attr );
 }
 
 SP_Executor :: ~SP_Executor()
 {
 	shutdown();
 
-	while( 2 != mIsShutdown ) {
-		sp_thread_mutex_lock( &mMutex );
-		sp_thread_cond_wait( &mCond, &mMutex );
-		sp_thread_mutex_unlock( &mMutex );
+	sp_thread_mutex_lock( &mMutex );
+	for( ; mRunning > 0; ) {
+		sp_thread_cond_wait( &mExitCond, &mMutex );
 	}
+	sp_thread_mutex_unlock( &mMutex );
 
 	sp_thread_mutex_destroy( &mMutex );
-	sp_thread_cond_destroy( &mCond);
+	sp_thread_cond_destroy( &mCond );
+	sp_thread_cond_destroy( &mExitCond );
+
+	for( int i = 0; i < mMaxThreads; i++ ) {
+		delete mQueueList[ i ];
+	}
+	free( mQueueList );
+	mQueueList = NULL;
 
-	delete mThreadPool;
-	mThreadPool = NULL;
+	free( mWorkerList );
+	mWorkerList = NULL;
 
-	delete mQueue;
-	mQueue = NULL;
+	delete mOverflow;
+	mOverflow = NULL;
+	sp_thread_mutex_destroy( &mOverflowMutex );
 }
 
 void SP_Executor :: shutdown()
@@ -95,47 +129,97 @@ void SP_Executor :: shutdown()
 	if( 0 == mIsShutdown ) {
 		mIsShutdown = 1;
 
-		// signal the event loop to wake up
-		execute( worker, NULL );
+		// wake up one worker, every exiting worker wakes up the next one
+		sp_thread_cond_signal( &mCond );
 	}
 	sp_thread_mutex_unlock( &mMutex );
 }
 
-sp_thread_result_t SP_THREAD_CALL  SP_Executor :: eventLoop( void * arg )
+SP_Task * SP_Executor :: steal( int index )
 {
-	SP_Executor * executor = ( SP_Executor * )arg;
+	SP_Task * task = NULL;
+
+	// own ring first, then the others, then the overflow queue
+	for( int i = 0; i < mMaxThreads && NULL == task; i++ ) {
+		task = (SP_Task*)mQueueList[ ( index + i ) % mMaxThreads ]->pop();
+	}
 
-	while( 0 == executor->mIsShutdown ) {
-		void * queueData = executor->mQueue->pop();
+	if( NULL == task && sp_atomic_get( &mOverflowCount ) > 0 ) {
+		sp_thread_mutex_lock( &mOverflowMutex );
+		task = (SP_Task*)mOverflow->pop();
+		if( NULL != task ) sp_atomic_add( &mOverflowCount, -1 );
+		sp_thread_mutex_unlock( &mOverflowMutex );
+	}
+
+	return task;
+}
+
+sp_thread_result_t SP_THREAD_CALL SP_Executor :: workerLoop( void * arg )
+{
+	SP_ExecutorWorker_t * worker = ( SP_ExecutorWorker_t * )arg;
+	SP_Executor * executor = worker->mExecutor;
 
-		if( executor->mThreadPool->getMaxThreads() > 1 ) {
-			if( 0 != executor->mThreadPool->dispatch( worker, queueData ) ) {
-				worker( queueData );
+	for( ; ; ) {
+		SP_Task * task = executor->steal( worker->mIndex );
+
+		if( NULL == task ) {
+			int isShutdown = 0;
+
+			sp_thread_mutex_lock( &executor->mMutex );
+
+			// check again after announcing that we are going to sleep,
+			// a producer which pushes after this point will signal us
+			sp_atomic_add( &executor->mSleeping, 1 );
+			task = executor->steal( worker->mIndex );
+			if( NULL == task && 0 == executor->mIsShutdown ) {
+				sp_thread_cond_wait( &executor->mCond, &executor->mMutex );
+			}
+			sp_atomic_add( &executor->mSleeping, -1 );
+			isShutdown = executor->mIsShutdown;
+
+			sp_thread_mutex_unlock( &executor->mMutex );
+
+			if( NULL == task && isShutdown ) {
+				task = executor->steal( worker->mIndex );
+				if( NULL == task ) break;
 			}
-		} else {
-			worker( queueData );
 		}
+
+		if( NULL != task ) task->run();
 	}
 
 	sp_thread_mutex_lock( &executor->mMutex );
-	executor->mIsShutdown = 2;
+	executor->mRunning--;
 	sp_thread_cond_signal( &executor->mCond );
+	sp_thread_cond_signal( &executor->mExitCond );
 	sp_thread_mutex_unlock( &executor->mMutex );
 
 	return 0;
 }
 
-void SP_Executor :: worker( void * arg )
+void SP_Executor :: execute( SP_Task * task )
 {
-	if( NULL != arg ) {
-		SP_Task * task = ( SP_Task * )arg;
-		task->run();
+	if( NULL == task ) return;
+
+	int index = (unsigned int)sp_atomic_add( &mNextQueue, 1 ) % mMaxThreads;
+
+	int pushed = 0;
+	for( int i = 0; i < mMaxThreads && 0 == pushed; i++ ) {
+		if( 0 == mQueueList[ ( index + i ) % mMaxThreads ]->push( task ) ) pushed = 1;
 	}
-}
 
-void SP_Executor :: execute( SP_Task * task )
-{
-	mQueue->push( task );
+	if( 0 == pushed ) {
+		sp_thread_mutex_lock( &mOverflowMutex );
+		mOverflow->push( task );
+		sp_atomic_add( &mOverflowCount, 1 );
+		sp_thread_mutex_unlock( &mOverflowMutex );
+	}
+
+	if( sp_atomic_get( &mSleeping ) > 0 ) {
+		sp_thread_mutex_lock( &mMutex );
+		sp_thread_cond_signal( &mCond );
+		sp_thread_mutex_unlock( &mMutex );
+	}
 }
 
 void SP_Executor :: execute( void ( * func ) ( void * ), void * arg )
@@ -146,6 +230,12 @@ void SP_Executor :: execute( void ( * func ) ( void * ), void * arg )
 
 int SP_Executor :: getQueueLength()
 {
-	return mQueue->getLength();
+	int len = sp_atomic_get( &mOverflowCount );
+
+	for( int i = 0; i < mMaxThreads; i++ ) {
+		len += mQueueList[ i ]->getLength();
+	}
+
+	return len;
 }
 
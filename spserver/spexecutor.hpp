@@ -9,8 +9,8 @@
 
 #include "spthread.hpp"
 
-class SP_ThreadPool;
-class SP_BlockingQueue;
+class SP_RingQueue;
+class SP_CircleQueue;
 
 class SP_Task {
 public:
@@ -34,6 +34,8 @@ private:
 	int mDeleteAfterRun;
 };
 
+// work-stealing executor, each worker thread owns a lock-free ring,
+// tasks are pushed round-robin, an idle worker steals from the others
 class SP_Executor {
 public:
 	SP_Executor( int maxThreads, const char * tag = 0 );
@@ -45,17 +47,34 @@ public:
 	void shutdown();
 
 private:
-	static void msgQueueCallback( void * queueData, void * arg );
-	static void worker( void * arg );
-	static sp_thread_result_t SP_THREAD_CALL eventLoop( void * arg );
+	typedef struct tagSP_ExecutorWorker {
+		SP_Executor * mExecutor;
+		int mIndex;
+	} SP_ExecutorWorker_t;
 
-	SP_ThreadPool * mThreadPool;
-	SP_BlockingQueue * mQueue;
+	static sp_thread_result_t SP_THREAD_CALL workerLoop( void * arg );
+
+	SP_Task * steal( int index );
+
+	char mTag[ 32 ];
+
+	int mMaxThreads;
+	SP_RingQueue ** mQueueList;
+	SP_ExecutorWorker_t * mWorkerList;
+	volatile int mNextQueue;
+
+	// used when all the rings are full
+	SP_CircleQueue * mOverflow;
+	volatile int mOverflowCount;
+	sp_thread_mutex_t mOverflowMutex;
 
 	int mIsShutdown;
+	int mRunning;
+	volatile int mSleeping;
 
 	sp_thread_mutex_t mMutex;
 	sp_thread_cond_t mCond;
+	sp_thread_cond_t mExitCond;
 };
 
 #endif
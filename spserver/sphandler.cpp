@@ -18,6 +18,18 @@ SP_TimerHandler :: ~SP_TimerHandler()
 
 //---------------------------------------------------------
 
+SP_ConnectHandler :: ~SP_ConnectHandler()
+{
+}
+
+//---------------------------------------------------------
+
+SP_RelayHandler :: ~SP_RelayHandler()
+{
+}
+
+//---------------------------------------------------------
+
 SP_CompletionHandler :: ~SP_CompletionHandler()
 {
 }
@@ -40,6 +40,25 @@ public:
 	virtual int handle( SP_Response * response, struct timeval * timeout ) = 0;
 };
 
+class SP_ConnectHandler {
+public:
+	virtual ~SP_ConnectHandler();
+
+	// called by a worker thread when the connect is finished
+	// @param fd : the connected fd, the handler owns it; -1 if failed
+	// @param error : 0 for OK, or errno, ETIMEDOUT for timeout
+	virtual void handle( int fd, int error, SP_Response * response ) = 0;
+};
+
+class SP_RelayHandler {
+public:
+	virtual ~SP_RelayHandler();
+
+	// called in the event loop thread when the relay is finished,
+	// both fds are closed already, must not block
+	virtual void close() = 0;
+};
+
 /**
  * @note Asynchronous Completion Token
  */
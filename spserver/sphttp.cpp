@@ -7,6 +7,7 @@
 #include <time.h>
 #include <string.h>
 
+#include "spporting.hpp"
 #include "spthread.hpp"
 
 #include "sphttp.hpp"
@@ -15,6 +16,7 @@
 #include "sprequest.hpp"
 #include "spresponse.hpp"
 #include "spmsgblock.hpp"
+#include "sputils.hpp"
 
 SP_HttpHandler :: ~SP_HttpHandler()
 {
@@ -36,6 +38,8 @@ SP_HttpHandlerFactory :: ~SP_HttpHandlerFactory()
 
 //---------------------------------------------------------
 
+// pipelined requests in one read are parsed and queued together,
+// so that they are handled in one worker run
 class SP_HttpRequestDecoder : public SP_MsgDecoder {
 public:
 	SP_HttpRequestDecoder();
@@ -44,38 +48,132 @@ public:
 
 	virtual int decode( SP_Buffer * inBuffer );
 
-	SP_HttpRequest * getMsg();
+	// take the first completed request, the caller should delete it
+	SP_HttpMsgParser * takeParser();
 
 private:
+	enum { eMaxPipeline = 16 };
+
 	SP_HttpMsgParser * mParser;
+	SP_ArrayList * mCompletedList;
 };
 
 SP_HttpRequestDecoder :: SP_HttpRequestDecoder()
 {
 	mParser = new SP_HttpMsgParser();
+	mCompletedList = new SP_ArrayList();
 }
 
 SP_HttpRequestDecoder :: ~SP_HttpRequestDecoder()
 {
+	for( ; mCompletedList->getCount() > 0; ) {
+		delete (SP_HttpMsgParser*)mCompletedList->takeItem( SP_ArrayList::LAST_INDEX );
+	}
+	delete mCompletedList;
+
 	delete mParser;
 }
 
 int SP_HttpRequestDecoder :: decode( SP_Buffer * inBuffer )
 {
-	if( inBuffer->getSize() > 0 ) {
-		int len = mParser->append( inBuffer->getBuffer(), inBuffer->getSize() );
+	for( ; inBuffer->getSize() > 0 && mCompletedList->getCount() < eMaxPipeline; ) {
+		int len = mParser->append( inBuffer->getRawBuffer(), inBuffer->getSize() );
 
 		inBuffer->erase( len );
 
-		return mParser->isCompleted() ? eOK : eMoreData;
-	} else {
-		return eMoreData;
+		if( ! mParser->isCompleted() ) break;
+
+		mCompletedList->append( mParser );
+		int keepAlive = mParser->getRequest()->isKeepAlive();
+		mParser = new SP_HttpMsgParser();
+
+		// the session is closed after this one, leave the rest alone
+		if( ! keepAlive ) break;
 	}
+
+	return mCompletedList->getCount() > 0 ? eOK : eMoreData;
+}
+
+SP_HttpMsgParser * SP_HttpRequestDecoder :: takeParser()
+{
+	return (SP_HttpMsgParser*)mCompletedList->takeItem( 0 );
+}
+
+//---------------------------------------------------------
+
+// the Date value only changes once a second, it is formatted once
+// and shared by all the sessions of a factory; the readers never lock,
+// one writer formats the new second into the next slot and publishes it
+class SP_HttpDateCache {
+public:
+	SP_HttpDateCache();
+	~SP_HttpDateCache();
+
+	// copy the value of the current second into buffer, return its length
+	int get( char * buffer, int size );
+
+private:
+	// a slot is rewritten eSlots - 1 seconds after it stops being current,
+	// long after any reader has copied it
+	enum { eSlots = 4 };
+
+	typedef struct tagSlot {
+		time_t mTime;
+		char mDate[ 64 ];
+		int mLength;
+	} Slot_t;
+
+	Slot_t mSlots[ eSlots ];
+	volatile int mCurrent;
+	volatile int mUpdating;
+};
+
+SP_HttpDateCache :: SP_HttpDateCache()
+{
+	memset( mSlots, 0, sizeof( mSlots ) );
+	mCurrent = 0;
+	mUpdating = 0;
 }
 
-SP_HttpRequest * SP_HttpRequestDecoder :: getMsg()
+SP_HttpDateCache :: ~SP_HttpDateCache()
 {
-	return mParser->getRequest();
+}
+
+int SP_HttpDateCache :: get( char * buffer, int size )
+{
+	time_t now = time( NULL );
+
+	Slot_t * slot = &( mSlots[ mCurrent ] );
+
+	// the others keep the last second while one thread formats the new one
+	if( now != slot->mTime && sp_atomic_cas( &mUpdating, 0, 1 ) ) {
+		int current = mCurrent;
+
+		// another thread may have published this second already
+		if( now != mSlots[ current ].mTime ) {
+			int next = ( current + 1 ) % eSlots;
+
+			struct tm tmTime;
+			gmtime_r( &now, &tmTime );
+
+			Slot_t * nextSlot = &( mSlots[ next ] );
+			nextSlot->mLength = strftime( nextSlot->mDate, sizeof( nextSlot->mDate ),
+					"%a, %d %b %Y %H:%M:%S %Z", &tmTime );
+			nextSlot->mTime = now;
+
+			// the full barrier publishes the slot before the new index
+			sp_atomic_cas( &mCurrent, current, next );
+		}
+
+		slot = &( mSlots[ mCurrent ] );
+		sp_atomic_cas( &mUpdating, 1, 0 );
+	}
+
+	int len = slot->mLength < size ? slot->mLength : size - 1;
+	memcpy( buffer, slot->mDate, len );
+	buffer[ len ] = '\0';
+
+	return len;
 }
 
 //---------------------------------------------------------
@@ -118,7 +216,7 @@ size_t SP_HttpResponseMsgBlock :: getSize() const
 
 class SP_HttpHandlerAdapter : public SP_Handler {
 public:
-	SP_HttpHandlerAdapter( SP_HttpHandler * handler );
+	SP_HttpHandlerAdapter( SP_HttpHandler * handler, SP_HttpDateCache * dateCache );
 
 	virtual ~SP_HttpHandlerAdapter();
 
@@ -135,12 +233,24 @@ public:
 	virtual void close();
 
 private:
+	// append the response of one request to the reply, return -1 : close
+	int process( SP_HttpRequest * httpRequest, SP_Message * reply, SP_Buffer ** head );
+
+	// write the status line and the headers in one pass, return -1 : out of memory
+	static int writeHead( SP_HttpResponse * httpResponse, SP_Buffer * buffer );
+
+	// return the length of the decimal digits
+	static int formatNumber( long long value, char * buffer );
+
 	SP_HttpHandler * mHandler;
+	SP_HttpDateCache * mDateCache;
 };
 
-SP_HttpHandlerAdapter :: SP_HttpHandlerAdapter( SP_HttpHandler * handler )
+SP_HttpHandlerAdapter :: SP_HttpHandlerAdapter( SP_HttpHandler * handler,
+		SP_HttpDateCache * dateCache )
 {
 	mHandler = handler;
+	mDateCache = dateCache;
 }
 
 SP_HttpHandlerAdapter :: ~SP_HttpHandlerAdapter()
@@ -158,21 +268,42 @@ int SP_HttpHandlerAdapter :: start( SP_Request * request, SP_Response * response
 int SP_HttpHandlerAdapter :: handle( SP_Request * request, SP_Response * response )
 {
 	SP_HttpRequestDecoder * decoder = ( SP_HttpRequestDecoder * ) request->getMsgDecoder();
-	SP_HttpRequest * httpRequest = ( SP_HttpRequest * ) decoder->getMsg();
 
-	httpRequest->setClinetIP( request->getClientIP() );
+	// the responses of the pipelined requests go out in order in one reply,
+	// a head is appended to the reply buffer until a body follows it
+	SP_Message * reply = response->getReply();
+	SP_Buffer * head = reply->getMsg();
+
+	int ret = 0;
+
+	for( SP_HttpMsgParser * parser = decoder->takeParser();
+			NULL != parser; parser = decoder->takeParser() ) {
+		SP_HttpRequest * httpRequest = parser->getRequest();
+		httpRequest->setClinetIP( request->getClientIP() );
+
+		// the requests behind a closing one are dropped
+		if( 0 == ret ) ret = process( httpRequest, reply, &head );
+
+		delete parser;
+	}
+
+	return ret;
+}
+
+int SP_HttpHandlerAdapter :: process( SP_HttpRequest * httpRequest,
+		SP_Message * reply, SP_Buffer ** head )
+{
+	if( NULL == *head ) {
+		*head = new SP_Buffer();
+		reply->getFollowBlockList()->append( new SP_BufferMsgBlock( *head, 1 ) );
+	}
 
 	SP_HttpResponse * httpResponse = new SP_HttpResponse();
 	httpResponse->setVersion( httpRequest->getVersion() );
 
 	mHandler->handle( httpRequest, httpResponse );
 
-	SP_Buffer * reply = response->getReply()->getMsg();
-
-	char buffer[ 512 ] = { 0 };
-	snprintf( buffer, sizeof( buffer ), "%s %i %s\r\n", httpResponse->getVersion(),
-		httpResponse->getStatusCode(), httpResponse->getReasonPhrase() );
-	reply->append( buffer );
+	char buffer[ 64 ] = { 0 };
 
 	// check keep alive header
 	if( httpRequest->isKeepAlive() ) {
@@ -185,17 +316,15 @@ int SP_HttpHandlerAdapter :: handle( SP_Request * request, SP_Response * respons
 		// check Content-Length header
 		httpResponse->removeHeader( SP_HttpMessage::HEADER_CONTENT_LENGTH );
 		if( httpResponse->getContentLength() >= 0 ) {
-				snprintf( buffer, sizeof( buffer ), "%d", httpResponse->getContentLength() );
+				formatNumber( (long long)httpResponse->getContentLength()
+						+ ( httpResponse->getFile() >= 0 ? httpResponse->getFileLength() : 0 ), buffer );
 				httpResponse->addHeader( SP_HttpMessage::HEADER_CONTENT_LENGTH, buffer );
 		}
 	}
 
 	// check date header
 	httpResponse->removeHeader( SP_HttpMessage::HEADER_DATE );
-	time_t tTime = time( NULL );
-	struct tm tmTime;
-	gmtime_r( &tTime, &tmTime );
-	strftime( buffer, sizeof( buffer ), "%a, %d %b %Y %H:%M:%S %Z", &tmTime );
+	mDateCache->get( buffer, sizeof( buffer ) );
 	httpResponse->addHeader( SP_HttpMessage::HEADER_DATE, buffer );
 
 	// check Content-Type header
@@ -208,32 +337,113 @@ int SP_HttpHandlerAdapter :: handle( SP_Request * request, SP_Response * respons
 	httpResponse->removeHeader( SP_HttpMessage::HEADER_SERVER );
 	httpResponse->addHeader( SP_HttpMessage::HEADER_SERVER, "sphttp/spserver" );
 
-	for( int i = 0; i < httpResponse->getHeaderCount(); i++ ) {
-		snprintf( buffer, sizeof( buffer ), "%s: %s\r\n",
-			httpResponse->getHeaderName( i ), httpResponse->getHeaderValue( i ) );
-		reply->append( buffer );
+	// without the head the response cannot be sent, close the session
+	if( 0 != writeHead( httpResponse, *head ) ) {
+		sp_syslog( LOG_WARNING, "Cannot write http response head, out of memory" );
+		delete httpResponse;
+		return -1;
 	}
 
-	reply->append( "\r\n" );	
-
 	char keepAlive[ 32 ] = { 0 };
 	if( NULL != httpResponse->getHeaderValue( SP_HttpMessage::HEADER_CONNECTION ) ) {
 		strncpy( keepAlive, httpResponse->getHeaderValue(
 				SP_HttpMessage::HEADER_CONNECTION ), sizeof( keepAlive ) - 1 );
 	}
 
+	SP_MsgBlock * fileBlock = NULL;
+	if( httpResponse->getFile() >= 0 && 0 != strcasecmp( httpRequest->getMethod(), "head" ) ) {
+		off_t offset = httpResponse->getFileOffset();
+		size_t length = httpResponse->getFileLength();
+		fileBlock = new SP_FileMsgBlock( httpResponse->takeFile(), offset, length, 1 );
+	}
+
 	if( NULL != httpResponse->getContent() ) {
-		response->getReply()->getFollowBlockList()->append(
-				new SP_HttpResponseMsgBlock( httpResponse ) );
+		reply->getFollowBlockList()->append( new SP_HttpResponseMsgBlock( httpResponse ) );
+		*head = NULL;
 	} else {
 		delete httpResponse;
 	}
 
-	request->setMsgDecoder( new SP_HttpRequestDecoder() );
+	// the file is sent with sendfile after the content
+	if( NULL != fileBlock ) {
+		reply->getFollowBlockList()->append( fileBlock );
+		*head = NULL;
+	}
 
 	return 0 == strcasecmp( keepAlive, "Keep-Alive" ) ? 0 : -1;
 }
 
+int SP_HttpHandlerAdapter :: formatNumber( long long value, char * buffer )
+{
+	char digits[ 32 ];
+	int len = 0;
+
+	unsigned long long number = value < 0 ? 0ULL - value : value;
+	do {
+		digits[ len++ ] = '0' + number % 10;
+		number /= 10;
+	} while( number > 0 );
+
+	if( value < 0 ) digits[ len++ ] = '-';
+
+	for( int i = 0; i < len; i++ ) buffer[ i ] = digits[ len - i - 1 ];
+	buffer[ len ] = '\0';
+
+	return len;
+}
+
+int SP_HttpHandlerAdapter :: writeHead( SP_HttpResponse * httpResponse, SP_Buffer * buffer )
+{
+	const char * version = httpResponse->getVersion();
+	const char * reason = httpResponse->getReasonPhrase();
+
+	char code[ 32 ];
+	int codeLen = formatNumber( httpResponse->getStatusCode(), code );
+
+	int versionLen = strlen( version ), reasonLen = strlen( reason );
+
+	// the size of the head is known before anything is written
+	int total = versionLen + 1 + codeLen + 1 + reasonLen + 2 + 2;
+	for( int i = 0; i < httpResponse->getHeaderCount(); i++ ) {
+		const SP_HttpHeader_t * header = httpResponse->getHeader( i );
+		total += header->mNameLen + 2 + header->mValueLen + 2;
+	}
+
+	char * pos = buffer->getWritable( total );
+	if( NULL == pos ) return -1;
+
+	memcpy( pos, version, versionLen );
+	pos += versionLen;
+	*pos++ = ' ';
+	memcpy( pos, code, codeLen );
+	pos += codeLen;
+	*pos++ = ' ';
+	memcpy( pos, reason, reasonLen );
+	pos += reasonLen;
+	*pos++ = '\r';
+	*pos++ = '\n';
+
+	for( int i = 0; i < httpResponse->getHeaderCount(); i++ ) {
+		const SP_HttpHeader_t * header = httpResponse->getHeader( i );
+
+		memcpy( pos, header->mName, header->mNameLen );
+		pos += header->mNameLen;
+		*pos++ = ':';
+		*pos++ = ' ';
+		memcpy( pos, header->mValue, header->mValueLen );
+		pos += header->mValueLen;
+		*pos++ = '\r';
+		*pos++ = '\n';
+	}
+
+	*pos++ = '\r';
+	*pos++ = '\n';
+
+	buffer->commit( total );
+
+	return 0;
+}
+
 void SP_HttpHandlerAdapter :: error( SP_Response * response )
 {
 	mHandler->error();
@@ -253,15 +463,17 @@ void SP_HttpHandlerAdapter :: close()
 SP_HttpHandlerAdapterFactory :: SP_HttpHandlerAdapterFactory( SP_HttpHandlerFactory * factory )
 {
 	mFactory = factory;
+	mDateCache = new SP_HttpDateCache();
 }
 
 SP_HttpHandlerAdapterFactory :: ~SP_HttpHandlerAdapterFactory()
 {
 	delete mFactory;
+	delete mDateCache;
 }
 
 SP_Handler * SP_HttpHandlerAdapterFactory :: create() const
 {
-	return new SP_HttpHandlerAdapter( mFactory->create() );
+	return new SP_HttpHandlerAdapter( mFactory->create(), mDateCache );
 }
 
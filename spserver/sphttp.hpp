@@ -12,6 +12,7 @@
 class SP_HttpRequest;
 class SP_HttpResponse;
 class SP_HttpMsgParser;
+class SP_HttpDateCache;
 
 class SP_HttpHandler {
 public:
@@ -41,6 +42,7 @@ public:
 
 private:
 	SP_HttpHandlerFactory * mFactory;
+	SP_HttpDateCache * mDateCache;
 };
 
 #endif
@@ -11,6 +11,7 @@
 
 #include "sphttpmsg.hpp"
 #include "sputils.hpp"
+#include "spscan.hpp"
 
 static char * sp_strsep(char **s, const char *del)
 {
@@ -52,82 +53,167 @@ int SP_HttpMsgParser :: isIgnoreContent() const
 	return 0 != mIgnoreContent;
 }
 
+int SP_HttpMsgParser :: getLineEnd( const char * buffer, int len, int * lineLen )
+{
+	const char * pos = (char*)memchr( buffer, '\n', len );
+	if( NULL == pos ) return -1;
+
+	*lineLen = pos - buffer + 1;
+
+	int end = pos - buffer;
+	for( ; end > 0 && '\r' == buffer[ end - 1 ]; ) end--;
+
+	return end;
+}
+
 int SP_HttpMsgParser :: parseStartLine( SP_HttpMessage ** message,
 		const void * buffer, int len )
 {
 	int lineLen = 0;
 
-	char * pos = (char*)memchr( buffer, '\n', len );
+	const char * line = (char*)buffer;
+	int end = getLineEnd( line, len, &lineLen );
+	if( end < 0 ) return 0;
+
+	// the line is sliced in the input, only the kept parts are copied
+	const char * first = line, * second = NULL, * rest = NULL;
+	int firstLen = end, secondLen = 0, restLen = 0;
+
+	const char * pos = (char*)memchr( first, ' ', end );
 	if( NULL != pos ) {
-		lineLen = pos - (char*)buffer + 1;
+		firstLen = pos - first;
+		second = pos + 1;
+		secondLen = line + end - second;
 
-		char * line = (char*)malloc( lineLen + 1 );
-		memcpy( line, buffer, lineLen );
-		line[ lineLen ] = '\0';
+		pos = (char*)memchr( second, ' ', secondLen );
+		if( NULL != pos ) {
+			secondLen = pos - second;
+			rest = pos + 1;
+			restLen = line + end - rest;
+		}
+	}
 
-		pos = line;
+	char temp[ 128 ] = { 0 };
 
-		char * first, * second;
-		first = sp_strsep( &pos, " " );
-		second = sp_strsep( &pos, " " );
+	if( 0 == strncasecmp( line, "HTTP", 4 ) ) {
+		SP_HttpResponse * response = new SP_HttpResponse();
 
-		if( 0 == strncasecmp( line, "HTTP", 4 ) ) {
-			SP_HttpResponse * response = new SP_HttpResponse();
-			if( NULL != first ) response->setVersion( first );
-			if( NULL != second ) response->setStatusCode( atoi( second ) );
-			if( NULL != pos ) response->setReasonPhrase( strtok( pos, "\r\n" ) );
+		snprintf( temp, sizeof( temp ), "%.*s", firstLen, first );
+		response->setVersion( temp );
+		if( NULL != second ) response->setStatusCode( atoi( second ) );
+		if( NULL != rest ) {
+			snprintf( temp, sizeof( temp ), "%.*s", restLen, rest );
+			response->setReasonPhrase( temp );
+		}
 
-			*message = response;
-		} else {
-			SP_HttpRequest * request = new SP_HttpRequest();
-			if( NULL != first ) request->setMethod( first );
-			if( NULL != second ) request->setURL( second );
-			if( NULL != second ) request->setURI( sp_strsep( &second, "?" ) );
-			if( NULL != pos ) request->setVersion( strtok( pos, "\r\n" ) );
+		*message = response;
+	} else {
+		SP_HttpRequest * request = new SP_HttpRequest();
 
-			char * params = second;
-			for( ; NULL != params && '\0' != *params; ) {
-				char * value = sp_strsep( &params, "&" );
-				char * name = sp_strsep( &value, "=" );
-				request->addParam( name, NULL == value ? "" : value );
+		snprintf( temp, sizeof( temp ), "%.*s", firstLen, first );
+		request->setMethod( temp );
+		if( NULL != rest ) {
+			snprintf( temp, sizeof( temp ), "%.*s", restLen, rest );
+			request->setVersion( temp );
+		}
+
+		if( NULL != second ) {
+			request->setURL( second, secondLen );
+
+			const char * params = (char*)memchr( second, '?', secondLen );
+			int paramsLen = 0;
+			if( NULL != params ) {
+				paramsLen = second + secondLen - params - 1;
+				request->setURI( second, params - second );
+				params++;
+			} else {
+				request->setURI( second, secondLen );
 			}
 
-			*message = request;
+			for( ; paramsLen > 0; ) {
+				const char * amp = (char*)memchr( params, '&', paramsLen );
+				int pairLen = NULL != amp ? amp - params : paramsLen;
+
+				const char * eq = (char*)memchr( params, '=', pairLen );
+				if( NULL != eq ) {
+					request->addParam( params, eq - params, eq + 1, params + pairLen - eq - 1 );
+				} else {
+					request->addParam( params, pairLen, "", 0 );
+				}
+
+				params += pairLen + 1;
+				paramsLen -= pairLen + 1;
+			}
 		}
 
-		free( line );
+		*message = request;
 	}
 
 	return lineLen;
 }
 
-int SP_HttpMsgParser :: parseHeader( SP_HttpMessage * message,
-		const void * buffer, int len )
+int SP_HttpMsgParser :: parseHeaders( SP_HttpMessage * message,
+		const void * buffer, int len, int * status )
 {
-	int lineLen = 0;
+	int parsedLen = 0;
 
-	char * pos = (char*)memchr( buffer, '\n', len );
-	if( NULL != pos ) {
-		lineLen = pos - (char*)buffer + 1;
+	const char * head = (char*)buffer;
 
-		char * line = (char*)malloc( lineLen + 1 );
-		memcpy( line, buffer, lineLen );
-		line[ lineLen ] = '\0';
+	// all the colons and line ends are found in one pass over the head,
+	// then the lines are sliced from the offsets
+	int offsets[ eHeaderOffsets ];
 
-		pos = line;
+	for( int count = eHeaderOffsets; eHeader == *status && eHeaderOffsets == count; ) {
+		const char * line = head + parsedLen;
 
-		char * name = sp_strsep( &pos, ":" );
+		count = SP_Scanner::findAll( line, len - parsedLen, ':', '\n',
+				offsets, eHeaderOffsets );
 
-		if( NULL != pos ) {
-			pos = strtok( pos, "\r\n" );
-			pos += strspn( pos, " " );
-			message->addHeader( name, pos );
+		int lineStart = 0, colon = -1;
+
+		for( int i = 0; i < count && eHeader == *status; i++ ) {
+			int pos = offsets[ i ];
+
+			if( ':' == line[ pos ] ) {
+				if( colon < 0 ) colon = pos;
+				continue;
+			}
+
+			int end = pos;
+			for( ; end > lineStart && '\r' == line[ end - 1 ]; ) end--;
+
+			if( end == lineStart ) {
+				// the empty line ends the headers once it is complete
+				*status = eContent;
+			} else if( colon >= 0 ) {
+				int value = colon + 1;
+				for( ; value < end && ' ' == line[ value ]; ) value++;
+
+				message->addHeader( line + lineStart, colon - lineStart,
+						line + value, end - value );
+			}
+
+			lineStart = pos + 1;
+			colon = -1;
+		}
+
+		if( 0 == lineStart && eHeaderOffsets == count ) {
+			// a line with too many colons, slice it alone
+			int lineLen = 0, end = getLineEnd( line, len - parsedLen, &lineLen );
+			if( end < 0 ) break;
+
+			int value = offsets[ 0 ] + 1;
+			for( ; value < end && ' ' == line[ value ]; ) value++;
+
+			message->addHeader( line, offsets[ 0 ], line + value, end - value );
+
+			lineStart = lineLen;
 		}
 
-		free( line );
+		parsedLen += lineStart;
 	}
 
-	return lineLen;
+	return parsedLen;
 }
 
 int SP_HttpMsgParser :: getLine( const void * buffer, int len,
@@ -220,12 +306,9 @@ int SP_HttpMsgParser :: append( const void * buffer, int len )
 
 	if( NULL != mMessage ) {
 		// parse header
-		for( int headerLen = 1; eHeader == mStatus
-				&& headerLen > 0 && parsedLen < len; parsedLen += headerLen ) {
-			headerLen = parseHeader( mMessage, ((char*)buffer) + parsedLen, len - parsedLen );
-
-			char ch = * ( ((char*)buffer) + parsedLen );
-			if( '\r' == ch || '\n' == ch ) mStatus = eContent;
+		if( eHeader == mStatus ) {
+			parsedLen += parseHeaders( mMessage, ((char*)buffer) + parsedLen,
+					len - parsedLen, &mStatus );
 		}
 
 		if( SP_HttpMessage::eResponse == mMessage->getType()
@@ -307,6 +390,43 @@ const char * SP_HttpMessage :: HEADER_TRANSFER_ENCODING = "Transfer-Encoding";
 const char * SP_HttpMessage :: HEADER_DATE = "Date";
 const char * SP_HttpMessage :: HEADER_SERVER = "Server";
 
+// in the order of the well-known ids
+static const char * const * sWellKnownNames[] = {
+	&SP_HttpMessage::HEADER_CONTENT_LENGTH, &SP_HttpMessage::HEADER_CONTENT_TYPE,
+	&SP_HttpMessage::HEADER_CONNECTION, &SP_HttpMessage::HEADER_PROXY_CONNECTION,
+	&SP_HttpMessage::HEADER_TRANSFER_ENCODING, &SP_HttpMessage::HEADER_DATE,
+	&SP_HttpMessage::HEADER_SERVER
+};
+
+int SP_HttpMessage :: getHeaderId( const char * name, int nameLen )
+{
+	if( nameLen < 0 ) {
+		// the callers mostly pass the constants themselves
+		for( int i = 0; i < eWellKnownHeaders; i++ ) {
+			if( name == *sWellKnownNames[ i ] ) return i;
+		}
+
+		nameLen = strlen( name );
+	}
+
+	// the well-known names all differ in length
+	int id = -1;
+
+	switch( nameLen ) {
+		case 4: id = eHeaderDate; break;
+		case 6: id = eHeaderServer; break;
+		case 10: id = eHeaderConnection; break;
+		case 12: id = eHeaderContentType; break;
+		case 14: id = eHeaderContentLength; break;
+		case 16: id = eHeaderProxyConnection; break;
+		case 17: id = eHeaderTransferEncoding; break;
+	}
+
+	if( id >= 0 && 0 != strncasecmp( name, *sWellKnownNames[ id ], nameLen ) ) id = -1;
+
+	return id;
+}
+
 SP_HttpMessage :: SP_HttpMessage( int type )
 	: mType( type )
 {
@@ -314,25 +434,59 @@ SP_HttpMessage :: SP_HttpMessage( int type )
 	mContentLength = 0;
 	mMaxLength = 0;
 
-	mHeaderNameList = new SP_ArrayList();
-	mHeaderValueList = new SP_ArrayList();
+	mHeaders = mInlineHeaders;
+	mHeaderCount = 0;
+	mMaxHeaders = eInlineHeaders;
+
+	for( int i = 0; i < eWellKnownHeaders; i++ ) mWellKnown[ i ] = -1;
+
+	mPool = mInlinePool;
+	mPoolUsed = 0;
+	mPoolSize = eInlinePool;
+	mPoolChunks = NULL;
 
 	snprintf( mVersion, sizeof( mVersion ), "%s", "HTTP/1.0" );
 }
 
 SP_HttpMessage :: ~SP_HttpMessage()
 {
-	for( int i = mHeaderNameList->getCount() - 1; i >= 0; i-- ) {
-		free( mHeaderNameList->takeItem( i ) );
-		free( mHeaderValueList->takeItem( i ) );
-	}
+	if( mHeaders != mInlineHeaders ) free( mHeaders );
 
-	delete mHeaderNameList;
-	delete mHeaderValueList;
+	for( void * chunk = mPoolChunks; NULL != chunk; ) {
+		void * next = *(void**)chunk;
+		free( chunk );
+		chunk = next;
+	}
 
 	if( NULL != mContent ) free( mContent );
 }
 
+const char * SP_HttpMessage :: dupString( const char * str, int len )
+{
+	if( len < 0 ) len = strlen( str );
+
+	if( mPoolUsed + len + 1 > mPoolSize ) {
+		int size = len + 1 > ePoolChunk ? len + 1 : ePoolChunk;
+
+		// the chunks are linked by their first pointer
+		char * chunk = (char*)malloc( sizeof( void * ) + size );
+		*(void**)chunk = mPoolChunks;
+		mPoolChunks = chunk;
+
+		mPool = chunk + sizeof( void * );
+		mPoolUsed = 0;
+		mPoolSize = size;
+	}
+
+	char * ret = mPool + mPoolUsed;
+	memcpy( ret, str, len );
+	ret[ len ] = '\0';
+
+	mPoolUsed += len + 1;
+
+	return ret;
+}
+
 int SP_HttpMessage :: getType() const
 {
 	return mType;
@@ -398,34 +552,84 @@ int SP_HttpMessage :: getContentLength() const
 
 void SP_HttpMessage :: addHeader( const char * name, const char * value )
 {
-	mHeaderNameList->append( strdup( name ) );
-	mHeaderValueList->append( strdup( value ) );
+	addHeader( name, strlen( name ), value, strlen( value ) );
 }
 
-int SP_HttpMessage :: removeHeader( const char * name )
+void SP_HttpMessage :: addHeader( const char * name, int nameLen,
+		const char * value, int valueLen )
 {
-	int ret = 0;
+	if( mHeaderCount >= mMaxHeaders ) {
+		int maxHeaders = mMaxHeaders * 2;
+		SP_HttpHeader_t * headers = (SP_HttpHeader_t*)malloc( sizeof( SP_HttpHeader_t ) * maxHeaders );
+		memcpy( headers, mHeaders, sizeof( SP_HttpHeader_t ) * mHeaderCount );
 
-	for( int i = 0; i < mHeaderNameList->getCount() && 0 == ret; i++ ) {
-		if( 0 == strcasecmp( name, (char*)mHeaderNameList->getItem( i ) ) ) {
-			free( mHeaderNameList->takeItem( i ) );	
-			free( mHeaderValueList->takeItem( i ) );
-			ret = 1;
+		if( mHeaders != mInlineHeaders ) free( mHeaders );
+		mHeaders = headers;
+		mMaxHeaders = maxHeaders;
+	}
+
+	SP_HttpHeader_t * header = &( mHeaders[ mHeaderCount ] );
+	header->mId = getHeaderId( name, nameLen );
+	header->mName = dupString( name, nameLen );
+	header->mNameLen = nameLen;
+	header->mValue = dupString( value, valueLen );
+	header->mValueLen = valueLen;
+
+	if( header->mId >= 0 && mWellKnown[ header->mId ] < 0 ) {
+		mWellKnown[ header->mId ] = mHeaderCount;
+	}
+
+	mHeaderCount++;
+}
+
+int SP_HttpMessage :: findHeader( const char * name ) const
+{
+	int id = getHeaderId( name );
+	if( id >= 0 ) return mWellKnown[ id ];
+
+	// a name which is not well-known never matches a well-known header
+	int nameLen = strlen( name );
+
+	for( int i = 0; i < mHeaderCount; i++ ) {
+		if( nameLen == mHeaders[ i ].mNameLen && mHeaders[ i ].mId < 0
+				&& 0 == strcasecmp( name, mHeaders[ i ].mName ) ) {
+			return i;
 		}
 	}
 
-	return ret;
+	return -1;
+}
+
+int SP_HttpMessage :: removeHeader( const char * name )
+{
+	return removeHeader( findHeader( name ) );
 }
 
 int SP_HttpMessage :: removeHeader( int index )
 {
 	int ret = 0;
 
-	if( index >= 0 && index < mHeaderNameList->getCount() ) {
+	if( index >= 0 && index < mHeaderCount ) {
 		ret = 1;
 
-		free( mHeaderNameList->takeItem( index ) );	
-		free( mHeaderValueList->takeItem( index ) );
+		// the strings stay in the pool until the message is deleted
+		memmove( mHeaders + index, mHeaders + index + 1,
+				sizeof( SP_HttpHeader_t ) * ( mHeaderCount - index - 1 ) );
+		mHeaderCount--;
+
+		for( int id = 0; id < eWellKnownHeaders; id++ ) {
+			if( mWellKnown[ id ] < index ) continue;
+
+			if( mWellKnown[ id ] > index ) {
+				mWellKnown[ id ]--;
+			} else {
+				// the removed one was the first, look for the next one
+				mWellKnown[ id ] = -1;
+				for( int i = index; i < mHeaderCount && mWellKnown[ id ] < 0; i++ ) {
+					if( id == mHeaders[ i ].mId ) mWellKnown[ id ] = i;
+				}
+			}
+		}
 	}
 
 	return ret;
@@ -433,30 +637,33 @@ int SP_HttpMessage :: removeHeader( int index )
 
 int SP_HttpMessage :: getHeaderCount() const
 {
-	return mHeaderNameList->getCount();
+	return mHeaderCount;
+}
+
+const SP_HttpHeader_t * SP_HttpMessage :: getHeader( int index ) const
+{
+	if( index >= 0 && index < mHeaderCount ) return &( mHeaders[ index ] );
+
+	return NULL;
 }
 
 const char * SP_HttpMessage :: getHeaderName( int index ) const
 {
-	return (char*)mHeaderNameList->getItem( index );
+	const SP_HttpHeader_t * header = getHeader( index );
+
+	return NULL != header ? header->mName : NULL;
 }
 
 const char * SP_HttpMessage :: getHeaderValue( int index ) const
 {
-	return (char*)mHeaderValueList->getItem( index );
+	const SP_HttpHeader_t * header = getHeader( index );
+
+	return NULL != header ? header->mValue : NULL;
 }
 
 const char * SP_HttpMessage :: getHeaderValue( const char * name ) const
 {
-	const char * value = NULL;
-
-	for( int i = 0; i < mHeaderNameList->getCount() && NULL == value; i++ ) {
-		if( 0 == strcasecmp( name, (char*)mHeaderNameList->getItem( i ) ) ) {
-			value = (char*)mHeaderValueList->getItem( i );
-		}
-	}
-
-	return value;
+	return getHeaderValue( findHeader( name ) );
 }
 
 int SP_HttpMessage :: isKeepAlive() const
@@ -469,7 +676,13 @@ int SP_HttpMessage :: isKeepAlive() const
 		return 1;
 	}
 
-	return 0;
+	// HTTP/1.1 connections are persistent unless they are closed explicitly
+	if( ( NULL != proxy && 0 == strcasecmp( proxy, "close" ) )
+			|| ( NULL != local && 0 == strcasecmp( local, "close" ) ) ) {
+		return 0;
+	}
+
+	return 0 == strcasecmp( mVersion, "HTTP/1.1" ) ? 1 : 0;
 }
 
 //---------------------------------------------------------
@@ -481,21 +694,15 @@ SP_HttpRequest :: SP_HttpRequest()
 	memset( mClientIP, 0, sizeof( mClientIP ) );
 	mURI = mURL = NULL;
 
-	mParamNameList = new SP_ArrayList();
-	mParamValueList = new SP_ArrayList();
+	// most requests have no params, the lists are created by the first addParam
+	mParamNameList = mParamValueList = NULL;
 }
 
 SP_HttpRequest :: ~SP_HttpRequest()
 {
-	if( NULL != mURI ) free( mURI );
-	if( NULL != mURL ) free( mURL );
-
-	for( int i = mParamNameList->getCount() - 1; i >= 0; i-- ) {
-		free( mParamNameList->takeItem( i ) );
-		free( mParamValueList->takeItem( i ) );
-	}
-	delete mParamNameList;
-	delete mParamValueList;
+	// the uri, url and params are kept in the pool of the message
+	if( NULL != mParamNameList ) delete mParamNameList;
+	if( NULL != mParamValueList ) delete mParamValueList;
 }
 
 void SP_HttpRequest :: setMethod( const char * method )
@@ -508,13 +715,9 @@ const char * SP_HttpRequest :: getMethod() const
 	return mMethod;
 }
 
-void SP_HttpRequest :: setURI( const char * uri )
+void SP_HttpRequest :: setURI( const char * uri, int len )
 {
-	char * temp = mURI;
-
-	mURI = strdup( uri );
-
-	if( NULL != temp ) free( temp );
+	mURI = dupString( uri, len );
 }
 
 const char * SP_HttpRequest :: getURI() const
@@ -522,13 +725,9 @@ const char * SP_HttpRequest :: getURI() const
 	return mURI;
 }
 
-void SP_HttpRequest :: setURL( const char * url )
+void SP_HttpRequest :: setURL( const char * url, int len )
 {
-	char * temp = mURL;
-
-	mURL = strdup( url );
-
-	if( NULL != temp ) free( temp );
+	mURL = dupString( url, len );
 }
 
 const char * SP_HttpRequest :: getURL() const
@@ -548,18 +747,29 @@ const char * SP_HttpRequest :: getClientIP() const
 
 void SP_HttpRequest :: addParam( const char * name, const char * value )
 {
-	mParamNameList->append( strdup( name ) );
-	mParamValueList->append( strdup( value ) );
+	addParam( name, strlen( name ), value, strlen( value ) );
+}
+
+void SP_HttpRequest :: addParam( const char * name, int nameLen,
+		const char * value, int valueLen )
+{
+	if( NULL == mParamNameList ) {
+		mParamNameList = new SP_ArrayList();
+		mParamValueList = new SP_ArrayList();
+	}
+
+	mParamNameList->append( (void*)dupString( name, nameLen ) );
+	mParamValueList->append( (void*)dupString( value, valueLen ) );
 }
 
 int SP_HttpRequest :: removeParam( const char * name )
 {
 	int ret = 0;
 
-	for( int i = 0; i < mParamNameList->getCount() && 0 == ret; i++ ) {
+	for( int i = 0; i < getParamCount() && 0 == ret; i++ ) {
 		if( 0 == strcasecmp( name, (char*)mParamNameList->getItem( i ) ) ) {
-			free( mParamNameList->takeItem( i ) );	
-			free( mParamValueList->takeItem( i ) );
+			mParamNameList->takeItem( i );
+			mParamValueList->takeItem( i );
 			ret = 1;
 		}
 	}
@@ -569,24 +779,24 @@ int SP_HttpRequest :: removeParam( const char * name )
 
 int SP_HttpRequest :: getParamCount() const
 {
-	return mParamNameList->getCount();
+	return NULL != mParamNameList ? mParamNameList->getCount() : 0;
 }
 
 const char * SP_HttpRequest :: getParamName( int index ) const
 {
-	return (char*)mParamNameList->getItem( index );
+	return NULL != mParamNameList ? (char*)mParamNameList->getItem( index ) : NULL;
 }
 
 const char * SP_HttpRequest :: getParamValue( int index ) const
 {
-	return (char*)mParamValueList->getItem( index );
+	return NULL != mParamValueList ? (char*)mParamValueList->getItem( index ) : NULL;
 }
 
 const char * SP_HttpRequest :: getParamValue( const char * name ) const
 {
 	const char * value = NULL;
 
-	for( int i = 0; i < mParamNameList->getCount() && NULL == value; i++ ) {
+	for( int i = 0; i < getParamCount() && NULL == value; i++ ) {
 		if( 0 == strcasecmp( name, (char*)mParamNameList->getItem( i ) ) ) {
 			value = (char*)mParamValueList->getItem( i );
 		}
@@ -602,10 +812,16 @@ SP_HttpResponse :: SP_HttpResponse()
 {
 	mStatusCode = 200;
 	snprintf( mReasonPhrase, sizeof( mReasonPhrase ), "%s", "OK" );
+
+	mFileFd = -1;
+	mFileOffset = 0;
+	mFileLength = 0;
 }
 
 SP_HttpResponse :: ~SP_HttpResponse()
 {
+	if( mFileFd >= 0 ) close( mFileFd );
+	mFileFd = -1;
 }
 
 void SP_HttpResponse :: setStatusCode( int statusCode )
@@ -628,5 +844,40 @@ const char * SP_HttpResponse :: getReasonPhrase() const
 	return mReasonPhrase;
 }
 
+void SP_HttpResponse :: setFile( int fd, off_t offset, size_t length )
+{
+	if( mFileFd >= 0 && mFileFd != fd ) close( mFileFd );
+
+	mFileFd = fd;
+	mFileOffset = offset;
+	mFileLength = length;
+}
+
+int SP_HttpResponse :: getFile() const
+{
+	return mFileFd;
+}
+
+off_t SP_HttpResponse :: getFileOffset() const
+{
+	return mFileOffset;
+}
+
+size_t SP_HttpResponse :: getFileLength() const
+{
+	return mFileLength;
+}
+
+int SP_HttpResponse :: takeFile()
+{
+	int fd = mFileFd;
+
+	mFileFd = -1;
+	mFileOffset = 0;
+	mFileLength = 0;
+
+	return fd;
+}
+
 //---------------------------------------------------------
 
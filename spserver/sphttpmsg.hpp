@@ -6,6 +6,8 @@
 #ifndef __sphttpmsg_hpp__
 #define __sphttpmsg_hpp__
 
+#include <sys/types.h>
+
 class SP_ArrayList;
 class SP_HttpRequest;
 class SP_HttpResponse;
@@ -31,8 +33,8 @@ public:
 private:
 	static int parseStartLine( SP_HttpMessage ** message,
 		const void * buffer, int len );
-	static int parseHeader( SP_HttpMessage * message,
-		const void * buffer, int len );
+	static int parseHeaders( SP_HttpMessage * message,
+		const void * buffer, int len, int * status );
 	static int parseChunked( SP_HttpMessage * message,
 		const void * buffer, int len, int * status );
 	static int parseContent( SP_HttpMessage * message,
@@ -41,14 +43,29 @@ private:
 
 	static int getLine( const void * buffer, int len, char * line, int size );
 
+	// return the length of the line without the CRLF, -1 if the line is incomplete
+	static int getLineEnd( const char * buffer, int len, int * lineLen );
+
 	SP_HttpMessage * mMessage;
 
 	enum { eStartLine, eHeader, eContent, eCompleted };
 	int mStatus;
 
+	enum { eHeaderOffsets = 128 };
+
 	int mIgnoreContent;
 };
 
+// a header of the message, the name and the value are null-terminated
+// slices in the string pool of the message
+typedef struct tagSP_HttpHeader {
+	const char * mName;
+	const char * mValue;
+	int mNameLen, mValueLen;
+	// the well-known id of the name, -1 for the others
+	int mId;
+} SP_HttpHeader_t;
+
 class SP_HttpMessage {
 public:
 	static const char * HEADER_CONTENT_LENGTH;
@@ -59,6 +76,14 @@ public:
 	static const char * HEADER_DATE;
 	static const char * HEADER_SERVER;
 
+	// the interned ids of the well-known headers, -1 for the others
+	enum { eHeaderContentLength, eHeaderContentType, eHeaderConnection,
+		eHeaderProxyConnection, eHeaderTransferEncoding, eHeaderDate,
+		eHeaderServer, eWellKnownHeaders };
+
+	// nameLen -1 : null-terminated name
+	static int getHeaderId( const char * name, int nameLen = -1 );
+
 public:
 	SP_HttpMessage( int type );
 	virtual ~SP_HttpMessage();
@@ -76,23 +101,50 @@ public:
 	int getContentLength() const;
 
 	void addHeader( const char * name, const char * value );
+	// the name and the value need not be null-terminated
+	void addHeader( const char * name, int nameLen, const char * value, int valueLen );
 	int removeHeader( const char * name );
 	int removeHeader( int index );
 	int getHeaderCount() const;
 	const char * getHeaderName( int index ) const;
 	const char * getHeaderValue( int index ) const;
 	const char * getHeaderValue( const char * name ) const;
+	const SP_HttpHeader_t * getHeader( int index ) const;
 
 	int isKeepAlive() const;
 
 protected:
+	// copy the string into the pool, the copy is null-terminated and
+	// lives as long as the message, len -1 : null-terminated string
+	const char * dupString( const char * str, int len = -1 );
+
+	// the index of the first header with the name, -1 if none
+	int findHeader( const char * name ) const;
+
 	const int mType;
 
 	char mVersion[ 16 ];
 	void * mContent;
 	int mMaxLength, mContentLength;
 
-	SP_ArrayList * mHeaderNameList, * mHeaderValueList;
+	// most messages fit in the inline header table and pool
+	enum { eInlineHeaders = 16, eInlinePool = 1024, ePoolChunk = 4096 };
+
+	SP_HttpHeader_t * mHeaders;
+	int mHeaderCount, mMaxHeaders;
+	SP_HttpHeader_t mInlineHeaders[ eInlineHeaders ];
+
+	// the index of the first header of each well-known id, -1 if absent
+	int mWellKnown[ eWellKnownHeaders ];
+
+	char * mPool;
+	int mPoolUsed, mPoolSize;
+	void * mPoolChunks;
+	char mInlinePool[ eInlinePool ];
+
+private:
+	SP_HttpMessage( SP_HttpMessage & );
+	SP_HttpMessage & operator=( SP_HttpMessage & );
 };
 
 class SP_HttpRequest : public SP_HttpMessage {
@@ -103,16 +155,18 @@ public:
 	void setMethod( const char * method );
 	const char * getMethod() const;
 
-	void setURI( const char * uri );
+	// len -1 : null-terminated string
+	void setURI( const char * uri, int len = -1 );
 	const char * getURI() const;
 
-	void setURL( const char * url );
+	void setURL( const char * url, int len = -1 );
 	const char * getURL() const;
 
 	void setClinetIP( const char * clientIP );
 	const char * getClientIP() const;
 
 	void addParam( const char * name, const char * value );
+	void addParam( const char * name, int nameLen, const char * value, int valueLen );
 	int removeParam( const char * name );
 	int getParamCount() const;
 	const char * getParamName( int index ) const;
@@ -121,7 +175,7 @@ public:
 
 private:
 	char mMethod[ 16 ], mClientIP[ 16 ];
-	char * mURI, * mURL;
+	const char * mURI, * mURL;
 
 	SP_ArrayList * mParamNameList, * mParamValueList;
 };
@@ -137,9 +191,23 @@ public:
 	void setReasonPhrase( const char * reasonPhrase );
 	const char * getReasonPhrase() const;
 
+	// send [ offset, offset + length ) of the file after the content,
+	// the response takes over the fd
+	void setFile( int fd, off_t offset, size_t length );
+	int getFile() const;
+	off_t getFileOffset() const;
+	size_t getFileLength() const;
+
+	// give up the fd, the caller should close it
+	int takeFile();
+
 private:
 	int mStatusCode;
 	char mReasonPhrase[ 128 ];
+
+	int mFileFd;
+	off_t mFileOffset;
+	size_t mFileLength;
 };
 
 #endif
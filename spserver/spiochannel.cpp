@@ -5,6 +5,11 @@
 
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "spporting.hpp"
 
@@ -17,6 +22,7 @@
 #include "spmsgblock.hpp"
 
 #ifdef WIN32
+#include <io.h>
 #include "spwin32buffer.hpp"
 #include "spiocpevent.hpp"
 #include "spwin32iocp.hpp"
@@ -43,80 +49,183 @@ int SP_IOChannel :: transmit( SP_Session * session )
 
     SP_IocpSession_t * iocpSession = (SP_IocpSession_t*)session->getArg();
     SP_IocpEventArg * eventArg = iocpSession->mEventArg;
+	SP_BlockingQueue * outputQueue = eventArg->getOutputResultQueue();
 #else
 #	ifdef IOV_MAX
 	const static int SP_MAX_IOV = IOV_MAX;
 #	else
 	const static int SP_MAX_IOV = 8;
 #	endif
-	SP_EventArg * eventArg = (SP_EventArg*)session->getArg();
+	SP_BlockingQueue * outputQueue = session->getOutputQueue();
+	if( NULL == outputQueue ) {
+		outputQueue = ( (SP_EventArg*)session->getArg() )->getOutputResultQueue();
+	}
 #endif
 
 	SP_ArrayList * outList = session->getOutList();
-	size_t outOffset = session->getOutOffset();
 
 	struct iovec iovArray[ SP_MAX_IOV ];
-	memset( iovArray, 0, sizeof( iovArray ) );
 
-	int iovSize = 0;
+	int total = 0;
+
+	for( ; outList->getCount() > 0; ) {
+		int iovSize = 0;
+		size_t iovLen = 0;
 
-	for( int i = 0; i < outList->getCount() && iovSize < SP_MAX_IOV; i++ ) {
-		SP_Message * msg = (SP_Message*)outList->getItem( i );
+		// start from the write cursor, only the first message can be partly sent
+		int block = session->getOutBlock();
+		size_t offset = session->getOutBlockOffset();
 
-		if( outOffset >= msg->getMsg()->getSize() ) {
-			outOffset -= msg->getMsg()->getSize();
-		} else {
-			iovArray[ iovSize ].iov_base = (char*)msg->getMsg()->getBuffer() + outOffset;
-			iovArray[ iovSize++ ].iov_len = msg->getMsg()->getSize() - outOffset;
-			outOffset = 0;
+		// a file block is sent alone, the iovecs stop in front of it
+		const SP_MsgBlock * fileBlock = NULL;
+		size_t fileOffset = 0;
+		int stop = 0;
+
+		for( int i = 0; i < outList->getCount() && iovSize < SP_MAX_IOV && 0 == stop; i++ ) {
+			SP_Message * msg = (SP_Message*)outList->getItem( i );
+
+			if( block < 0 ) {
+				if( offset < msg->getMsg()->getSize() ) {
+					iovArray[ iovSize ].iov_base = (char*)msg->getMsg()->getRawBuffer() + offset;
+					iovArray[ iovSize ].iov_len = msg->getMsg()->getSize() - offset;
+					iovLen += iovArray[ iovSize++ ].iov_len;
+				}
+				block = 0;
+				offset = 0;
+			}
+
+			SP_MsgBlockList * blockList = msg->getFollowBlockList();
+			for( int j = block; j < blockList->getCount() && iovSize < SP_MAX_IOV; j++ ) {
+				const SP_MsgBlock * item = blockList->getItem( j );
+
+				if( offset < item->getSize() ) {
+					if( item->getFd() >= 0 ) {
+						if( 0 == iovSize ) {
+							fileBlock = item;
+							fileOffset = offset;
+							iovLen = item->getSize() - offset;
+						}
+						stop = 1;
+						break;
+					}
+
+					iovArray[ iovSize ].iov_base = (char*)item->getData() + offset;
+					iovArray[ iovSize ].iov_len = item->getSize() - offset;
+					iovLen += iovArray[ iovSize++ ].iov_len;
+				}
+				offset = 0;
+			}
+
+			block = -1;
 		}
 
-		SP_MsgBlockList * blockList = msg->getFollowBlockList();
-		for( int j = 0; j < blockList->getCount() && iovSize < SP_MAX_IOV; j++ ) {
-			SP_MsgBlock * block = (SP_MsgBlock*)blockList->getItem( j );
+		int len = 0;
 
-			if( outOffset >= block->getSize() ) {
-				outOffset -= block->getSize();
+		if( NULL != fileBlock || iovSize > 0 ) {
+			if( NULL != fileBlock ) {
+				len = write_file( fileBlock->getFd(), fileBlock->getOffset() + fileOffset, iovLen );
 			} else {
-				iovArray[ iovSize ].iov_base = (char*)block->getData() + outOffset;
-				iovArray[ iovSize++ ].iov_len = block->getSize() - outOffset;
-				outOffset = 0;
+				len = write_vec( iovArray, iovSize );
 			}
-		}
-	}
 
-	int len = write_vec( iovArray, iovSize );
+			if( len <= 0 ) {
+				if( 0 == total ) total = len;
+				break;
+			}
 
-	if( len > 0 ) {
-		outOffset = session->getOutOffset() + len;
+			total += len;
+		}
+
+		// advance the cursor, release the messages which are sent completely
+		size_t remain = len;
 
 		for( ; outList->getCount() > 0; ) {
 			SP_Message * msg = (SP_Message*)outList->getItem( 0 );
-			if( outOffset >= msg->getTotalSize() ) {
-				msg = (SP_Message*)outList->takeItem( 0 );
-				outOffset = outOffset - msg->getTotalSize();
+			SP_MsgBlockList * blockList = msg->getFollowBlockList();
+
+			block = session->getOutBlock();
+			offset = session->getOutBlockOffset();
+
+			size_t sent = remain;
 
-				int index = msg->getToList()->find( session->getSid() );
-				if( index >= 0 ) msg->getToList()->take( index );
-				msg->getSuccess()->add( session->getSid() );
+			for( ; block < blockList->getCount(); block++, offset = 0 ) {
+				size_t size = block < 0 ? msg->getMsg()->getSize()
+						: blockList->getItem( block )->getSize();
 
-				if( msg->getToList()->getCount() <= 0 ) {
-					eventArg->getOutputResultQueue()->push( msg );
+				if( remain < size - offset ) {
+					offset += remain;
+					remain = 0;
+					break;
 				}
-			} else {
+
+				remain -= size - offset;
+			}
+
+			if( block < blockList->getCount() ) {
+				session->setOutCursor( block, offset );
+				session->setOutOffset( session->getOutOffset() + sent );
 				break;
 			}
+
+			msg = (SP_Message*)outList->takeItem( 0 );
+			session->setOutCursor( -1, 0 );
+			session->setOutOffset( 0 );
+
+			int index = msg->getToList()->find( session->getSid() );
+			if( index >= 0 ) msg->getToList()->take( index );
+			msg->getSuccess()->add( session->getSid() );
+
+			if( msg->getToList()->getCount() <= 0 ) {
+				SP_Message * completed = msg->complete();
+				if( NULL != completed ) outputQueue->push( completed );
+			}
 		}
 
-		session->setOutOffset( outOffset );
+		// short write, the socket buffer is full
+		if( (size_t)len < iovLen ) break;
 	}
 
-	if( len > 0 && outList->getCount() > 0 ) {
-		int tmpLen = transmit( session );
-		if( tmpLen > 0 ) len += tmpLen;
+	return total;
+}
+
+int SP_IOChannel :: write_file( int fd, off_t offset, size_t len )
+{
+	char buffer[ 16 * 1024 ];
+
+	int total = 0;
+
+	// leave the rest to the next write event, the event loop cannot be held too long
+	for( ; len > 0 && total < 1024 * 1024; ) {
+		size_t size = len < sizeof( buffer ) ? len : sizeof( buffer );
+
+#ifdef WIN32
+		int ret = -1;
+		if( lseek( fd, offset, SEEK_SET ) >= 0 ) ret = read( fd, buffer, size );
+#else
+		int ret = pread( fd, buffer, size, offset );
+#endif
+
+		if( ret <= 0 ) {
+			// the file is shorter than the block
+			if( 0 == ret ) errno = EIO;
+			return total > 0 ? total : -1;
+		}
+
+		struct iovec iov;
+		iov.iov_base = buffer;
+		iov.iov_len = ret;
+
+		int written = write_vec( &iov, 1 );
+		if( written <= 0 ) return total > 0 ? total : written;
+
+		total += written;
+		offset += written;
+		len -= written;
+
+		if( written < ret ) break;
 	}
 
-	return len;
+	return total;
 }
 
 //---------------------------------------------------------
@@ -158,6 +267,26 @@ int SP_DefaultIOChannel :: write_vec( struct iovec * iovArray, int iovSize )
 	return sp_writev( mFd, iovArray, iovSize );
 }
 
+int SP_DefaultIOChannel :: write_file( int fd, off_t offset, size_t len )
+{
+#ifdef __linux__
+	// keep the return value in the range of int
+	if( len > 1024 * 1024 * 1024 ) len = 1024 * 1024 * 1024;
+
+	int ret = sendfile( mFd, fd, &offset, len );
+
+	// the file is shorter than the block
+	if( 0 == ret ) {
+		errno = EIO;
+		ret = -1;
+	}
+
+	return ret;
+#else
+	return SP_IOChannel::write_file( fd, offset, len );
+#endif
+}
+
 //---------------------------------------------------------
 
 SP_DefaultIOChannelFactory :: SP_DefaultIOChannelFactory()
@@ -6,6 +6,8 @@
 #ifndef __spiochannel_hpp__
 #define __spiochannel_hpp__
 
+#include <sys/types.h>
+
 class SP_Session;
 class SP_Buffer;
 
@@ -38,6 +40,11 @@ protected:
 
 	// returns the number of bytes written, or -1 if an error occurred.
 	virtual int write_vec( struct iovec * iovArray, int iovSize ) = 0;
+
+	// write [ offset, offset + len ) of the file,
+	// the default reads the file and writes it with write_vec.
+	// returns the number of bytes written, or -1 if an error occurred.
+	virtual int write_file( int fd, off_t offset, size_t len );
 };
 
 class SP_IOChannelFactory {
@@ -65,6 +72,7 @@ public:
 
 protected:
 	virtual int write_vec( struct iovec * iovArray, int iovSize );
+	virtual int write_file( int fd, off_t offset, size_t len );
 	int mFd;
 };
 
@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include "spporting.hpp"
 
@@ -63,7 +64,7 @@ int SP_IOUtils :: setBlock( int fd )
 	return 0;
 }
 
-int SP_IOUtils :: tcpListen( const char * ip, int port, int * fd, int blocking )
+int SP_IOUtils :: tcpListen( const char * ip, int port, int * fd, int blocking, int reusePort )
 {
 	int ret = 0;
 
@@ -92,6 +93,20 @@ int SP_IOUtils :: tcpListen( const char * ip, int port, int * fd, int blocking )
 		}
 	}
 
+	if( 0 == ret && reusePort ) {
+#ifdef SO_REUSEPORT
+		int flags = 1;
+		if( setsockopt( listenFd, SOL_SOCKET, SO_REUSEPORT, (char*)&flags, sizeof( flags ) ) < 0 ) {
+			sp_syslog( LOG_WARNING, "failed to set socket to reuseport, errno %d, %s",
+				errno, strerror( errno ) );
+			ret = -1;
+		}
+#else
+		sp_syslog( LOG_WARNING, "SO_REUSEPORT is not supported" );
+		ret = -1;
+#endif
+	}
+
 	struct sockaddr_in addr;
 
 	if( 0 == ret ) {
@@ -16,7 +16,8 @@ public:
 
 	static int setBlock( int fd );
 
-	static int tcpListen( const char * ip, int port, int * fd, int blocking = 1 );
+	// reusePort: set SO_REUSEPORT, so several sockets can listen on the same port
+	static int tcpListen( const char * ip, int port, int * fd, int blocking = 1, int reusePort = 0 );
 
 	static int initDaemon( const char * workdir = 0 );
 
@@ -38,6 +38,7 @@ SP_LFServer :: SP_LFServer( const char * bindIP, int port, SP_HandlerFactory * h
 	mAcceptArg->mMaxConnections = 256;
 	mAcceptArg->mReqQueueSize = 128;
 	mAcceptArg->mRefusedMsg = strdup( "System busy, try again later." );
+	mAcceptArg->mAcceptBatch = 16;
 	mAcceptArg->mHandlerFactory = handlerFactory;
 
 	mAcceptArg->mEventArg = mEventArg;
@@ -115,6 +116,12 @@ void SP_LFServer :: setIOChannelFactory( SP_IOChannelFactory * ioChannelFactory
 	mAcceptArg->mIOChannelFactory = ioChannelFactory;
 }
 
+void SP_LFServer :: setAcceptBatch( int acceptBatch )
+{
+	mAcceptArg->mAcceptBatch = acceptBatch > 0 ?
+			acceptBatch : mAcceptArg->mAcceptBatch;
+}
+
 void SP_LFServer :: shutdown()
 {
 	mIsShutdown = 1;
@@ -30,6 +30,9 @@ public:
 	void setReqQueueSize( int reqQueueSize, const char * refusedMsg );
 	void setIOChannelFactory( SP_IOChannelFactory * ioChannelFactory );
 
+	// max connections accepted per wakeup of the listen socket, default is 16
+	void setAcceptBatch( int acceptBatch );
+
 	void shutdown();
 	int isRunning();
 
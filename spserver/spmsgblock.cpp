@@ -3,6 +3,8 @@
  * For license terms, see the file COPYING along with this library.
  */
 
+#include "spporting.hpp"
+
 #include "spmsgblock.hpp"
 
 #include "spbuffer.hpp"
@@ -12,6 +14,16 @@ SP_MsgBlock :: ~SP_MsgBlock()
 {
 }
 
+int SP_MsgBlock :: getFd() const
+{
+	return -1;
+}
+
+off_t SP_MsgBlock :: getOffset() const
+{
+	return 0;
+}
+
 //---------------------------------------------------------
 
 SP_MsgBlockList :: SP_MsgBlockList()
@@ -92,7 +104,7 @@ SP_BufferMsgBlock :: ~SP_BufferMsgBlock()
 
 const void * SP_BufferMsgBlock :: getData() const
 {
-	return mBuffer->getBuffer();
+	return mBuffer->getRawBuffer();
 }
 
 size_t SP_BufferMsgBlock :: getSize() const
@@ -150,3 +162,63 @@ void SP_SimpleMsgBlock :: setData( void * data, size_t size, int toBeOwner )
 	mToBeOwner = toBeOwner;
 }
 
+//---------------------------------------------------------
+
+SP_SliceMsgBlock :: SP_SliceMsgBlock( SP_BufferSlice * slice, int toBeOwner )
+{
+	mSlice = slice;
+	mToBeOwner = toBeOwner;
+}
+
+SP_SliceMsgBlock :: ~SP_SliceMsgBlock()
+{
+	if( mToBeOwner ) delete mSlice;
+	mSlice = NULL;
+}
+
+const void * SP_SliceMsgBlock :: getData() const
+{
+	return mSlice->getData();
+}
+
+size_t SP_SliceMsgBlock :: getSize() const
+{
+	return mSlice->getSize();
+}
+
+
+//---------------------------------------------------------
+
+SP_FileMsgBlock :: SP_FileMsgBlock( int fd, off_t offset, size_t size, int toBeOwner )
+{
+	mFd = fd;
+	mOffset = offset;
+	mSize = size;
+	mToBeOwner = toBeOwner;
+}
+
+SP_FileMsgBlock :: ~SP_FileMsgBlock()
+{
+	if( mToBeOwner && mFd >= 0 ) close( mFd );
+	mFd = -1;
+}
+
+const void * SP_FileMsgBlock :: getData() const
+{
+	return NULL;
+}
+
+size_t SP_FileMsgBlock :: getSize() const
+{
+	return mSize;
+}
+
+int SP_FileMsgBlock :: getFd() const
+{
+	return mFd;
+}
+
+off_t SP_FileMsgBlock :: getOffset() const
+{
+	return mOffset;
+}
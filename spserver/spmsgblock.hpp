@@ -7,8 +7,10 @@
 #define __spmsgblock_hpp__
 
 #include <stdio.h>
+#include <sys/types.h>
 
 class SP_Buffer;
+class SP_BufferSlice;
 class SP_ArrayList;
 
 class SP_MsgBlock {
@@ -17,6 +19,11 @@ public:
 
 	virtual const void * getData() const = 0;
 	virtual size_t getSize() const = 0;
+
+	// -1 for a memory block, otherwise the data is [ getOffset(), getOffset() + getSize() )
+	// of the file, and getData() returns NULL
+	virtual int getFd() const;
+	virtual off_t getOffset() const;
 };
 
 class SP_MsgBlockList {
@@ -79,5 +86,44 @@ private:
 	int mToBeOwner;
 };
 
+// reference the data of a SP_BufferSlice, no copy
+class SP_SliceMsgBlock : public SP_MsgBlock {
+public:
+	SP_SliceMsgBlock( SP_BufferSlice * slice, int toBeOwner );
+	virtual ~SP_SliceMsgBlock();
+
+	virtual const void * getData() const;
+	virtual size_t getSize() const;
+
+private:
+	SP_SliceMsgBlock( SP_SliceMsgBlock & );
+	SP_SliceMsgBlock & operator=( SP_SliceMsgBlock & );
+
+	SP_BufferSlice * mSlice;
+	int mToBeOwner;
+};
+
+// reference a range of a file, it is sent without being read into memory
+class SP_FileMsgBlock : public SP_MsgBlock {
+public:
+	SP_FileMsgBlock( int fd, off_t offset, size_t size, int toBeOwner );
+	virtual ~SP_FileMsgBlock();
+
+	virtual const void * getData() const;
+	virtual size_t getSize() const;
+
+	virtual int getFd() const;
+	virtual off_t getOffset() const;
+
+private:
+	SP_FileMsgBlock( SP_FileMsgBlock & );
+	SP_FileMsgBlock & operator=( SP_FileMsgBlock & );
+
+	int mFd;
+	off_t mOffset;
+	size_t mSize;
+	int mToBeOwner;
+};
+
 #endif
 
@@ -11,6 +11,7 @@
 
 #include "spbuffer.hpp"
 #include "sputils.hpp"
+#include "spscan.hpp"
 
 //-------------------------------------------------------------------
 
@@ -135,17 +136,15 @@ int SP_DotTermMsgDecoder :: decode( SP_Buffer * inBuffer )
 		mBuffer = NULL;
 	}
 
-	const char * pos = (char*)inBuffer->find( "\r\n.\r\n", 5 );	
-
-	if( NULL == pos ) {
-		pos = (char*)inBuffer->find( "\n.\n", 3 );
-	}
+	int termLen = 0;
+	const char * pos = SP_Scanner::findDotTerm( (char*)inBuffer->getRawBuffer(),
+			inBuffer->getSize(), &termLen );
 
 	if( NULL != pos ) {
 		int len = pos - (char*)inBuffer->getRawBuffer();
 
 		mBuffer = (char*)malloc( len + 1 );
-		memcpy( mBuffer, inBuffer->getBuffer(), len );
+		memcpy( mBuffer, inBuffer->getRawBuffer(), len );
 		mBuffer[ len ] = '\0';
 
 		inBuffer->erase( len );
@@ -158,11 +157,7 @@ int SP_DotTermMsgDecoder :: decode( SP_Buffer * inBuffer )
 		}
 		* des = '\0';
 
-		if( 0 == strncmp( (char*)pos, "\n.\n", 3 ) ) {
-			inBuffer->erase( 3 );
-		} else  {
-			inBuffer->erase( 5 );
-		}
+		inBuffer->erase( termLen );
 		return eOK;
 	} else {
 		return eMoreData;
@@ -195,28 +190,22 @@ int SP_DotTermChunkMsgDecoder :: decode( SP_Buffer * inBuffer )
 {
 	if( inBuffer->getSize() <= 0 ) return eMoreData;
 
-	const char * pos = (char*)inBuffer->find( "\r\n.\r\n", 5 );	
-
-	if( NULL == pos ) {
-		pos = (char*)inBuffer->find( "\n.\n", 3 );
-	}
+	int termLen = 0;
+	const char * pos = SP_Scanner::findDotTerm( (char*)inBuffer->getRawBuffer(),
+			inBuffer->getSize(), &termLen );
 
 	if( NULL != pos ) {
 		if( pos != inBuffer->getRawBuffer() ) {
 			int len = pos - (char*)inBuffer->getRawBuffer();
 
 			SP_Buffer * last = new SP_Buffer();
-			last->append( inBuffer->getBuffer(), len );
+			last->append( inBuffer->getRawBuffer(), len );
 			mList->append( last );
 
 			inBuffer->erase( len );
 		}
 
-		if( 0 == strncmp( (char*)pos, "\n.\n", 3 ) ) {
-			inBuffer->erase( 3 );
-		} else  {
-			inBuffer->erase( 5 );
-		}
+		inBuffer->erase( termLen );
 
 		return eOK;
 	} else {
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "spporting.hpp"
+
+#include "sprelay.hpp"
+#include "speventcb.hpp"
+#include "sptimerwheel.hpp"
+#include "sphandler.hpp"
+
+#include "event.h"
+
+#if defined( __linux__ ) && defined( SPLICE_F_NONBLOCK ) && ! defined( SP_NO_SPLICE )
+#define SP_HAVE_SPLICE
+#endif
+
+struct tagSP_RelayPipe {
+	int mSrc, mDst;
+
+	// data is moved by splice through the pipe, or by read/write through the buffer
+	int mPipe[ 2 ];
+	char * mBuffer;
+	size_t mOffset;
+
+	size_t mPending;
+	int mDone;
+
+	struct event mReadEvent;
+	struct event mWriteEvent;
+
+	SP_Relay_t * mRelay;
+};
+
+struct tagSP_Relay {
+	SP_EventArg * mEventArg;
+	SP_RelayPipe_t mPipeList[ 2 ];
+
+	// the idle timeout of both directions
+	SP_TimerNode_t mTimerNode;
+
+	SP_RelayHandler * mHandler;
+};
+
+enum { eRelayChunk = 64 * 1024 };
+
+int SP_Relay :: start( SP_EventArg * eventArg, int fd1, int fd2, SP_RelayHandler * handler )
+{
+	SP_Relay_t * relay = (SP_Relay_t*)calloc( 1, sizeof( SP_Relay_t ) );
+	if( NULL == relay ) {
+		sp_close( fd1 );
+		sp_close( fd2 );
+		closeHandler( handler );
+		return -1;
+	}
+
+	relay->mEventArg = eventArg;
+	relay->mHandler = handler;
+	SP_TimerWheel::initNode( &( relay->mTimerNode ), onTimeout, relay );
+
+	for( int i = 0; i < 2; i++ ) {
+		SP_RelayPipe_t * pipe = &( relay->mPipeList[ i ] );
+
+		pipe->mRelay = relay;
+		pipe->mSrc = 0 == i ? fd1 : fd2;
+		pipe->mDst = 0 == i ? fd2 : fd1;
+		pipe->mPipe[ 0 ] = pipe->mPipe[ 1 ] = -1;
+
+#ifdef SP_HAVE_SPLICE
+		if( 0 != pipe2( pipe->mPipe, O_NONBLOCK | O_CLOEXEC ) ) {
+			sp_syslog( LOG_NOTICE, "relay(%d,%d) cannot create pipe, errno %d, use read/write",
+					fd1, fd2, errno );
+			pipe->mPipe[ 0 ] = pipe->mPipe[ 1 ] = -1;
+		}
+#endif
+
+		if( pipe->mPipe[ 0 ] < 0 ) pipe->mBuffer = (char*)malloc( eRelayChunk );
+
+		event_set( &( pipe->mReadEvent ), pipe->mSrc, EV_READ, onRead, pipe );
+		event_base_set( eventArg->getEventBase(), &( pipe->mReadEvent ) );
+
+		event_set( &( pipe->mWriteEvent ), pipe->mDst, EV_WRITE, onWrite, pipe );
+		event_base_set( eventArg->getEventBase(), &( pipe->mWriteEvent ) );
+	}
+
+	for( int i = 0; i < 2; i++ ) {
+		SP_RelayPipe_t * pipe = &( relay->mPipeList[ i ] );
+
+		if( pipe->mPipe[ 0 ] < 0 && NULL == pipe->mBuffer ) {
+			sp_syslog( LOG_WARNING, "relay(%d,%d) out of memory", fd1, fd2 );
+			destroy( relay );
+			return -1;
+		}
+
+		event_add( &( pipe->mReadEvent ), NULL );
+	}
+
+	touch( relay );
+
+	return 0;
+}
+
+void SP_Relay :: touch( SP_Relay_t * relay )
+{
+	int timeout = relay->mEventArg->getTimeout();
+
+	if( timeout > 0 ) {
+		relay->mEventArg->getTimerWheel()->schedule( &( relay->mTimerNode ), timeout * 1000 );
+	}
+}
+
+void SP_Relay :: onTimeout( SP_TimerNode_t * node, void * arg )
+{
+	SP_Relay_t * relay = (SP_Relay_t*)arg;
+
+	sp_syslog( LOG_NOTICE, "relay(%d,%d) timeout",
+			relay->mPipeList[ 0 ].mSrc, relay->mPipeList[ 0 ].mDst );
+
+	destroy( relay );
+}
+
+int SP_Relay :: fill( SP_RelayPipe_t * pipe )
+{
+	int ret = -1;
+
+#ifdef SP_HAVE_SPLICE
+	if( pipe->mPipe[ 1 ] >= 0 ) {
+		ret = splice( pipe->mSrc, NULL, pipe->mPipe[ 1 ], NULL, eRelayChunk,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+
+		// the fd does not support splice, fall back to read/write
+		if( ret < 0 && EINVAL == errno ) {
+			pipe->mBuffer = (char*)malloc( eRelayChunk );
+			if( NULL == pipe->mBuffer ) return -1;
+
+			sp_close( pipe->mPipe[ 0 ] );
+			sp_close( pipe->mPipe[ 1 ] );
+			pipe->mPipe[ 0 ] = pipe->mPipe[ 1 ] = -1;
+		}
+	}
+#endif
+
+	if( NULL != pipe->mBuffer ) {
+		ret = recv( pipe->mSrc, pipe->mBuffer, eRelayChunk, 0 );
+		pipe->mOffset = 0;
+	}
+
+	if( ret > 0 ) pipe->mPending = ret;
+
+	return ret;
+}
+
+int SP_Relay :: flush( SP_RelayPipe_t * pipe )
+{
+	for( ; pipe->mPending > 0; ) {
+		int ret = -1;
+
+#ifdef SP_HAVE_SPLICE
+		if( pipe->mPipe[ 0 ] >= 0 ) {
+			ret = splice( pipe->mPipe[ 0 ], NULL, pipe->mDst, NULL, pipe->mPending,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+		}
+#endif
+
+		if( NULL != pipe->mBuffer ) {
+			ret = send( pipe->mDst, pipe->mBuffer + pipe->mOffset, pipe->mPending, 0 );
+			if( ret > 0 ) pipe->mOffset += ret;
+		}
+
+		if( ret > 0 ) {
+			pipe->mPending -= ret;
+		} else if( ret < 0 && ( EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno ) ) {
+			break;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void SP_Relay :: finish( SP_RelayPipe_t * pipe )
+{
+	// pass the end of stream to the other side
+	shutdown( pipe->mDst, SHUT_WR );
+	pipe->mDone = 1;
+
+	SP_Relay_t * relay = pipe->mRelay;
+	if( relay->mPipeList[ 0 ].mDone && relay->mPipeList[ 1 ].mDone ) {
+		destroy( relay );
+	}
+}
+
+void SP_Relay :: onRead( int fd, short events, void * arg )
+{
+	SP_RelayPipe_t * pipe = (SP_RelayPipe_t*)arg;
+	SP_Relay_t * relay = pipe->mRelay;
+
+	int ret = fill( pipe );
+
+	if( ret > 0 ) {
+		touch( relay );
+
+		if( 0 != flush( pipe ) ) {
+			sp_syslog( LOG_NOTICE, "relay(%d,%d) write error, errno %d",
+					pipe->mSrc, pipe->mDst, errno );
+			destroy( relay );
+		} else if( pipe->mPending > 0 ) {
+			// stop reading until the peer catches up
+			event_add( &( pipe->mWriteEvent ), NULL );
+		} else {
+			event_add( &( pipe->mReadEvent ), NULL );
+		}
+	} else if( 0 == ret ) {
+		finish( pipe );
+	} else if( EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno ) {
+		event_add( &( pipe->mReadEvent ), NULL );
+	} else {
+		sp_syslog( LOG_NOTICE, "relay(%d,%d) read error, errno %d",
+				pipe->mSrc, pipe->mDst, errno );
+		destroy( relay );
+	}
+}
+
+void SP_Relay :: onWrite( int fd, short events, void * arg )
+{
+	SP_RelayPipe_t * pipe = (SP_RelayPipe_t*)arg;
+	SP_Relay_t * relay = pipe->mRelay;
+
+	size_t pending = pipe->mPending;
+
+	if( 0 != flush( pipe ) ) {
+		sp_syslog( LOG_NOTICE, "relay(%d,%d) write error, errno %d",
+				pipe->mSrc, pipe->mDst, errno );
+		destroy( relay );
+		return;
+	}
+
+	if( pending != pipe->mPending ) touch( relay );
+
+	if( pipe->mPending > 0 ) {
+		event_add( &( pipe->mWriteEvent ), NULL );
+	} else {
+		event_add( &( pipe->mReadEvent ), NULL );
+	}
+}
+
+void SP_Relay :: destroy( SP_Relay_t * relay )
+{
+	relay->mEventArg->getTimerWheel()->cancel( &( relay->mTimerNode ) );
+
+	for( int i = 0; i < 2; i++ ) {
+		SP_RelayPipe_t * pipe = &( relay->mPipeList[ i ] );
+
+		event_del( &( pipe->mReadEvent ) );
+		event_del( &( pipe->mWriteEvent ) );
+
+		if( pipe->mPipe[ 0 ] >= 0 ) sp_close( pipe->mPipe[ 0 ] );
+		if( pipe->mPipe[ 1 ] >= 0 ) sp_close( pipe->mPipe[ 1 ] );
+
+		if( NULL != pipe->mBuffer ) free( pipe->mBuffer );
+	}
+
+	sp_close( relay->mPipeList[ 0 ].mSrc );
+	sp_close( relay->mPipeList[ 0 ].mDst );
+
+	closeHandler( relay->mHandler );
+
+	free( relay );
+}
+
+void SP_Relay :: closeHandler( SP_RelayHandler * handler )
+{
+	if( NULL != handler ) {
+		handler->close();
+		delete handler;
+	}
+}
+
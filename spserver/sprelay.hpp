@@ -0,0 +1,53 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __sprelay_hpp__
+#define __sprelay_hpp__
+
+class SP_EventArg;
+class SP_RelayHandler;
+
+struct event;
+
+typedef struct tagSP_TimerNode SP_TimerNode_t;
+
+typedef struct tagSP_RelayPipe SP_RelayPipe_t;
+typedef struct tagSP_Relay SP_Relay_t;
+
+// forward the data between two fds in the event loop thread, no handler
+// and no worker is involved, splice is used when it is available
+class SP_Relay {
+public:
+	// run in the event loop thread, the relay owns the fds and the handler from now on
+	// return 0 : OK, -1 : Fail, the fds are closed and the handler is closed too
+	static int start( SP_EventArg * eventArg, int fd1, int fd2, SP_RelayHandler * handler );
+
+private:
+	static void onRead( int fd, short events, void * arg );
+	static void onWrite( int fd, short events, void * arg );
+
+	// return > 0 : bytes read, 0 : end of stream, -1 : error
+	static int fill( SP_RelayPipe_t * pipe );
+
+	// return 0 : OK, maybe some data is still pending, -1 : error
+	static int flush( SP_RelayPipe_t * pipe );
+
+	static void finish( SP_RelayPipe_t * pipe );
+
+	// push the idle timeout back
+	static void touch( SP_Relay_t * relay );
+	static void onTimeout( SP_TimerNode_t * node, void * arg );
+
+	static void destroy( SP_Relay_t * relay );
+
+	// tell the handler that the relay is finished, and delete it
+	static void closeHandler( SP_RelayHandler * handler );
+
+	SP_Relay();
+	~SP_Relay();
+};
+
+#endif
+
@@ -11,15 +11,19 @@
 #include "sprequest.hpp"
 #include "spmsgdecoder.hpp"
 #include "sputils.hpp"
+#include "spioutils.hpp"
+#include "spbuffer.hpp"
 
 SP_Request :: SP_Request()
 {
 	mDecoder = new SP_DefaultMsgDecoder();
+	mIsDefaultDecoder = 1;
 
 	memset( mClientIP, 0, sizeof( mClientIP ) );
 	mClientPort = 0;
 
 	memset( mServerIP, 0, sizeof( mServerIP ) );
+	mServerFd = -1;
 }
 
 SP_Request :: ~SP_Request()
@@ -37,6 +41,23 @@ void SP_Request :: setMsgDecoder( SP_MsgDecoder * decoder )
 {
 	if( NULL != mDecoder ) delete mDecoder;
 	mDecoder = decoder;
+	mIsDefaultDecoder = 0;
+}
+
+void SP_Request :: reset()
+{
+	if( mIsDefaultDecoder ) {
+		((SP_DefaultMsgDecoder*)mDecoder)->getMsg()->reset();
+	} else {
+		setMsgDecoder( new SP_DefaultMsgDecoder() );
+		mIsDefaultDecoder = 1;
+	}
+
+	memset( mClientIP, 0, sizeof( mClientIP ) );
+	mClientPort = 0;
+
+	memset( mServerIP, 0, sizeof( mServerIP ) );
+	mServerFd = -1;
 }
 
 void SP_Request :: setClientIP( const char * clientIP )
@@ -66,6 +87,19 @@ void SP_Request :: setServerIP( const char * ip )
 
 const char * SP_Request :: getServerIP()
 {
+	if( '\0' == mServerIP[0] && mServerFd >= 0 ) {
+		struct sockaddr_in serverAddr;
+		socklen_t addrLen = sizeof( serverAddr );
+		if( 0 == getsockname( mServerFd, (struct sockaddr*)&serverAddr, &addrLen ) ) {
+			SP_IOUtils::inetNtoa( &( serverAddr.sin_addr ), mServerIP, sizeof( mServerIP ) );
+		}
+	}
+
 	return mServerIP;
 }
 
+void SP_Request :: setServerFd( int fd )
+{
+	mServerFd = fd;
+}
+
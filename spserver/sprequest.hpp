@@ -21,6 +21,9 @@ public:
 	// set a special SP_MsgDecoder
 	void setMsgDecoder( SP_MsgDecoder * decoder );
 
+	// restore the default SP_MsgDecoder and clear the addresses
+	void reset();
+
 	void setClientIP( const char * clientIP );
 	const char * getClientIP();
 
@@ -30,13 +33,18 @@ public:
 	void setServerIP( const char * ip );
 	const char * getServerIP();
 
+	// if server ip is not set, it is resolved from this fd by getsockname
+	void setServerFd( int fd );
+
 private:
 	SP_MsgDecoder * mDecoder;
+	int mIsDefaultDecoder;
 
 	char mClientIP[ 32 ];
 	int mClientPort;
 
 	char mServerIP[ 32 ];
+	int mServerFd;
 };
 
 #endif
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 
 #include "spresponse.hpp"
+#include "spthread.hpp"
 #include "spbuffer.hpp"
 #include "sputils.hpp"
 #include "spmsgblock.hpp"
@@ -88,6 +89,9 @@ SP_Message :: SP_Message( int completionKey )
 	mFollowBlockList = NULL;
 
 	mToList = mSuccess = mFailure = NULL;
+
+	mOrigin = mNextCopy = NULL;
+	mPending = 1;
 }
 
 SP_Message :: ~SP_Message()
@@ -108,6 +112,32 @@ SP_Message :: ~SP_Message()
 	mFailure = NULL;
 }
 
+SP_Message * SP_Message :: complete()
+{
+	SP_Message * origin = NULL != mOrigin ? mOrigin : this;
+	if( sp_atomic_add( &( origin->mPending ), -1 ) > 0 ) return NULL;
+
+	// the last part, merge the results of the copies into the origin
+	for( SP_Message * copy = origin->mNextCopy; NULL != copy; ) {
+		SP_Message * next = copy->mNextCopy;
+
+		for( int i = 0; i < copy->getSuccess()->getCount(); i++ ) {
+			origin->getSuccess()->add( copy->getSuccess()->get( i ) );
+		}
+		for( int i = 0; i < copy->getFailure()->getCount(); i++ ) {
+			origin->getFailure()->add( copy->getFailure()->get( i ) );
+		}
+
+		delete copy;
+		copy = next;
+	}
+
+	origin->mNextCopy = NULL;
+	origin->mPending = 1;
+
+	return origin;
+}
+
 void SP_Message :: reset()
 {
 	if( NULL != mMsg ) mMsg->reset();
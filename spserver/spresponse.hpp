@@ -73,6 +73,13 @@ private:
 	SP_Message( SP_Message & );
 	SP_Message & operator=( SP_Message & );
 
+	friend class SP_EventHelper;
+	friend class SP_IOChannel;
+
+	// a message forwarded to other reactors is completed once, by its last part;
+	// return the message to be completed, NULL while the other parts are pending
+	SP_Message * complete();
+
 	SP_Buffer * mMsg;
 	SP_MsgBlockList * mFollowBlockList;
 
@@ -81,6 +88,11 @@ private:
 	SP_SidList * mFailure;
 
 	int mCompletionKey;
+
+	// for the copies forwarded to other reactors, a copy points to its origin,
+	// the origin chains the copies and counts the parts not completed yet
+	SP_Message * mOrigin, * mNextCopy;
+	int mPending;
 };
 
 class SP_Response {
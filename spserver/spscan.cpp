@@ -0,0 +1,314 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <string.h>
+
+#include "spscan.hpp"
+
+#if defined( __GNUC__ ) && defined( __SSE2__ )
+#define SP_SCAN_SSE2
+#include <emmintrin.h>
+#if defined( __clang__ ) || __GNUC__ >= 5
+#define SP_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+typedef const char * ( * SP_FindEither_t )( const char * buffer, size_t len, char a, char b );
+typedef int ( * SP_FindAll_t )( const char * buffer, size_t len, char a, char b,
+		int * offsets, int maxCount );
+typedef const char * ( * SP_Find_t )( const char * buffer, size_t len, const char * key, size_t keyLen );
+
+static const char * findEitherScalar( const char * buffer, size_t len, char a, char b )
+{
+	for( const char * end = buffer + len; buffer < end; buffer++ ) {
+		if( a == *buffer || b == *buffer ) return buffer;
+	}
+
+	return NULL;
+}
+
+static int findAllScalar( const char * buffer, size_t len, char a, char b,
+		int * offsets, int maxCount )
+{
+	int count = 0;
+
+	for( size_t i = 0; i < len && count < maxCount; i++ ) {
+		if( a == buffer[ i ] || b == buffer[ i ] ) offsets[ count++ ] = i;
+	}
+
+	return count;
+}
+
+static const char * findScalar( const char * buffer, size_t len, const char * key, size_t keyLen )
+{
+	for( const char * end = buffer + len; (size_t)( end - buffer ) >= keyLen; buffer++ ) {
+		buffer = (char*)memchr( buffer, *key, ( end - buffer ) - keyLen + 1 );
+		if( NULL == buffer ) break;
+
+		if( 0 == memcmp( buffer, key, keyLen ) ) return buffer;
+	}
+
+	return NULL;
+}
+
+#ifdef SP_SCAN_SSE2
+
+// the bytes after the last full block are covered by one more block which
+// overlaps the checked ones, the checked positions never match again
+
+static const char * findEitherSSE2( const char * buffer, size_t len, char a, char b )
+{
+	if( len < 16 ) return findEitherScalar( buffer, len, a, b );
+
+	const __m128i va = _mm_set1_epi8( a ), vb = _mm_set1_epi8( b );
+
+	for( size_t i = 0; ; i += 16 ) {
+		if( i + 16 > len ) i = len - 16;
+
+		__m128i x = _mm_loadu_si128( (const __m128i*)( buffer + i ) );
+		int mask = _mm_movemask_epi8( _mm_or_si128(
+				_mm_cmpeq_epi8( x, va ), _mm_cmpeq_epi8( x, vb ) ) );
+		if( 0 != mask ) return buffer + i + __builtin_ctz( mask );
+
+		if( i + 16 >= len ) break;
+	}
+
+	return NULL;
+}
+
+static int findAllSSE2( const char * buffer, size_t len, char a, char b,
+		int * offsets, int maxCount )
+{
+	if( len < 16 ) return findAllScalar( buffer, len, a, b, offsets, maxCount );
+
+	const __m128i va = _mm_set1_epi8( a ), vb = _mm_set1_epi8( b );
+
+	int count = 0;
+
+	for( size_t i = 0, done = 0; count < maxCount; i += 16 ) {
+		if( i + 16 > len ) i = len - 16;
+
+		__m128i x = _mm_loadu_si128( (const __m128i*)( buffer + i ) );
+		unsigned int mask = _mm_movemask_epi8( _mm_or_si128(
+				_mm_cmpeq_epi8( x, va ), _mm_cmpeq_epi8( x, vb ) ) );
+		if( done > i ) mask &= ~0U << ( done - i );
+
+		for( ; 0 != mask && count < maxCount; mask &= mask - 1 ) {
+			offsets[ count++ ] = i + __builtin_ctz( mask );
+		}
+
+		done = i + 16;
+		if( done >= len ) break;
+	}
+
+	return count;
+}
+
+// compare the first and the last byte of the key at 16 positions at once,
+// only the candidates are checked with memcmp
+static const char * findSSE2( const char * buffer, size_t len, const char * key, size_t keyLen )
+{
+	size_t count = len - keyLen + 1;
+	if( count < 16 ) return findScalar( buffer, len, key, keyLen );
+
+	const __m128i first = _mm_set1_epi8( key[ 0 ] ), last = _mm_set1_epi8( key[ keyLen - 1 ] );
+
+	for( size_t i = 0; ; i += 16 ) {
+		if( i + 16 > count ) i = count - 16;
+
+		__m128i x = _mm_loadu_si128( (const __m128i*)( buffer + i ) );
+		__m128i y = _mm_loadu_si128( (const __m128i*)( buffer + i + keyLen - 1 ) );
+		unsigned int mask = _mm_movemask_epi8( _mm_and_si128(
+				_mm_cmpeq_epi8( x, first ), _mm_cmpeq_epi8( y, last ) ) );
+
+		for( ; 0 != mask; mask &= mask - 1 ) {
+			const char * pos = buffer + i + __builtin_ctz( mask );
+			if( 0 == memcmp( pos + 1, key + 1, keyLen - 2 ) ) return pos;
+		}
+
+		if( i + 16 >= count ) break;
+	}
+
+	return NULL;
+}
+
+#endif
+
+#ifdef SP_SCAN_AVX2
+
+// the short inputs go to sse2 before any ymm register is dirty,
+// mixing them afterwards costs far more than the scan
+
+__attribute__(( target( "avx2" ) ))
+static const char * findEitherAVX2( const char * buffer, size_t len, char a, char b )
+{
+	if( len < 32 ) return findEitherSSE2( buffer, len, a, b );
+
+	const __m256i va = _mm256_set1_epi8( a ), vb = _mm256_set1_epi8( b );
+
+	for( size_t i = 0; ; i += 32 ) {
+		if( i + 32 > len ) i = len - 32;
+
+		__m256i x = _mm256_loadu_si256( (const __m256i*)( buffer + i ) );
+		unsigned int mask = _mm256_movemask_epi8( _mm256_or_si256(
+				_mm256_cmpeq_epi8( x, va ), _mm256_cmpeq_epi8( x, vb ) ) );
+		if( 0 != mask ) return buffer + i + __builtin_ctz( mask );
+
+		if( i + 32 >= len ) break;
+	}
+
+	return NULL;
+}
+
+__attribute__(( target( "avx2" ) ))
+static int findAllAVX2( const char * buffer, size_t len, char a, char b,
+		int * offsets, int maxCount )
+{
+	if( len < 32 ) return findAllSSE2( buffer, len, a, b, offsets, maxCount );
+
+	const __m256i va = _mm256_set1_epi8( a ), vb = _mm256_set1_epi8( b );
+
+	int count = 0;
+
+	for( size_t i = 0, done = 0; count < maxCount; i += 32 ) {
+		if( i + 32 > len ) i = len - 32;
+
+		__m256i x = _mm256_loadu_si256( (const __m256i*)( buffer + i ) );
+		unsigned int mask = _mm256_movemask_epi8( _mm256_or_si256(
+				_mm256_cmpeq_epi8( x, va ), _mm256_cmpeq_epi8( x, vb ) ) );
+		if( done > i ) mask &= ~0U << ( done - i );
+
+		for( ; 0 != mask && count < maxCount; mask &= mask - 1 ) {
+			offsets[ count++ ] = i + __builtin_ctz( mask );
+		}
+
+		done = i + 32;
+		if( done >= len ) break;
+	}
+
+	return count;
+}
+
+__attribute__(( target( "avx2" ) ))
+static const char * findAVX2( const char * buffer, size_t len, const char * key, size_t keyLen )
+{
+	size_t count = len - keyLen + 1;
+	if( count < 32 ) return findSSE2( buffer, len, key, keyLen );
+
+	const __m256i first = _mm256_set1_epi8( key[ 0 ] ), last = _mm256_set1_epi8( key[ keyLen - 1 ] );
+
+	for( size_t i = 0; ; i += 32 ) {
+		if( i + 32 > count ) i = count - 32;
+
+		__m256i x = _mm256_loadu_si256( (const __m256i*)( buffer + i ) );
+		__m256i y = _mm256_loadu_si256( (const __m256i*)( buffer + i + keyLen - 1 ) );
+		unsigned int mask = _mm256_movemask_epi8( _mm256_and_si256(
+				_mm256_cmpeq_epi8( x, first ), _mm256_cmpeq_epi8( y, last ) ) );
+
+		for( ; 0 != mask; mask &= mask - 1 ) {
+			const char * pos = buffer + i + __builtin_ctz( mask );
+			if( 0 == memcmp( pos + 1, key + 1, keyLen - 2 ) ) return pos;
+		}
+
+		if( i + 32 >= count ) break;
+	}
+
+	return NULL;
+}
+
+#endif
+
+static const char * sKernel = NULL;
+static SP_FindEither_t sFindEither = NULL;
+static SP_FindAll_t sFindAll = NULL;
+static SP_Find_t sFind = NULL;
+
+// the same kernels are picked by every thread, a race only writes the same values
+static void selectKernel()
+{
+	SP_FindEither_t findEither = findEitherScalar;
+	SP_FindAll_t findAll = findAllScalar;
+	SP_Find_t find = findScalar;
+	const char * kernel = "scalar";
+
+#ifdef SP_SCAN_SSE2
+	findEither = findEitherSSE2;
+	findAll = findAllSSE2;
+	find = findSSE2;
+	kernel = "sse2";
+#endif
+
+#ifdef SP_SCAN_AVX2
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) ) {
+		findEither = findEitherAVX2;
+		findAll = findAllAVX2;
+		find = findAVX2;
+		kernel = "avx2";
+	}
+#endif
+
+	sFindEither = findEither;
+	sFindAll = findAll;
+	sFind = find;
+	sKernel = kernel;
+}
+
+const char * SP_Scanner :: findEither( const char * buffer, size_t len, char a, char b )
+{
+	if( NULL == sFindEither ) selectKernel();
+
+	return sFindEither( buffer, len, a, b );
+}
+
+int SP_Scanner :: findAll( const char * buffer, size_t len, char a, char b,
+		int * offsets, int maxCount )
+{
+	if( NULL == sFindAll ) selectKernel();
+
+	return sFindAll( buffer, len, a, b, offsets, maxCount );
+}
+
+const char * SP_Scanner :: find( const char * buffer, size_t len,
+		const char * key, size_t keyLen )
+{
+	if( keyLen <= 0 || keyLen > len ) return NULL;
+	if( 1 == keyLen ) return (char*)memchr( buffer, *key, len );
+
+	if( NULL == sFind ) selectKernel();
+
+	return sFind( buffer, len, key, keyLen );
+}
+
+const char * SP_Scanner :: findDotTerm( const char * buffer, size_t len, int * termLen )
+{
+	// both of the terminators have "\n." in the middle
+	for( const char * end = buffer + len, * pos = buffer; pos < end; pos += 2 ) {
+		pos = find( pos, end - pos, "\n.", 2 );
+		if( NULL == pos ) break;
+
+		if( pos + 2 < end && '\n' == pos[ 2 ] ) {
+			*termLen = 3;
+			return pos;
+		}
+
+		if( pos > buffer && '\r' == pos[ -1 ]
+				&& pos + 3 < end && '\r' == pos[ 2 ] && '\n' == pos[ 3 ] ) {
+			*termLen = 5;
+			return pos - 1;
+		}
+	}
+
+	return NULL;
+}
+
+const char * SP_Scanner :: getKernel()
+{
+	if( NULL == sKernel ) selectKernel();
+
+	return sKernel;
+}
+
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spscan_hpp__
+#define __spscan_hpp__
+
+#include <sys/types.h>
+
+// delimiter scanning for the decoders, AVX2 or SSE2 is picked at runtime,
+// with a scalar fallback for the other cpus and compilers
+class SP_Scanner {
+public:
+	// the first byte which is a or b, NULL if none
+	static const char * findEither( const char * buffer, size_t len, char a, char b );
+
+	// the offsets of all the bytes which are a or b, in one pass,
+	// at most maxCount offsets are stored, return the number of them
+	static int findAll( const char * buffer, size_t len, char a, char b,
+			int * offsets, int maxCount );
+
+	// the first occurrence of key, NULL if none
+	static const char * find( const char * buffer, size_t len, const char * key, size_t keyLen );
+
+	// the first "\r\n.\r\n" or "\n.\n", termLen is set to 5 or 3
+	static const char * findDotTerm( const char * buffer, size_t len, int * termLen );
+
+	// the name of the kernels in use, "avx2", "sse2" or "scalar"
+	static const char * getKernel();
+
+private:
+	SP_Scanner();
+	~SP_Scanner();
+};
+
+#endif
+
@@ -23,7 +23,7 @@
 #include "event_msgqueue.h"
 
 SP_Server :: SP_Server( const char * bindIP, int port,
-		SP_HandlerFactory * handlerFactory )
+		SP_HandlerFactory * handlerFactory, int edgeTriggered )
 {
 	snprintf( mBindIP, sizeof( mBindIP ), "%s", bindIP );
 	mPort = port;
@@ -38,6 +38,10 @@ SP_Server :: SP_Server( const char * bindIP, int port,
 	mReqQueueSize = 128;
 	mMaxConnections = 256;
 	mRefusedMsg = strdup( "System busy, try again later." );
+	mReactorCount = 1;
+	mReusePort = 0;
+	mAcceptBatch = 16;
+	mEdgeTriggered = edgeTriggered;
 }
 
 SP_Server :: ~SP_Server()
@@ -80,6 +84,21 @@ void SP_Server :: setReqQueueSize( int reqQueueSize, const char * refusedMsg )
 	mRefusedMsg = strdup( refusedMsg );
 }
 
+void SP_Server :: setReactorCount( int reactorCount )
+{
+	mReactorCount = reactorCount > 0 ? reactorCount : mReactorCount;
+}
+
+void SP_Server :: setAcceptBatch( int acceptBatch )
+{
+	mAcceptBatch = acceptBatch > 0 ? acceptBatch : mAcceptBatch;
+}
+
+void SP_Server :: setReusePort( int reusePort )
+{
+	mReusePort = reusePort;
+}
+
 void SP_Server :: shutdown()
 {
 	mIsShutdown = 1;
@@ -147,6 +166,51 @@ void SP_Server :: outputCompleted( void * arg )
 	free( arg );
 }
 
+typedef struct tagSP_Reactor {
+	SP_Server * mServer;
+	SP_EventArg * mEventArg;
+	SP_AcceptArg_t mAcceptArg;
+
+	SP_Executor * mWorkerExecutor;
+	SP_Executor * mActExecutor;
+	SP_CompletionHandler * mCompletionHandler;
+
+	int mListenFd;
+	struct event mAcceptEvent;
+
+	int mIsRunning;
+} SP_Reactor_t;
+
+sp_thread_result_t SP_THREAD_CALL SP_Server :: reactorLoop( void * arg )
+{
+	SP_Reactor_t * reactor = (SP_Reactor_t*)arg;
+	SP_EventArg * eventArg = reactor->mEventArg;
+
+	/* Start the event loop. */
+	while( 0 == reactor->mServer->mIsShutdown ) {
+		event_base_loop( eventArg->getEventBase(), EVLOOP_ONCE );
+
+		for( ; NULL != eventArg->getInputResultQueue()->top(); ) {
+			SP_Task * task = (SP_Task*)eventArg->getInputResultQueue()->pop();
+			reactor->mWorkerExecutor->execute( task );
+		}
+
+		for( ; NULL != eventArg->getOutputResultQueue()->top(); ) {
+			SP_Message * msg = (SP_Message*)eventArg->getOutputResultQueue()->pop();
+
+			void ** arg = ( void** )malloc( sizeof( void * ) * 2 );
+			arg[ 0 ] = (void*)reactor->mCompletionHandler;
+			arg[ 1 ] = (void*)msg;
+
+			reactor->mActExecutor->execute( outputCompleted, arg );
+		}
+	}
+
+	reactor->mIsRunning = 0;
+
+	return 0;
+}
+
 int SP_Server :: start()
 {
 #ifdef SIGPIPE
@@ -157,74 +221,176 @@ int SP_Server :: start()
 	int ret = 0;
 	int listenFD = -1;
 
-	ret = SP_IOUtils::tcpListen( mBindIP, mPort, &listenFD, 0 );
+	int reusePort = mReusePort && mReactorCount > 1;
+
+	ret = SP_IOUtils::tcpListen( mBindIP, mPort, &listenFD, 0, reusePort );
+	if( 0 != ret && reusePort ) {
+		sp_syslog( LOG_WARNING, "Cannot listen with SO_REUSEPORT, use a shared listen socket" );
+		reusePort = 0;
+		ret = SP_IOUtils::tcpListen( mBindIP, mPort, &listenFD, 0 );
+	}
 
 	if( 0 == ret ) {
 
-		SP_EventArg eventArg( mTimeout );
+		if( NULL == mIOChannelFactory ) {
+			mIOChannelFactory = new SP_DefaultIOChannelFactory();
+		}
+
+		int reactorCount = mReactorCount;
+
+		SP_Reactor_t * reactorList = (SP_Reactor_t*)calloc( reactorCount, sizeof( SP_Reactor_t ) );
+		SP_AcceptArg_t ** acceptArgList = (SP_AcceptArg_t**)calloc( reactorCount, sizeof( void * ) );
+		SP_EventArg ** eventArgList = (SP_EventArg**)calloc( reactorCount, sizeof( void * ) );
+
+		for( int i = 0; i < reactorCount; i++ ) {
+			SP_Reactor_t * reactor = &( reactorList[ i ] );
+			reactor->mServer = this;
+			reactor->mEventArg = new SP_EventArg( mTimeout, mEdgeTriggered );
+			reactor->mListenFd = -1;
+
+			SP_AcceptArg_t * acceptArg = &( reactor->mAcceptArg );
+			acceptArg->mEventArg = reactor->mEventArg;
+			acceptArg->mHandlerFactory = mHandlerFactory;
+			acceptArg->mIOChannelFactory = mIOChannelFactory;
+			acceptArg->mReqQueueSize = mReqQueueSize;
+			acceptArg->mMaxConnections = ( mMaxConnections + reactorCount - 1 ) / reactorCount;
+			acceptArg->mRefusedMsg = mRefusedMsg;
+			acceptArg->mAcceptBatch = mAcceptBatch;
+			acceptArg->mReactorCount = reactorCount;
+			acceptArg->mReactorList = acceptArgList;
+
+			if( i > 0 ) {
+				acceptArg->mHandoffQueue = msgqueue_new( reactor->mEventArg->getEventBase(),
+						0, SP_EventCallback::onHandoff, acceptArg );
+			}
+
+			acceptArgList[ i ] = acceptArg;
+			eventArgList[ i ] = reactor->mEventArg;
+		}
+
+		for( int i = 0; i < reactorCount; i++ ) {
+			eventArgList[ i ]->setReactorList( eventArgList, reactorCount, i );
+		}
+
+		reactorList[ 0 ].mListenFd = listenFD;
+
+		// with SO_REUSEPORT the kernel spreads connections, no need to hand off fds
+		for( int i = 1; i < reactorCount && reusePort; i++ ) {
+			if( 0 != SP_IOUtils::tcpListen( mBindIP, mPort, &( reactorList[ i ].mListenFd ), 0, 1 ) ) {
+				sp_syslog( LOG_WARNING, "Cannot listen with SO_REUSEPORT, use a shared listen socket" );
+				for( int j = 1; j < i; j++ ) {
+					sp_close( reactorList[ j ].mListenFd );
+					reactorList[ j ].mListenFd = -1;
+				}
+				reusePort = 0;
+			}
+		}
+
+		for( int i = 0; i < reactorCount && reusePort; i++ ) {
+			reactorList[ i ].mAcceptArg.mReactorCount = 1;
+		}
+
+		SP_EventArg * eventArg = reactorList[ 0 ].mEventArg;
 
 		// Clean close on SIGINT or SIGTERM.
 		struct event evSigInt, evSigTerm;
 		signal_set( &evSigInt, SIGINT,  sigHandler, this );
-		event_base_set( eventArg.getEventBase(), &evSigInt );
+		event_base_set( eventArg->getEventBase(), &evSigInt );
 		signal_add( &evSigInt, NULL);
 		signal_set( &evSigTerm, SIGTERM, sigHandler, this );
-		event_base_set( eventArg.getEventBase(), &evSigTerm );
+		event_base_set( eventArg->getEventBase(), &evSigTerm );
 		signal_add( &evSigTerm, NULL);
 
-		SP_AcceptArg_t acceptArg;
-		memset( &acceptArg, 0, sizeof( SP_AcceptArg_t ) );
+		for( int i = 0; i < reactorCount; i++ ) {
+			SP_Reactor_t * reactor = &( reactorList[ i ] );
+			if( reactor->mListenFd < 0 ) continue;
 
-		if( NULL == mIOChannelFactory ) {
-			mIOChannelFactory = new SP_DefaultIOChannelFactory();
+			event_set( &( reactor->mAcceptEvent ), reactor->mListenFd, EV_READ|EV_PERSIST,
+					SP_EventCallback::onAccept, &( reactor->mAcceptArg ) );
+			event_base_set( reactor->mEventArg->getEventBase(), &( reactor->mAcceptEvent ) );
+			event_add( &( reactor->mAcceptEvent ), NULL );
 		}
-		acceptArg.mEventArg = &eventArg;
-		acceptArg.mHandlerFactory = mHandlerFactory;
-		acceptArg.mIOChannelFactory = mIOChannelFactory;
-		acceptArg.mReqQueueSize = mReqQueueSize;
-		acceptArg.mMaxConnections = mMaxConnections;
-		acceptArg.mRefusedMsg = mRefusedMsg;
-
-		struct event evAccept;
-		event_set( &evAccept, listenFD, EV_READ|EV_PERSIST,
-				SP_EventCallback::onAccept, &acceptArg );
-		event_base_set( eventArg.getEventBase(), &evAccept );
-		event_add( &evAccept, NULL );
-
-		SP_Executor workerExecutor( mMaxThreads, "work" );
-		SP_Executor actExecutor( 1, "act" );
-		SP_CompletionHandler * completionHandler = mHandlerFactory->createCompletionHandler();
-
-		/* Start the event loop. */
-		while( 0 == mIsShutdown ) {
-			event_base_loop( eventArg.getEventBase(), EVLOOP_ONCE );
-
-			for( ; NULL != eventArg.getInputResultQueue()->top(); ) {
-				SP_Task * task = (SP_Task*)eventArg.getInputResultQueue()->pop();
-				workerExecutor.execute( task );
+
+		{
+			SP_Executor workerExecutor( mMaxThreads, "work" );
+			SP_Executor actExecutor( 1, "act" );
+			SP_CompletionHandler * completionHandler = mHandlerFactory->createCompletionHandler();
+
+			for( int i = 0; i < reactorCount; i++ ) {
+				reactorList[ i ].mWorkerExecutor = &workerExecutor;
+				reactorList[ i ].mActExecutor = &actExecutor;
+				reactorList[ i ].mCompletionHandler = completionHandler;
 			}
 
-			for( ; NULL != eventArg.getOutputResultQueue()->top(); ) {
-				SP_Message * msg = (SP_Message*)eventArg.getOutputResultQueue()->pop();
+			sp_thread_attr_t attr;
+			sp_thread_attr_init( &attr );
+			assert( sp_thread_attr_setstacksize( &attr, 1024 * 1024 ) == 0 );
+			sp_thread_attr_setdetachstate( &attr, SP_THREAD_CREATE_DETACHED );
+
+			int running = 1;
+			for( ; running < reactorCount; running++ ) {
+				SP_Reactor_t * reactor = &( reactorList[ running ] );
+				reactor->mIsRunning = 1;
+
+				sp_thread_t thread;
+				if( 0 == sp_thread_create( &thread, &attr, reactorLoop, reactor ) ) {
+					sp_syslog( LOG_NOTICE, "Thread #%ld has been created for reactor #%d", thread, running );
+				} else {
+					reactor->mIsRunning = 0;
+					sp_syslog( LOG_WARNING, "Unable to create a thread for reactor #%d, %s",
+						running, strerror( errno ) );
+					break;
+				}
+			}
 
-				void ** arg = ( void** )malloc( sizeof( void * ) * 2 );
-				arg[ 0 ] = (void*)completionHandler;
-				arg[ 1 ] = (void*)msg;
+			sp_thread_attr_destroy( &attr );
 
-				actExecutor.execute( outputCompleted, arg );
+			// only hand off fds to the reactors which are running
+			for( int i = 0; i < reactorCount && running < reactorCount; i++ ) {
+				if( ! reusePort ) reactorList[ i ].mAcceptArg.mReactorCount = running;
+				eventArgList[ i ]->setReactorList( eventArgList, running, i );
 			}
-		}
 
-		delete completionHandler;
+			// stop accepting on the sockets of the reactors which are not running
+			for( int i = running; i < reactorCount; i++ ) {
+				if( reactorList[ i ].mListenFd < 0 ) continue;
+				event_del( &( reactorList[ i ].mAcceptEvent ) );
+				sp_close( reactorList[ i ].mListenFd );
+				reactorList[ i ].mListenFd = -1;
+			}
+
+			reactorList[ 0 ].mIsRunning = 1;
+			reactorLoop( &( reactorList[ 0 ] ) );
+
+			for( int i = 1; i < running; i++ ) {
+				msgqueue_push( (struct event_msgqueue*)reactorList[ i ].mAcceptArg.mHandoffQueue, NULL );
+			}
+
+			for( int i = 1; i < running; i++ ) {
+				for( ; reactorList[ i ].mIsRunning; ) sp_sleep( 1 );
+			}
+
+			delete completionHandler;
+		}
 
 		sp_syslog( LOG_NOTICE, "Server is shutdown." );
 
-		event_del( &evAccept );
+		for( int i = 0; i < reactorCount; i++ ) {
+			if( reactorList[ i ].mListenFd < 0 ) continue;
+			event_del( &( reactorList[ i ].mAcceptEvent ) );
+			sp_close( reactorList[ i ].mListenFd );
+		}
 
 		signal_del( &evSigTerm );
 		signal_del( &evSigInt );
 
-		sp_close( listenFD );
+		for( int i = 0; i < reactorCount; i++ ) {
+			delete reactorList[ i ].mEventArg;
+		}
+
+		free( eventArgList );
+		free( acceptArgList );
+		free( reactorList );
 	}
 
 	return ret;
@@ -15,12 +15,17 @@ class SP_Session;
 class SP_Executor;
 class SP_IOChannelFactory;
 
+typedef struct tagSP_Reactor SP_Reactor_t;
+
 struct event;
 
 // half-sync/half-async thread pool server
 class SP_Server {
 public:
-	SP_Server( const char * bindIP, int port, SP_HandlerFactory * handlerFactory );
+	// edgeTriggered : linux only, the sessions are registered once in a native
+	//   edge-triggered epoll instead of re-adding a libevent event for every io
+	SP_Server( const char * bindIP, int port, SP_HandlerFactory * handlerFactory,
+			int edgeTriggered = 0 );
 	~SP_Server();
 
 	void setTimeout( int timeout );
@@ -29,6 +34,15 @@ public:
 	void setReqQueueSize( int reqQueueSize, const char * refusedMsg );
 	void setIOChannelFactory( SP_IOChannelFactory * ioChannelFactory );
 
+	// run N event loops, each one owns its sessions, default is 1
+	void setReactorCount( int reactorCount );
+
+	// max connections accepted per wakeup of the listen socket, default is 16
+	void setAcceptBatch( int acceptBatch );
+
+	// each reactor listens on its own SO_REUSEPORT socket, default is 0
+	void setReusePort( int reusePort );
+
 	void shutdown();
 	int isRunning();
 	int run();
@@ -48,9 +62,15 @@ private:
 	int mMaxConnections;
 	int mReqQueueSize;
 	char * mRefusedMsg;
+	int mReactorCount;
+	int mReusePort;
+	int mAcceptBatch;
+	int mEdgeTriggered;
 
 	static sp_thread_result_t SP_THREAD_CALL eventLoop( void * arg );
 
+	static sp_thread_result_t SP_THREAD_CALL reactorLoop( void * arg );
+
 	int start();
 
 	static void sigHandler( int, short, void * arg );
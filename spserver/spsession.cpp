@@ -17,6 +17,7 @@
 #include "sputils.hpp"
 #include "sprequest.hpp"
 #include "spiochannel.hpp"
+#include "sptimerwheel.hpp"
 
 #ifndef WIN32
 #include "event.h"
@@ -26,78 +27,219 @@
 
 typedef struct tagSP_SessionEntry {
 	uint16_t mSeq;
-	uint16_t mNext;
+	int16_t mNext;
 
 	SP_Session * mSession;
 } SP_SessionEntry;
 
+typedef struct tagSP_SessionRow {
+	int mFreeHead;
+	int mUsed;
+
+	int mPrevAvail;
+	int mNextAvail;
+
+	SP_SessionEntry_t mEntries[ 1 ];
+} SP_SessionRow;
+
 SP_SessionManager :: SP_SessionManager()
 {
 	mFreeCount = 0;
-	mFreeList = 0;
 	mCount = 0;
-	memset( mArray, 0, sizeof( mArray ) );
+
+	mMaxRowCount = 16;
+	mRowList = (SP_SessionRow_t**)calloc( mMaxRowCount, sizeof( void * ) );
+	mRowSeqList = (uint16_t*)calloc( mMaxRowCount, sizeof( uint16_t ) );
+	mIdleRowList = (int*)calloc( mMaxRowCount, sizeof( int ) );
+	mRowCount = 1;
+	mIdleRowCount = 0;
+
+	mAvailHead = -1;
+
+	mKeyPrefix = 0;
 }
 
 SP_SessionManager :: ~SP_SessionManager()
 {
-	for( int i = 0; i < (int)( sizeof( mArray ) / sizeof( mArray[0] ) ); i++ ) {
-		SP_SessionEntry_t * list = mArray[ i ];
-		if( NULL != list ) {
-			SP_SessionEntry_t * iter = list;
-			for( int i = 0; i < eColPerRow; i++, iter++ ) {
+	for( int i = 0; i < mRowCount; i++ ) {
+		SP_SessionRow_t * row = mRowList[ i ];
+		if( NULL != row ) {
+			SP_SessionEntry_t * iter = row->mEntries;
+			for( int j = 0; j < eColPerRow; j++, iter++ ) {
 				if( NULL != iter->mSession ) {
 					delete iter->mSession;
 					iter->mSession = NULL;
 				}
 			}
-			free( list );
+			free( row );
 		}
 	}
 
-	memset( mArray, 0, sizeof( mArray ) );
+	free( mRowList );
+	mRowList = NULL;
+
+	free( mRowSeqList );
+	mRowSeqList = NULL;
+
+	free( mIdleRowList );
+	mIdleRowList = NULL;
 }
 
-uint32_t SP_SessionManager :: allocKey( uint16_t * seq )
+void SP_SessionManager :: linkAvail( int index )
 {
-	uint16_t key = 0;
+	SP_SessionRow_t * row = mRowList[ index ];
 
-	if( mFreeList <= 0 ) {
-		int avail = -1;
-		for( int i = 1; i < (int)( sizeof( mArray ) / sizeof( mArray[0] ) ); i++ ) {
-			if( NULL == mArray[i] ) {
-				avail = i;
-				break;
-			}
-		}
+	row->mPrevAvail = -1;
+	row->mNextAvail = mAvailHead;
+	if( mAvailHead >= 0 ) mRowList[ mAvailHead ]->mPrevAvail = index;
+	mAvailHead = index;
+}
+
+void SP_SessionManager :: unlinkAvail( int index )
+{
+	SP_SessionRow_t * row = mRowList[ index ];
+
+	if( row->mPrevAvail >= 0 ) {
+		mRowList[ row->mPrevAvail ]->mNextAvail = row->mNextAvail;
+	} else {
+		mAvailHead = row->mNextAvail;
+	}
+	if( row->mNextAvail >= 0 ) mRowList[ row->mNextAvail ]->mPrevAvail = row->mPrevAvail;
+
+	row->mPrevAvail = row->mNextAvail = -1;
+}
 
-		if( avail > 0  ) {
-			mFreeCount += eColPerRow;
-			mArray[ avail ] = ( SP_SessionEntry_t * )calloc(
-					eColPerRow, sizeof( SP_SessionEntry_t ) );
-			for( int i = eColPerRow - 1; i >= 0; i-- ) {
-				mArray[ avail ] [ i ].mNext = mFreeList;
-				mFreeList = eColPerRow * avail + i;
+int SP_SessionManager :: newRow()
+{
+	int index = -1;
+
+	if( mIdleRowCount > 0 ) {
+		index = mIdleRowList[ --mIdleRowCount ];
+	} else {
+		if( mRowCount >= eMaxRows ) return -1;
+
+		if( mRowCount >= mMaxRowCount ) {
+			int maxRowCount = mMaxRowCount * 2;
+			if( maxRowCount > eMaxRows ) maxRowCount = eMaxRows;
+
+			SP_SessionRow_t ** rowList = (SP_SessionRow_t**)realloc( mRowList,
+					sizeof( void * ) * maxRowCount );
+			if( NULL == rowList ) return -1;
+			mRowList = rowList;
+
+			uint16_t * rowSeqList = (uint16_t*)realloc( mRowSeqList,
+					sizeof( uint16_t ) * maxRowCount );
+			if( NULL == rowSeqList ) return -1;
+			mRowSeqList = rowSeqList;
+
+			int * idleRowList = (int*)realloc( mIdleRowList, sizeof( int ) * maxRowCount );
+			if( NULL == idleRowList ) return -1;
+			mIdleRowList = idleRowList;
+
+			for( int i = mMaxRowCount; i < maxRowCount; i++ ) {
+				mRowList[ i ] = NULL;
+				mRowSeqList[ i ] = 0;
 			}
-		} else {
-		  // add code to deal with no avail .
-		  
+			mMaxRowCount = maxRowCount;
 		}
 
-		
+		index = mRowCount++;
+	}
+
+	SP_SessionRow_t * row = (SP_SessionRow_t*)malloc( sizeof( SP_SessionRow_t )
+			+ sizeof( SP_SessionEntry_t ) * ( eColPerRow - 1 ) );
+	if( NULL == row ) {
+		mIdleRowList[ mIdleRowCount++ ] = index;
+		return -1;
+	}
+
+	for( int i = 0; i < eColPerRow; i++ ) {
+		row->mEntries[ i ].mSeq = mRowSeqList[ index ];
+		row->mEntries[ i ].mNext = i + 1 < eColPerRow ? i + 1 : -1;
+		row->mEntries[ i ].mSession = NULL;
+	}
+	row->mFreeHead = 0;
+	row->mUsed = 0;
+
+	mRowList[ index ] = row;
+	linkAvail( index );
+
+	mFreeCount += eColPerRow;
+
+	return index;
+}
+
+void SP_SessionManager :: releaseRow( int index )
+{
+	SP_SessionRow_t * row = mRowList[ index ];
+
+	assert( 0 == row->mUsed );
+
+	unlinkAvail( index );
+
+	// keys of this row may be held by the application, don't reuse their seq
+	uint16_t maxSeq = 0;
+	for( int i = 0; i < eColPerRow; i++ ) {
+		uint16_t diff = row->mEntries[ i ].mSeq - mRowSeqList[ index ];
+		if( diff > maxSeq ) maxSeq = diff;
 	}
+	mRowSeqList[ index ] += maxSeq + 1;
+
+	free( row );
+	mRowList[ index ] = NULL;
+
+	mIdleRowList[ mIdleRowCount++ ] = index;
+
+	mFreeCount -= eColPerRow;
+}
+
+SP_SessionEntry_t * SP_SessionManager :: getEntry( uint32_t key )
+{
+	if( ( key & ~eKeyMask ) != mKeyPrefix ) return NULL;
+	key &= eKeyMask;
 
-	if( mFreeList > 0 ) {
-		key = mFreeList;
-		--mFreeCount;
+	int index = key / eColPerRow, col = key % eColPerRow;
 
-		int row = mFreeList / eColPerRow, col = mFreeList % eColPerRow;
+	if( index >= mRowCount || NULL == mRowList[ index ] ) return NULL;
 
-		*seq = mArray[ row ] [ col ].mSeq;
-		mFreeList = mArray[ row ] [ col ].mNext;
+	return &( mRowList[ index ]->mEntries[ col ] );
+}
+
+uint32_t SP_SessionManager :: allocKey( uint16_t * seq )
+{
+	int index = mAvailHead;
+
+	if( index < 0 ) index = newRow();
+
+	if( index < 0 ) {
+		sp_syslog( LOG_WARNING, "Out of session keys, count %d", mCount );
+		return 0;
 	}
 
-	return key;
+	SP_SessionRow_t * row = mRowList[ index ];
+
+	int col = row->mFreeHead;
+	SP_SessionEntry_t * entry = &( row->mEntries[ col ] );
+
+	row->mFreeHead = entry->mNext;
+	row->mUsed++;
+	if( row->mFreeHead < 0 ) unlinkAvail( index );
+
+	--mFreeCount;
+
+	*seq = entry->mSeq;
+
+	return mKeyPrefix | ( index * eColPerRow + col );
+}
+
+void SP_SessionManager :: setKeyPrefix( uint32_t prefix )
+{
+	mKeyPrefix = prefix << eKeyPrefixShift;
+}
+
+uint32_t SP_SessionManager :: getKeyPrefix()
+{
+	return mKeyPrefix >> eKeyPrefixShift;
 }
 
 int SP_SessionManager :: getCount()
@@ -112,30 +254,27 @@ int SP_SessionManager :: getFreeCount()
 
 void SP_SessionManager :: put( uint32_t key, uint16_t seq, SP_Session * session )
 {
-	int row = key / eColPerRow, col = key % eColPerRow;
-
-	assert( NULL != mArray[ row ] );
+	assert( ( key & ~eKeyMask ) == mKeyPrefix );
 
-	SP_SessionEntry_t * list = mArray[ row ];
+	SP_SessionEntry_t * entry = getEntry( key );
 
-	assert( NULL == list[ col ].mSession );
-	assert( seq == list[ col ].mSeq );
+	assert( NULL != entry );
+	assert( NULL == entry->mSession );
+	assert( seq == entry->mSeq );
 
-	list[ col ].mSession = session;
+	entry->mSession = session;
 
 	mCount++;
 }
 
 SP_Session * SP_SessionManager :: get( uint32_t key, uint16_t * seq )
 {
-	int row = key / eColPerRow, col = key % eColPerRow;
-
 	SP_Session * ret = NULL;
 
-	SP_SessionEntry_t * list = mArray[ row ];
-	if( NULL != list ) {
-		ret = list[ col ].mSession;
-		* seq = list[ col ].mSeq;
+	SP_SessionEntry_t * entry = getEntry( key );
+	if( NULL != entry ) {
+		ret = entry->mSession;
+		* seq = entry->mSeq;
 	} else {
 		* seq = 0;
 	}
@@ -145,24 +284,33 @@ SP_Session * SP_SessionManager :: get( uint32_t key, uint16_t * seq )
 
 SP_Session * SP_SessionManager :: remove( uint32_t key, uint16_t seq )
 {
-	int row = key / eColPerRow, col = key % eColPerRow;
-
 	SP_Session * ret = NULL;
 
-	SP_SessionEntry_t * list = mArray[ row ];
-	if( NULL != list ) {
-		assert( seq == list[ col ].mSeq );
+	SP_SessionEntry_t * entry = getEntry( key );
+	if( NULL != entry ) {
+		assert( seq == entry->mSeq );
+
+		key &= eKeyMask;
+		int index = key / eColPerRow, col = key % eColPerRow;
+		SP_SessionRow_t * row = mRowList[ index ];
 
-		ret = list[ col ].mSession;
+		ret = entry->mSession;
+		if( NULL != ret ) mCount--;
 
-		list[ col ].mSession = NULL;
-		list[ col ].mSeq++;
+		entry->mSession = NULL;
+		entry->mSeq++;
+
+		if( row->mFreeHead < 0 ) linkAvail( index );
+		entry->mNext = row->mFreeHead;
+		row->mFreeHead = col;
+		row->mUsed--;
 
-		list[ col ].mNext = mFreeList;
-		mFreeList = key;
 		++mFreeCount;
 
-		mCount--;
+		// release an idle row, but keep a spare row to absorb small bursts
+		if( 0 == row->mUsed && mFreeCount - eColPerRow >= eColPerRow ) {
+			releaseRow( index );
+		}
 	}
 
 	return ret;
@@ -182,19 +330,26 @@ SP_Session :: SP_Session( SP_Sid_t sid )
 	mWriteEvent = (struct event*)malloc( sizeof( struct event ) );
 #endif
 
+	mTimerNode = (SP_TimerNode_t*)malloc( sizeof( SP_TimerNode_t ) );
+	SP_TimerWheel::initNode( mTimerNode, NULL, NULL );
+
 	mHandler = NULL;
 	mArg = NULL;
+	mOutputQueue = NULL;
 
 	mInBuffer = new SP_Buffer();
 	mRequest = new SP_Request();
 
 	mOutOffset = 0;
 	mOutList = new SP_ArrayList();
+	mOutBlock = -1;
+	mOutBlockOffset = 0;
 
 	mStatus = eNormal;
 	mRunning = 0;
 	mWriting = 0;
 	mReading = 0;
+	mReady = 0;
 
 	mTotalRead = mTotalWrite = 0;
 
@@ -209,6 +364,9 @@ SP_Session :: ~SP_Session()
 	if( NULL != mWriteEvent ) free( mWriteEvent );
 	mWriteEvent = NULL;
 
+	free( mTimerNode );
+	mTimerNode = NULL;
+
 	if( NULL != mHandler ) {
 		delete mHandler;
 		mHandler = NULL;
@@ -239,6 +397,11 @@ struct event * SP_Session :: getWriteEvent()
 	return mWriteEvent;
 }
 
+SP_TimerNode_t * SP_Session :: getTimerNode()
+{
+	return mTimerNode;
+}
+
 void SP_Session :: setHandler( SP_Handler * handler )
 {
 	mHandler = handler;
@@ -259,11 +422,58 @@ void * SP_Session :: getArg()
 	return mArg;
 }
 
+void SP_Session :: setOutputQueue( SP_BlockingQueue * outputQueue )
+{
+	mOutputQueue = outputQueue;
+}
+
+SP_BlockingQueue * SP_Session :: getOutputQueue()
+{
+	return mOutputQueue;
+}
+
 SP_Sid_t SP_Session :: getSid()
 {
 	return mSid;
 }
 
+void SP_Session :: setSid( SP_Sid_t sid )
+{
+	mSid = sid;
+}
+
+void SP_Session :: reset()
+{
+	if( NULL != mHandler ) {
+		delete mHandler;
+		mHandler = NULL;
+	}
+
+	if( NULL != mIOChannel ) {
+		delete mIOChannel;
+		mIOChannel = NULL;
+	}
+
+	mArg = NULL;
+	mOutputQueue = NULL;
+
+	mInBuffer->reset();
+	mRequest->reset();
+
+	mOutOffset = 0;
+	mOutList->clean();
+	mOutBlock = -1;
+	mOutBlockOffset = 0;
+
+	mStatus = eNormal;
+	mRunning = 0;
+	mWriting = 0;
+	mReading = 0;
+	mReady = 0;
+
+	mTotalRead = mTotalWrite = 0;
+}
+
 SP_Buffer * SP_Session :: getInBuffer()
 {
 	return mInBuffer;
@@ -289,6 +499,22 @@ SP_ArrayList * SP_Session :: getOutList()
 	return mOutList;
 }
 
+void SP_Session :: setOutCursor( int block, size_t offset )
+{
+	mOutBlock = block;
+	mOutBlockOffset = offset;
+}
+
+int SP_Session :: getOutBlock()
+{
+	return mOutBlock;
+}
+
+size_t SP_Session :: getOutBlockOffset()
+{
+	return mOutBlockOffset;
+}
+
 void SP_Session :: setStatus( int status )
 {
 	mStatus = status;
@@ -319,6 +545,16 @@ void SP_Session :: setWriting( int writing )
 	mWriting = writing;
 }
 
+short SP_Session :: getReady()
+{
+	return mReady;
+}
+
+void SP_Session :: setReady( short ready )
+{
+	mReady = ready;
+}
+
 int SP_Session :: getReading()
 {
 	return mReading;
@@ -358,3 +594,45 @@ void SP_Session :: addWrite( int len )
 {
 	mTotalWrite += len;
 }
+
+//-------------------------------------------------------------------
+
+SP_SessionPool :: SP_SessionPool( int maxIdle )
+{
+	mIdleList = new SP_RingQueue( SP_RingQueue::eMPMC, maxIdle > 0 ? maxIdle : 1 );
+}
+
+SP_SessionPool :: ~SP_SessionPool()
+{
+	for( SP_Session * session = NULL; NULL != ( session = (SP_Session*)mIdleList->pop() ); ) {
+		delete session;
+	}
+
+	delete mIdleList;
+	mIdleList = NULL;
+}
+
+SP_Session * SP_SessionPool :: get( SP_Sid_t sid )
+{
+	SP_Session * session = (SP_Session*)mIdleList->pop();
+
+	if( NULL != session ) {
+		session->setSid( sid );
+	} else {
+		session = new SP_Session( sid );
+	}
+
+	return session;
+}
+
+void SP_SessionPool :: giveBack( SP_Session * session )
+{
+	session->reset();
+
+	if( 0 != mIdleList->push( session ) ) delete session;
+}
+
+int SP_SessionPool :: getIdleCount()
+{
+	return mIdleList->getLength();
+}
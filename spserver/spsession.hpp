@@ -15,8 +15,11 @@ class SP_Session;
 class SP_ArrayList;
 class SP_Request;
 class SP_IOChannel;
+class SP_RingQueue;
+class SP_BlockingQueue;
 
 struct event;
+typedef struct tagSP_TimerNode SP_TimerNode_t;
 
 class SP_Session {
 public:
@@ -26,21 +29,40 @@ public:
 	struct event * getReadEvent();	
 	struct event * getWriteEvent();	
 
+	// the idle timeout in the timer wheel of the event loop
+	SP_TimerNode_t * getTimerNode();
+
 	void setHandler( SP_Handler * handler );
 	SP_Handler * getHandler();
 
 	void setArg( void * arg );
 	void * getArg();
 
+	// the queue of the messages which are sent out, NULL if the arg is a SP_EventArg
+	void setOutputQueue( SP_BlockingQueue * outputQueue );
+	SP_BlockingQueue * getOutputQueue();
+
 	SP_Sid_t getSid();
+	void setSid( SP_Sid_t sid );
+
+	// release the handler and the iochannel, clear all the state,
+	// the session can be reused for another connection
+	void reset();
 
 	SP_Buffer * getInBuffer();
 	SP_Request * getRequest();
 
+	// bytes of the first message in the out list which have been sent
 	void setOutOffset( int offset );
 	int getOutOffset();
 	SP_ArrayList * getOutList();
 
+	// write cursor inside the first message in the out list,
+	// block -1 is the message buffer, others are indexes of the follow blocks
+	void setOutCursor( int block, size_t offset );
+	int getOutBlock();
+	size_t getOutBlockOffset();
+
 	enum { eNormal, eWouldExit, eExit };
 	void setStatus( int status );
 	int getStatus();
@@ -54,6 +76,10 @@ public:
 	int getWriting();
 	void setWriting( int writing );
 
+	// for edge-triggered reactor, EV_READ / EV_WRITE which are known to be ready
+	short getReady();
+	void setReady( short ready );
+
 	SP_IOChannel * getIOChannel();
 	void setIOChannel( SP_IOChannel * ioChannel );
 
@@ -73,19 +99,25 @@ private:
 	struct event * mReadEvent;
 	struct event * mWriteEvent;
 
+	SP_TimerNode_t * mTimerNode;
+
 	SP_Handler * mHandler;
 	void * mArg;
+	SP_BlockingQueue * mOutputQueue;
 
 	SP_Buffer * mInBuffer;
 	SP_Request * mRequest;
 
 	int mOutOffset;
 	SP_ArrayList * mOutList;
+	int mOutBlock;
+	size_t mOutBlockOffset;
 
 	char mStatus;
 	char mRunning;
 	char mWriting;
 	char mReading;
+	short mReady;
 
 	unsigned int mTotalRead, mTotalWrite;
 
@@ -93,7 +125,10 @@ private:
 };
 
 typedef struct tagSP_SessionEntry SP_SessionEntry_t;
+typedef struct tagSP_SessionRow SP_SessionRow_t;
 
+// sessions are kept in rows of eColPerRow entries, key = row * eColPerRow + col,
+// rows are allocated on demand and released when they become idle
 class SP_SessionManager {
 public:
 	SP_SessionManager();
@@ -105,18 +140,67 @@ public:
 	SP_Session * remove( uint32_t key, uint16_t seq );
 
 	int getFreeCount();
-	// > 0 : OK, 0 : out of memory
+	// > 0 : OK, 0 : out of memory or out of keys
 	uint32_t allocKey( uint16_t * seq );
 
+	// keys allocated by this manager carry the prefix in the high bits,
+	// keys with other prefixes are unknown to this manager
+	enum { eKeyPrefixShift = 24, eKeyMask = ( 1 << eKeyPrefixShift ) - 1 };
+	void setKeyPrefix( uint32_t prefix );
+	uint32_t getKeyPrefix();
+
 private:
 	enum { eColPerRow = 1024 };
-  enum { eRowNum = 64*16};
-  
-	int mCount;
-	SP_SessionEntry_t * mArray[ eRowNum ];
+	enum { eMaxRows = ( eKeyMask + 1 ) / eColPerRow };
+
+	SP_SessionEntry_t * getEntry( uint32_t key );
+
+	int newRow();
+	void releaseRow( int index );
 
+	void linkAvail( int index );
+	void unlinkAvail( int index );
+
+	int mCount;
 	int mFreeCount;
-	uint16_t mFreeList;
+
+	// row 0 is never used, so key 0 means invalid and keys of system sids are reserved
+	SP_SessionRow_t ** mRowList;
+	// the seq of the entries in a released row continues from here
+	uint16_t * mRowSeqList;
+	int mRowCount;
+	int mMaxRowCount;
+
+	// indexes of released rows, they are used first when a new row is needed
+	int * mIdleRowList;
+	int mIdleRowCount;
+
+	// rows which have free entries, doubly linked by row index
+	int mAvailHead;
+
+	uint32_t mKeyPrefix;
+};
+
+// recycle the closed sessions of one event loop, giveBack can be called
+// by any thread, get should be called by the event loop thread
+class SP_SessionPool {
+public:
+	SP_SessionPool( int maxIdle = 1024 );
+	~SP_SessionPool();
+
+	// reuse an idle session or create a new one
+	SP_Session * get( SP_Sid_t sid );
+
+	// reset the session and keep it for reuse, delete it if the pool is full
+	void giveBack( SP_Session * session );
+
+	int getIdleCount();
+
+private:
+	SP_SessionPool( SP_SessionPool & );
+	SP_SessionPool & operator=( SP_SessionPool & );
+
+	SP_RingQueue * mIdleList;
 };
 
 #endif
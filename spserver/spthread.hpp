@@ -41,6 +41,25 @@ typedef sp_thread_result_t ( * sp_thread_func_t )( void * args );
 #define sp_sleep(x) sleep(x)
 #endif
 
+/// atomic operations, add and cas are full barriers, swap is only an acquire barrier,
+/// get is a plain load with acquire semantics, no locked instruction
+
+#define sp_atomic_add(ptr,val)                __sync_add_and_fetch(ptr,val)
+#define sp_atomic_cas(ptr,oldval,newval)      __sync_bool_compare_and_swap(ptr,oldval,newval)
+#define sp_atomic_cas_ptr(ptr,oldval,newval)  __sync_bool_compare_and_swap(ptr,oldval,newval)
+#define sp_atomic_swap_ptr(ptr,val)           __sync_lock_test_and_set(ptr,val)
+
+#if defined( __ATOMIC_ACQUIRE )
+#define sp_atomic_get(ptr)                    __atomic_load_n(ptr,__ATOMIC_ACQUIRE)
+#elif defined( __i386__ ) || defined( __x86_64__ )
+// loads are not reordered with other loads on x86, only the compiler must be stopped
+#define sp_atomic_get(ptr) \
+	({ __typeof__(*(ptr)) __v = *(volatile __typeof__(*(ptr))*)(ptr); \
+	__asm__ __volatile__( "" ::: "memory" ); __v; })
+#else
+#define sp_atomic_get(ptr)                    __sync_add_and_fetch(ptr,0)
+#endif
+
 #else ///////////////////////////////////////////////////////////////////////
 
 // win32 thread
@@ -73,6 +92,17 @@ typedef struct tagsp_thread_attr {
 #define sp_sleep(x) Sleep(1000*x)
 #endif
 
+/// atomic operations, add, cas and swap are full barriers,
+/// get is a volatile load, which has acquire semantics with msvc
+
+#define sp_atomic_add(ptr,val)   (InterlockedExchangeAdd((LONG volatile*)(ptr),(LONG)(val))+(LONG)(val))
+#define sp_atomic_cas(ptr,oldval,newval) \
+	(InterlockedCompareExchange((LONG volatile*)(ptr),(LONG)(newval),(LONG)(oldval))==(LONG)(oldval))
+#define sp_atomic_cas_ptr(ptr,oldval,newval) \
+	(InterlockedCompareExchangePointer((PVOID volatile*)(ptr),(PVOID)(newval),(PVOID)(oldval))==(PVOID)(oldval))
+#define sp_atomic_swap_ptr(ptr,val) InterlockedExchangePointer((PVOID volatile*)(ptr),(PVOID)(val))
+#define sp_atomic_get(ptr)       (*(LONG volatile*)(ptr))
+
 int sp_thread_mutex_init( sp_thread_mutex_t * mutex, void * attr );
 int sp_thread_mutex_destroy( sp_thread_mutex_t * mutex );
 int sp_thread_mutex_lock( sp_thread_mutex_t * mutex );
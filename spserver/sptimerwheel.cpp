@@ -0,0 +1,286 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spporting.hpp"
+
+#include "sptimerwheel.hpp"
+
+// the ticks must not jump with the wall clock, so use the monotonic clock where it exists
+static void sp_getmonotonic( struct timeval * tv )
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	if( 0 == clock_gettime( CLOCK_MONOTONIC, &ts ) ) {
+		tv->tv_sec = ts.tv_sec;
+		tv->tv_usec = ts.tv_nsec / 1000;
+		return;
+	}
+#endif
+
+	sp_gettimeofday( tv, NULL );
+}
+
+SP_TimerWheel :: SP_TimerWheel( int tickMsec )
+{
+	mTickMsec = tickMsec > 0 ? tickMsec : 1000;
+
+	sp_getmonotonic( &mStartTime );
+
+	mCurrent = 0;
+	mCount = 0;
+
+	for( int i = 0; i < eRootSize; i++ ) initList( &( mRoot[ i ] ) );
+
+	for( int i = 0; i < eLevels; i++ ) {
+		for( int j = 0; j < eLevelSize; j++ ) initList( &( mLevel[ i ][ j ] ) );
+	}
+}
+
+SP_TimerWheel :: ~SP_TimerWheel()
+{
+	// the nodes belong to their owners, only detach them
+	for( int i = 0; i < eRootSize; i++ ) {
+		for( ; mRoot[ i ].mNext != &( mRoot[ i ] ); ) unlink( mRoot[ i ].mNext );
+	}
+
+	for( int i = 0; i < eLevels; i++ ) {
+		for( int j = 0; j < eLevelSize; j++ ) {
+			SP_TimerNode_t * head = &( mLevel[ i ][ j ] );
+			for( ; head->mNext != head; ) unlink( head->mNext );
+		}
+	}
+}
+
+void SP_TimerWheel :: initNode( SP_TimerNode_t * node, SP_TimerCallback_t callback, void * arg )
+{
+	memset( node, 0, sizeof( SP_TimerNode_t ) );
+
+	node->mCallback = callback;
+	node->mArg = arg;
+}
+
+int SP_TimerWheel :: isPending( const SP_TimerNode_t * node )
+{
+	return NULL != node->mNext;
+}
+
+void SP_TimerWheel :: initList( SP_TimerNode_t * head )
+{
+	head->mPrev = head->mNext = head;
+}
+
+void SP_TimerWheel :: unlink( SP_TimerNode_t * node )
+{
+	node->mPrev->mNext = node->mNext;
+	node->mNext->mPrev = node->mPrev;
+
+	node->mPrev = node->mNext = NULL;
+}
+
+void SP_TimerWheel :: append( SP_TimerNode_t * head, SP_TimerNode_t * node )
+{
+	node->mNext = head;
+	node->mPrev = head->mPrev;
+
+	head->mPrev->mNext = node;
+	head->mPrev = node;
+}
+
+unsigned int SP_TimerWheel :: getNowTick() const
+{
+	struct timeval now;
+	sp_getmonotonic( &now );
+
+	long long msec = ( now.tv_sec - mStartTime.tv_sec ) * 1000LL
+			+ ( now.tv_usec - mStartTime.tv_usec ) / 1000;
+
+	return (unsigned int)( msec / mTickMsec );
+}
+
+void SP_TimerWheel :: addNode( SP_TimerNode_t * node )
+{
+	unsigned int expire = node->mExpire;
+	unsigned int idx = expire - mCurrent;
+
+	SP_TimerNode_t * head = NULL;
+
+	if( (int)idx < 0 ) {
+		// already expired, run it at the next tick
+		head = &( mRoot[ mCurrent & eRootMask ] );
+	} else if( idx < eRootSize ) {
+		head = &( mRoot[ expire & eRootMask ] );
+	} else {
+		int level = 0;
+		for( ; level < eLevels - 1; level++ ) {
+			if( idx < ( 1U << ( eRootBits + ( level + 1 ) * eLevelBits ) ) ) break;
+		}
+
+		head = &( mLevel[ level ][ ( expire >> ( eRootBits + level * eLevelBits ) ) & eLevelMask ] );
+	}
+
+	append( head, node );
+}
+
+int SP_TimerWheel :: cascade( int level, int index )
+{
+	SP_TimerNode_t list;
+	initList( &list );
+
+	SP_TimerNode_t * head = &( mLevel[ level ][ index ] );
+
+	// take the whole slot first, addNode may put a node back into the same wheel
+	if( head->mNext != head ) {
+		list.mNext = head->mNext;
+		list.mPrev = head->mPrev;
+		list.mNext->mPrev = &list;
+		list.mPrev->mNext = &list;
+		initList( head );
+	}
+
+	for( ; list.mNext != &list; ) {
+		SP_TimerNode_t * node = list.mNext;
+		unlink( node );
+		addNode( node );
+	}
+
+	return index;
+}
+
+void SP_TimerWheel :: schedule( SP_TimerNode_t * node, int timeoutMsec )
+{
+	if( timeoutMsec < 0 ) timeoutMsec = 0;
+
+	// keep the difference of two ticks in the range of int
+	unsigned int ticks = ( timeoutMsec + mTickMsec - 1 ) / mTickMsec;
+	if( ticks > 0x3fffffff ) ticks = 0x3fffffff;
+
+	// the owner may sleep until the next expiry, so do not count from the last advance,
+	// count from the next tick as mCurrent does, a timer never expires early
+	unsigned int next = getNowTick() + 1;
+	if( (int)( next - mCurrent ) < 0 ) next = mCurrent;
+
+	unsigned int deadline = next + ticks;
+
+	if( isPending( node ) ) {
+		node->mDeadline = deadline;
+
+		// later, it is moved when its slot expires
+		if( (int)( deadline - node->mExpire ) >= 0 ) return;
+
+		unlink( node );
+		mCount--;
+	}
+
+	node->mExpire = node->mDeadline = deadline;
+	addNode( node );
+	mCount++;
+}
+
+void SP_TimerWheel :: cancel( SP_TimerNode_t * node )
+{
+	if( ! isPending( node ) ) return;
+
+	unlink( node );
+	mCount--;
+}
+
+int SP_TimerWheel :: advance()
+{
+	int ret = 0;
+
+	unsigned int now = getNowTick();
+
+	// nothing to expire, skip the idle ticks at once
+	if( 0 == mCount && (int)( now - mCurrent ) >= 0 ) mCurrent = now + 1;
+
+	for( ; (int)( now - mCurrent ) >= 0; ) {
+		int index = mCurrent & eRootMask;
+
+		// the root wheel turns around, refill it from the upper wheels
+		if( 0 == index ) {
+			for( int level = 0; level < eLevels; level++ ) {
+				int upper = ( mCurrent >> ( eRootBits + level * eLevelBits ) ) & eLevelMask;
+				if( 0 != cascade( level, upper ) ) break;
+			}
+		}
+
+		unsigned int tick = mCurrent++;
+
+		SP_TimerNode_t list;
+		initList( &list );
+
+		SP_TimerNode_t * head = &( mRoot[ index ] );
+		if( head->mNext != head ) {
+			list.mNext = head->mNext;
+			list.mPrev = head->mPrev;
+			list.mNext->mPrev = &list;
+			list.mPrev->mNext = &list;
+			initList( head );
+		}
+
+		for( ; list.mNext != &list; ) {
+			SP_TimerNode_t * node = list.mNext;
+			unlink( node );
+
+			if( (int)( node->mDeadline - tick ) > 0 ) {
+				// re-armed later since it was added, file it at the real deadline
+				node->mExpire = node->mDeadline;
+				addNode( node );
+			} else {
+				mCount--;
+				ret++;
+				node->mCallback( node, node->mArg );
+			}
+		}
+	}
+
+	return ret;
+}
+
+int SP_TimerWheel :: getNextTimeout() const
+{
+	if( 0 == mCount ) return -1;
+
+	// the upper wheels are cascaded when the root wheel turns around,
+	// so look at the root slots up to that tick only
+	unsigned int next = ( mCurrent + eRootMask ) & ~(unsigned int)eRootMask;
+
+	for( unsigned int tick = mCurrent; tick != next; tick++ ) {
+		const SP_TimerNode_t * head = &( mRoot[ tick & eRootMask ] );
+		if( head->mNext != head ) {
+			next = tick;
+			break;
+		}
+	}
+
+	struct timeval now;
+	sp_getmonotonic( &now );
+
+	long long msec = ( now.tv_sec - mStartTime.tv_sec ) * 1000LL
+			+ ( now.tv_usec - mStartTime.tv_usec ) / 1000;
+
+	// the tick is processed once the clock reaches its start
+	long long wait = (long long)(int)( next - (unsigned int)( msec / mTickMsec ) ) * mTickMsec
+			- msec % mTickMsec;
+
+	if( wait < 0 ) wait = 0;
+
+	return wait < 0x7fffffff ? (int)wait : 0x7fffffff;
+}
+
+int SP_TimerWheel :: getTickMsec() const
+{
+	return mTickMsec;
+}
+
+int SP_TimerWheel :: getCount() const
+{
+	return mCount;
+}
+
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __sptimerwheel_hpp__
+#define __sptimerwheel_hpp__
+
+#include <sys/types.h>
+
+typedef struct tagSP_TimerNode SP_TimerNode_t;
+
+typedef void ( * SP_TimerCallback_t )( SP_TimerNode_t * node, void * arg );
+
+// embedded in the owner, the wheel never allocates or frees a node
+struct tagSP_TimerNode {
+	SP_TimerNode_t * mPrev, * mNext;
+
+	// the tick of the slot which holds the node, and the tick it really expires,
+	// mDeadline is later than mExpire when the node is re-armed lazily
+	unsigned int mExpire, mDeadline;
+
+	SP_TimerCallback_t mCallback;
+	void * mArg;
+};
+
+// a hierarchical timing wheel, the timeouts are rounded up to the tick,
+// all the methods should be called by one thread
+class SP_TimerWheel {
+public:
+	SP_TimerWheel( int tickMsec = 1000 );
+	~SP_TimerWheel();
+
+	static void initNode( SP_TimerNode_t * node, SP_TimerCallback_t callback, void * arg );
+	static int isPending( const SP_TimerNode_t * node );
+
+	// expire the node after timeoutMsec, O(1), the time is counted from now, the wheel
+	// may be behind when its owner does not advance it at every tick;
+	// a pending node is only moved when it is re-armed earlier, a later deadline is
+	// recorded in the node and checked when its slot expires
+	void schedule( SP_TimerNode_t * node, int timeoutMsec );
+
+	void cancel( SP_TimerNode_t * node );
+
+	// move the wheel to the current time, the callbacks of the expired nodes are called,
+	// a callback can schedule or cancel any node, including its own
+	// return the number of the expired nodes
+	int advance();
+
+	// msec to wait before the next advance, -1 if the wheel is empty;
+	// it may be earlier than the real expiry, then the advance just finds nothing
+	int getNextTimeout() const;
+
+	int getTickMsec() const;
+	int getCount() const;
+
+private:
+	SP_TimerWheel( SP_TimerWheel & );
+	SP_TimerWheel & operator=( SP_TimerWheel & );
+
+	// 8 bits for the root wheel, 4 * 6 bits for the upper wheels, 32 bits of ticks
+	enum { eRootBits = 8, eLevelBits = 6, eLevels = 4 };
+	enum { eRootSize = 1 << eRootBits, eLevelSize = 1 << eLevelBits };
+	enum { eRootMask = eRootSize - 1, eLevelMask = eLevelSize - 1 };
+
+	static void initList( SP_TimerNode_t * head );
+	static void unlink( SP_TimerNode_t * node );
+	static void append( SP_TimerNode_t * head, SP_TimerNode_t * node );
+
+	unsigned int getNowTick() const;
+
+	void addNode( SP_TimerNode_t * node );
+
+	// move the nodes in one slot of an upper wheel down, return the index of the slot
+	int cascade( int level, int index );
+
+	int mTickMsec;
+	struct timeval mStartTime;
+
+	// the next tick to be processed
+	unsigned int mCurrent;
+	int mCount;
+
+	SP_TimerNode_t mRoot[ eRootSize ];
+	SP_TimerNode_t mLevel[ eLevels ][ eLevelSize ];
+};
+
+#endif
+
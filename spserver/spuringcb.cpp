@@ -0,0 +1,760 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "spporting.hpp"
+
+#include "spuringcb.hpp"
+
+#include "spsession.hpp"
+#include "spbuffer.hpp"
+#include "spmsgdecoder.hpp"
+#include "sprequest.hpp"
+#include "sputils.hpp"
+#include "sphandler.hpp"
+#include "spexecutor.hpp"
+#include "spioutils.hpp"
+#include "spmsgblock.hpp"
+#include "spiochannel.hpp"
+#include "sptimerwheel.hpp"
+
+uint64_t SP_UringEventCallback :: makeUserData( int key, SP_Sid_t sid )
+{
+	return ( (uint64_t)key << 56 ) | ( (uint64_t)sid.mSeq << 32 ) | sid.mKey;
+}
+
+int SP_UringEventCallback :: addMsgQueue( SP_UringMsgQueue * msgQueue )
+{
+	return msgQueue->arm( ( (uint64_t)eKeyMsgQueue << 56 ) | (unsigned long)msgQueue );
+}
+
+int SP_UringEventCallback :: addSession( SP_UringEventArg * eventArg, int fd, SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)malloc( sizeof( SP_UringSession_t ) );
+	if( NULL == uringSession ) {
+		sp_syslog( LOG_ERR, "malloc fail, errno %d", errno );
+		sp_close( fd );
+		return -1;
+	}
+
+	memset( uringSession, 0, sizeof( SP_UringSession_t ) );
+	uringSession->mSession = session;
+	uringSession->mEventArg = eventArg;
+	uringSession->mFd = fd;
+
+	session->setArg( uringSession );
+	session->setOutputQueue( eventArg->getOutputResultQueue() );
+
+	SP_TimerWheel::initNode( session->getTimerNode(), onTimeout, session );
+
+	return 0;
+}
+
+void SP_UringEventCallback :: addTimer( SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	if( eventArg->getTimeout() > 0 ) {
+		eventArg->getTimerWheel()->schedule( session->getTimerNode(),
+				eventArg->getTimeout() * 1000 );
+	}
+}
+
+int SP_UringEventCallback :: addRecv( SP_Session * session )
+{
+	int ret = 0;
+
+	if( 0 == session->getReading() && SP_Session::eNormal == session->getStatus() ) {
+		SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+		SP_Uring * uring = uringSession->mEventArg->getUring();
+
+		ret = uring->prepRecv( uringSession->mFd,
+				makeUserData( eKeyRecv, session->getSid() ) );
+
+		if( 0 == ret ) {
+			session->setReading( 1 );
+			addTimer( session );
+		}
+	}
+
+	return ret;
+}
+
+void SP_UringEventCallback :: onRecv( SP_Session * session, SP_UringCqe_t * cqe )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_Uring * uring = uringSession->mEventArg->getUring();
+
+	SP_Sid_t sid = session->getSid();
+
+	// a multishot receive stops at eof, error or running out of buffers
+	if( ! SP_Uring::hasMore( cqe ) ) session->setReading( 0 );
+
+	int bufferId = SP_Uring::getBufferId( cqe );
+
+	if( cqe->mRes > 0 ) {
+		session->getInBuffer()->append( uring->getBuffer( bufferId ), cqe->mRes );
+		uring->giveBack( bufferId );
+
+		session->addRead( cqe->mRes );
+		addTimer( session );
+
+		if( 0 == session->getRunning() ) {
+			if( 0 != SP_UringEventHelper::doDecodeForWork( session ) ) return;
+		}
+
+		if( 0 != addRecv( session ) ) {
+			if( 0 == session->getRunning() ) {
+				SP_UringEventHelper::doError( session );
+			} else {
+				sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session error later",
+						sid.mKey, sid.mSeq );
+			}
+		}
+	} else {
+		if( bufferId >= 0 ) uring->giveBack( bufferId );
+
+		if( -ENOBUFS == cqe->mRes ) {
+			// the buffers are given back after each completion, try again
+			if( 0 == addRecv( session ) ) return;
+		}
+
+		if( 0 == session->getRunning() ) {
+			if( 0 == cqe->mRes ) {
+				SP_UringEventHelper::doClose( session );
+			} else {
+				sp_syslog( LOG_NOTICE, "session(%d.%d) read error, errno %d, status %d",
+						sid.mKey, sid.mSeq, -cqe->mRes, session->getStatus() );
+				SP_UringEventHelper::doError( session );
+			}
+		} else {
+			// onResponse will receive again, and get the eof or error again
+			sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session %s later",
+					sid.mKey, sid.mSeq, 0 == cqe->mRes ? "close" : "error" );
+		}
+	}
+}
+
+int SP_UringEventCallback :: addSend( SP_Session * session )
+{
+	int ret = 0;
+
+	// wait for the socket to be writable, the data is sent by SP_IOChannel::transmit
+	if( 0 == session->getWriting() ) {
+		SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+		SP_Uring * uring = uringSession->mEventArg->getUring();
+
+		ret = uring->prepPoll( uringSession->mFd, POLLOUT,
+				makeUserData( eKeySend, session->getSid() ) );
+
+		if( 0 == ret ) {
+			session->setWriting( 1 );
+			addTimer( session );
+		}
+	}
+
+	return ret;
+}
+
+void SP_UringEventCallback :: onSend( SP_Session * session, SP_UringCqe_t * cqe )
+{
+	session->setWriting( 0 );
+
+	SP_Sid_t sid = session->getSid();
+
+	int ret = 0;
+
+	if( cqe->mRes < 0 ) {
+		ret = -1;
+		errno = -cqe->mRes;
+	} else if( session->getOutList()->getCount() > 0 ) {
+		int len = session->getIOChannel()->transmit( session );
+		if( len > 0 ) {
+			session->addWrite( len );
+			if( session->getOutList()->getCount() > 0 ) {
+				if( 0 != addSend( session ) ) ret = -1;
+			}
+		} else {
+			if( EAGAIN != errno || 0 != addSend( session ) ) ret = -1;
+		}
+	}
+
+	if( 0 != ret ) {
+		if( 0 == session->getRunning() ) {
+			sp_syslog( LOG_NOTICE, "session(%d.%d) write error, errno %d, status %d, count %d",
+					sid.mKey, sid.mSeq, errno, session->getStatus(), session->getOutList()->getCount() );
+			SP_UringEventHelper::doError( session );
+		} else {
+			sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session error later, errno [%d]",
+					sid.mKey, sid.mSeq, errno );
+		}
+		return;
+	}
+
+	if( session->getOutList()->getCount() <= 0 ) {
+		if( SP_Session::eExit == session->getStatus() ) {
+			if( 0 == session->getRunning() ) {
+				sp_syslog( LOG_DEBUG, "session(%d.%d) normal exit", sid.mKey, sid.mSeq );
+				SP_UringEventHelper::doClose( session );
+			} else {
+				sp_syslog( LOG_NOTICE, "session(%d.%d) busy, terminate session later",
+						sid.mKey, sid.mSeq );
+			}
+			return;
+		}
+	}
+
+	if( 0 == session->getRunning() ) {
+		SP_UringEventHelper::doDecodeForWork( session );
+	}
+}
+
+void SP_UringEventCallback :: delSession( SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+	SP_Uring * uring = eventArg->getUring();
+
+	SP_Sid_t sid = session->getSid();
+
+	eventArg->getTimerWheel()->cancel( session->getTimerNode() );
+
+	// a pending request holds its own reference to the socket, so the close only drops
+	// the fd, a new connection reusing the fd is never touched by the cancelled requests;
+	// the socket itself is released when the last request ends
+	uint64_t cancelData = (uint64_t)eKeyCancel << 56;
+	int cancelRet = 0;
+	if( session->getReading() ) cancelRet |= uring->prepCancel( makeUserData( eKeyRecv, sid ), cancelData );
+	if( session->getWriting() ) cancelRet |= uring->prepCancel( makeUserData( eKeySend, sid ), cancelData );
+
+	// the submission queue is full, end the pending requests by the socket itself
+	if( 0 != cancelRet ) shutdown( uringSession->mFd, SHUT_RDWR );
+
+	if( 0 != uring->prepClose( uringSession->mFd, (uint64_t)eKeyClose << 56 ) ) {
+		sp_close( uringSession->mFd );
+	}
+}
+
+int SP_UringEventCallback :: addAccept( SP_UringAcceptArg_t * acceptArg )
+{
+	int ret = acceptArg->mEventArg->getUring()->prepAccept(
+			acceptArg->mListenFd, (uint64_t)eKeyAccept << 56 );
+
+	if( 0 != ret && 0 == acceptArg->mNeedAccept ) {
+		sp_syslog( LOG_WARNING, "cannot queue accept for fd %d, retry later", acceptArg->mListenFd );
+	}
+
+	acceptArg->mNeedAccept = ( 0 != ret );
+
+	return ret;
+}
+
+void SP_UringEventCallback :: onAccept( SP_UringAcceptArg_t * acceptArg, SP_UringCqe_t * cqe )
+{
+	SP_UringEventArg * eventArg = acceptArg->mEventArg;
+
+	// the multishot accept is finished, queue it again
+	if( ! SP_Uring::hasMore( cqe ) ) addAccept( acceptArg );
+
+	if( cqe->mRes < 0 ) {
+		if( -ECANCELED != cqe->mRes ) {
+			sp_syslog( LOG_WARNING, "accept failed, errno %d, %s", -cqe->mRes, strerror( -cqe->mRes ) );
+		}
+		return;
+	}
+
+	int clientFD = cqe->mRes;
+
+	SP_Sid_t sid;
+	sid.mKey = eventArg->getSessionManager()->allocKey( &sid.mSeq );
+	if( 0 == sid.mKey ) {
+		sp_syslog( LOG_WARNING, "Cannot allocate session key, refuse fd %d", clientFD );
+		sp_close( clientFD );
+		return;
+	}
+
+	SP_Session * session = new SP_Session( sid );
+
+	struct sockaddr_in clientAddr;
+	socklen_t clientLen = sizeof( clientAddr );
+	memset( &clientAddr, 0, sizeof( clientAddr ) );
+	getpeername( clientFD, (struct sockaddr *)&clientAddr, &clientLen );
+
+	char clientIP[ 32 ] = { 0 };
+	SP_IOUtils::inetNtoa( &( clientAddr.sin_addr ), clientIP, sizeof( clientIP ) );
+	session->getRequest()->setClientIP( clientIP );
+	session->getRequest()->setClientPort( ntohs( clientAddr.sin_port ) );
+
+	// server ip is resolved when SP_Request::getServerIP is called
+	session->getRequest()->setServerFd( clientFD );
+
+	session->setHandler( acceptArg->mHandlerFactory->create() );
+	session->setIOChannel( new SP_DefaultIOChannel() );
+
+	if( 0 == addSession( eventArg, clientFD, session ) ) {
+		eventArg->getSessionManager()->put( sid.mKey, sid.mSeq, session );
+
+		if( eventArg->getSessionManager()->getCount() > acceptArg->mMaxConnections
+				|| eventArg->getInputResultQueue()->getLength() >= acceptArg->mReqQueueSize ) {
+
+			sp_syslog( LOG_WARNING, "System busy, session.count %d [%d], queue.length %d [%d]",
+				eventArg->getSessionManager()->getCount(), acceptArg->mMaxConnections,
+				eventArg->getInputResultQueue()->getLength(), acceptArg->mReqQueueSize );
+
+			SP_Message * msg = new SP_Message();
+			msg->getMsg()->append( acceptArg->mRefusedMsg );
+			msg->getMsg()->append( "\r\n" );
+			session->getOutList()->append( msg );
+			session->setStatus( SP_Session::eExit );
+
+			addSend( session );
+		} else {
+			SP_UringEventHelper::doStart( session );
+		}
+	} else {
+		eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+		delete session;
+	}
+}
+
+void SP_UringEventCallback :: onResponse( void * queueData, void * arg )
+{
+	SP_Response * response = (SP_Response*)queueData;
+	SP_UringEventArg * eventArg = (SP_UringEventArg*)arg;
+	SP_SessionManager * manager = eventArg->getSessionManager();
+
+	// NULL is pushed to wake up the event loop on shutdown
+	if( NULL == response ) return;
+
+	SP_Sid_t fromSid = response->getFromSid();
+	uint16_t seq = 0;
+
+	if( ! SP_UringEventHelper::isSystemSid( &fromSid ) ) {
+		SP_Session * session = manager->get( fromSid.mKey, &seq );
+		if( seq == fromSid.mSeq && NULL != session ) {
+			if( SP_Session::eWouldExit == session->getStatus() ) {
+				session->setStatus( SP_Session::eExit );
+			}
+
+			if( SP_Session::eNormal == session->getStatus() ) {
+				if( 0 == addRecv( session ) ) {
+					if( 0 == session->getRunning() ) {
+						SP_UringEventHelper::doDecodeForWork( session );
+					}
+				} else {
+					if( 0 == session->getRunning() ) {
+						SP_UringEventHelper::doError( session );
+					}
+				}
+			}
+		} else {
+			sp_syslog( LOG_WARNING, "session(%d.%d) invalid, unknown FROM",
+					fromSid.mKey, fromSid.mSeq );
+		}
+	}
+
+	for( SP_Message * msg = response->takeMessage();
+			NULL != msg; msg = response->takeMessage() ) {
+
+		SP_SidList * sidList = msg->getToList();
+
+		if( msg->getTotalSize() > 0 ) {
+			for( int i = sidList->getCount() - 1; i >= 0; i-- ) {
+				SP_Sid_t sid = sidList->get( i );
+				SP_Session * session = manager->get( sid.mKey, &seq );
+				if( seq == sid.mSeq && NULL != session ) {
+					if( 0 != memcmp( &fromSid, &sid, sizeof( sid ) )
+							&& SP_Session::eExit == session->getStatus() ) {
+						sidList->take( i );
+						msg->getFailure()->add( sid );
+						sp_syslog( LOG_WARNING, "session(%d.%d) would exit, invalid TO", sid.mKey, sid.mSeq );
+					} else {
+						if( 0 == addSend( session ) ) {
+							session->getOutList()->append( msg );
+						} else {
+							sidList->take( i );
+							msg->getFailure()->add( sid );
+							if( 0 == session->getRunning() ) {
+								SP_UringEventHelper::doError( session );
+							}
+						}
+					}
+				} else {
+					sidList->take( i );
+					msg->getFailure()->add( sid );
+					sp_syslog( LOG_WARNING, "session(%d.%d) invalid, unknown TO", sid.mKey, sid.mSeq );
+				}
+			}
+		} else {
+			for( ; sidList->getCount() > 0; ) {
+				msg->getFailure()->add( sidList->take( SP_ArrayList::LAST_INDEX ) );
+			}
+		}
+
+		if( msg->getToList()->getCount() <= 0 ) {
+			SP_UringEventHelper::doCompletion( eventArg, msg );
+		}
+	}
+
+	if( ! SP_UringEventHelper::isSystemSid( &fromSid ) ) {
+		SP_Session * session = manager->get( fromSid.mKey, &seq );
+		if( seq == fromSid.mSeq && NULL != session ) {
+			if( session->getOutList()->getCount() <= 0 && SP_Session::eExit == session->getStatus() ) {
+				if( 0 == session->getRunning() ) {
+					SP_UringEventHelper::doClose( session );
+				} else {
+					sp_syslog( LOG_NOTICE, "session(%d.%d) busy, terminate session later",
+							fromSid.mKey, fromSid.mSeq );
+				}
+			}
+		}
+	}
+
+	for( int i = 0; i < response->getToCloseList()->getCount(); i++ ) {
+		SP_Sid_t sid = response->getToCloseList()->get( i );
+		SP_Session * session = manager->get( sid.mKey, &seq );
+		if( seq == sid.mSeq && NULL != session ) {
+			session->setStatus( SP_Session::eExit );
+			if( 0 != addSend( session ) ) {
+				if( 0 == session->getRunning() ) {
+					SP_UringEventHelper::doError( session );
+				}
+			}
+		} else {
+			sp_syslog( LOG_WARNING, "session(%d.%d) invalid, unknown CLOSE", sid.mKey, sid.mSeq );
+		}
+	}
+
+	delete response;
+}
+
+void SP_UringEventCallback :: onTimeout( SP_TimerNode_t * node, void * arg )
+{
+	SP_Session * session = (SP_Session*)arg;
+
+	if( 0 == session->getRunning() ) {
+		SP_UringEventHelper::doTimeout( session );
+	} else {
+		SP_Sid_t sid = session->getSid();
+		sp_syslog( LOG_NOTICE, "session(%d.%d) busy, process session timeout later",
+				sid.mKey, sid.mSeq );
+		// onResponse will receive again, and the timer is armed again
+	}
+}
+
+int SP_UringEventCallback :: eventLoop( SP_UringEventArg * eventArg,
+		SP_UringAcceptArg_t * acceptArg, int maxWait )
+{
+	SP_Uring * uring = eventArg->getUring();
+	SP_TimerWheel * timerWheel = eventArg->getTimerWheel();
+	SP_SessionManager * manager = eventArg->getSessionManager();
+
+	int timeout = timerWheel->getNextTimeout();
+	if( maxWait >= 0 && ( timeout < 0 || maxWait < timeout ) ) timeout = maxWait;
+
+	// the ring was full when the accept was queued, the wait below frees it
+	if( NULL != acceptArg && acceptArg->mNeedAccept && 0 != addAccept( acceptArg ) ) {
+		if( timeout < 0 || timeout > eAcceptRetryMsec ) timeout = eAcceptRetryMsec;
+	}
+
+	// the requests queued by the last round are submitted together
+	uring->wait( timeout );
+
+	int count = 0;
+
+	SP_UringCqe_t cqe;
+	for( ; uring->next( &cqe ); count++ ) {
+		int key = (int)( cqe.mUserData >> 56 );
+
+		if( eKeyAccept == key ) {
+			onAccept( acceptArg, &cqe );
+		} else if( eKeyMsgQueue == key ) {
+			SP_UringMsgQueue * msgQueue = (SP_UringMsgQueue*)(unsigned long)
+					( cqe.mUserData & ( ( 1ULL << 56 ) - 1 ) );
+			msgQueue->arm( cqe.mUserData );
+			msgQueue->process();
+		} else if( eKeyRecv == key || eKeySend == key ) {
+			SP_Sid_t sid;
+			sid.mKey = (uint32_t)cqe.mUserData;
+			sid.mSeq = (uint16_t)( cqe.mUserData >> 32 );
+
+			uint16_t seq = 0;
+			SP_Session * session = manager->get( sid.mKey, &seq );
+
+			if( NULL == session || seq != sid.mSeq ) {
+				// the session is closed, the request is cancelled
+				int bufferId = SP_Uring::getBufferId( &cqe );
+				if( bufferId >= 0 ) uring->giveBack( bufferId );
+				continue;
+			}
+
+			if( eKeyRecv == key ) {
+				onRecv( session, &cqe );
+			} else {
+				onSend( session, &cqe );
+			}
+		}
+	}
+
+	timerWheel->advance();
+
+	return count;
+}
+
+//===================================================================
+
+int SP_UringEventHelper :: isSystemSid( SP_Sid_t * sid )
+{
+	return ( sid->mKey == SP_Sid_t::eTimerKey && sid->mSeq == SP_Sid_t::eTimerSeq )
+			|| ( sid->mKey == SP_Sid_t::ePushKey && sid->mSeq == SP_Sid_t::ePushSeq );
+}
+
+int SP_UringEventHelper :: doDecodeForWork( SP_Session * session )
+{
+	SP_MsgDecoder * decoder = session->getRequest()->getMsgDecoder();
+	int ret = decoder->decode( session->getInBuffer() );
+	if( SP_MsgDecoder::eOK == ret ) {
+		doWork( session );
+	} else if( SP_MsgDecoder::eMoreData != ret ) {
+		doError( session );
+		return -1;
+	}
+
+	return 0;
+}
+
+void SP_UringEventHelper :: doWork( SP_Session * session )
+{
+	if( SP_Session::eNormal == session->getStatus() ) {
+		session->setRunning( 1 );
+		SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+		SP_UringEventArg * eventArg = uringSession->mEventArg;
+		eventArg->getInputResultQueue()->push( new SP_SimpleTask( worker, session, 1 ) );
+	} else {
+		SP_Sid_t sid = session->getSid();
+
+		char buffer[ 16 ] = { 0 };
+		session->getInBuffer()->take( buffer, sizeof( buffer ) );
+		sp_syslog( LOG_WARNING, "session(%d.%d) status is %d, ignore [%s...] (%dB)",
+			sid.mKey, sid.mSeq, session->getStatus(), buffer, (int)session->getInBuffer()->getSize() );
+		session->getInBuffer()->reset();
+	}
+}
+
+void SP_UringEventHelper :: worker( void * arg )
+{
+	SP_Session * session = (SP_Session*)arg;
+	SP_Handler * handler = session->getHandler();
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_Response * response = new SP_Response( session->getSid() );
+	if( 0 != handler->handle( session->getRequest(), response ) ) {
+		session->setStatus( SP_Session::eWouldExit );
+	}
+
+	session->setRunning( 0 );
+
+	eventArg->getResponseQueue()->push( response );
+}
+
+void SP_UringEventHelper :: doClose( SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_Sid_t sid = session->getSid();
+
+	session->setRunning( 1 );
+
+	// remove session from SessionManager, the completions of this session will be ignored
+	eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+
+	SP_UringEventCallback::delSession( session );
+
+	eventArg->getInputResultQueue()->push( new SP_SimpleTask( close, session, 1 ) );
+}
+
+void SP_UringEventHelper :: close( void * arg )
+{
+	SP_Session * session = (SP_Session*)arg;
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_Sid_t sid = session->getSid();
+
+	session->getHandler()->close();
+
+	sp_syslog( LOG_DEBUG, "session(%d.%d) close, r %d(%d), w %d(%d), i %d, o %d, s %d(%d)",
+			sid.mKey, sid.mSeq, session->getTotalRead(), session->getReading(),
+			session->getTotalWrite(), session->getWriting(),
+			(int)session->getInBuffer()->getSize(), session->getOutList()->getCount(),
+			eventArg->getSessionManager()->getCount(), eventArg->getSessionManager()->getFreeCount() );
+
+	// the fd is closed by the ring, nothing refers to the session now
+	delete session;
+	free( uringSession );
+}
+
+void SP_UringEventHelper :: doError( SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+	SP_Sid_t sid = session->getSid();
+
+	session->setRunning( 1 );
+
+	SP_ArrayList * outList = session->getOutList();
+	for( ; outList->getCount() > 0; ) {
+		SP_Message * msg = ( SP_Message * ) outList->takeItem( SP_ArrayList::LAST_INDEX );
+
+		int index = msg->getToList()->find( sid );
+		if( index >= 0 ) msg->getToList()->take( index );
+		msg->getFailure()->add( sid );
+
+		if( msg->getToList()->getCount() <= 0 ) {
+			doCompletion( eventArg, msg );
+		}
+	}
+
+	// remove session from SessionManager, the completions of this session will be ignored
+	eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+
+	SP_UringEventCallback::delSession( session );
+
+	eventArg->getInputResultQueue()->push( new SP_SimpleTask( error, session, 1 ) );
+}
+
+void SP_UringEventHelper :: error( void * arg )
+{
+	SP_Session * session = ( SP_Session * )arg;
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_Sid_t sid = session->getSid();
+
+	SP_Response * response = new SP_Response( sid );
+	session->getHandler()->error( response );
+
+	eventArg->getResponseQueue()->push( response );
+
+	sp_syslog( LOG_WARNING, "session(%d.%d) error, r %d(%d), w %d(%d), i %d, o %d, s %d(%d)",
+			sid.mKey, sid.mSeq, session->getTotalRead(), session->getReading(),
+			session->getTotalWrite(), session->getWriting(),
+			(int)session->getInBuffer()->getSize(), session->getOutList()->getCount(),
+			eventArg->getSessionManager()->getCount(), eventArg->getSessionManager()->getFreeCount() );
+
+	// the completions of this session are ignored, so it's safe to destroy session here
+	session->getHandler()->close();
+
+	delete session;
+	free( uringSession );
+}
+
+void SP_UringEventHelper :: doTimeout( SP_Session * session )
+{
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+	SP_Sid_t sid = session->getSid();
+
+	session->setRunning( 1 );
+
+	SP_ArrayList * outList = session->getOutList();
+	for( ; outList->getCount() > 0; ) {
+		SP_Message * msg = ( SP_Message * ) outList->takeItem( SP_ArrayList::LAST_INDEX );
+
+		int index = msg->getToList()->find( sid );
+		if( index >= 0 ) msg->getToList()->take( index );
+		msg->getFailure()->add( sid );
+
+		if( msg->getToList()->getCount() <= 0 ) {
+			doCompletion( eventArg, msg );
+		}
+	}
+
+	// remove session from SessionManager, the completions of this session will be ignored
+	eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+
+	SP_UringEventCallback::delSession( session );
+
+	eventArg->getInputResultQueue()->push( new SP_SimpleTask( timeout, session, 1 ) );
+}
+
+void SP_UringEventHelper :: timeout( void * arg )
+{
+	SP_Session * session = ( SP_Session * )arg;
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_Sid_t sid = session->getSid();
+
+	SP_Response * response = new SP_Response( sid );
+	session->getHandler()->timeout( response );
+
+	eventArg->getResponseQueue()->push( response );
+
+	sp_syslog( LOG_WARNING, "session(%d.%d) timeout, r %d(%d), w %d(%d), i %d, o %d, s %d(%d)",
+			sid.mKey, sid.mSeq, session->getTotalRead(), session->getReading(),
+			session->getTotalWrite(), session->getWriting(),
+			(int)session->getInBuffer()->getSize(), session->getOutList()->getCount(),
+			eventArg->getSessionManager()->getCount(), eventArg->getSessionManager()->getFreeCount() );
+
+	// the completions of this session are ignored, so it's safe to destroy session here
+	session->getHandler()->close();
+
+	delete session;
+	free( uringSession );
+}
+
+void SP_UringEventHelper :: doStart( SP_Session * session )
+{
+	session->setRunning( 1 );
+
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+	eventArg->getInputResultQueue()->push( new SP_SimpleTask( start, session, 1 ) );
+}
+
+void SP_UringEventHelper :: start( void * arg )
+{
+	SP_Session * session = ( SP_Session * )arg;
+	SP_UringSession_t * uringSession = (SP_UringSession_t*)session->getArg();
+	SP_UringEventArg * eventArg = uringSession->mEventArg;
+
+	SP_IOChannel * ioChannel = session->getIOChannel();
+
+	int initRet = ioChannel->init( uringSession->mFd );
+
+	// always call SP_Handler::start
+	SP_Response * response = new SP_Response( session->getSid() );
+	int startRet = session->getHandler()->start( session->getRequest(), response );
+
+	int status = SP_Session::eWouldExit;
+
+	if( 0 == initRet ) {
+		if( 0 == startRet ) status = SP_Session::eNormal;
+	} else {
+		delete response;
+		// make an empty response
+		response = new SP_Response( session->getSid() );
+	}
+
+	session->setStatus( status );
+	session->setRunning( 0 );
+
+	eventArg->getResponseQueue()->push( response );
+}
+
+void SP_UringEventHelper :: doCompletion( SP_UringEventArg * eventArg, SP_Message * msg )
+{
+	eventArg->getOutputResultQueue()->push( msg );
+}
+
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spuringcb_hpp__
+#define __spuringcb_hpp__
+
+#include "spuringevent.hpp"
+
+class SP_HandlerFactory;
+class SP_Session;
+class SP_Message;
+class SP_Response;
+
+typedef struct tagSP_Sid SP_Sid_t;
+typedef struct tagSP_TimerNode SP_TimerNode_t;
+
+typedef struct tagSP_UringAcceptArg {
+	SP_HandlerFactory * mHandlerFactory;
+
+	int mReqQueueSize;
+	int mMaxConnections;
+	char * mRefusedMsg;
+
+	SP_UringEventArg * mEventArg;
+	int mListenFd;
+
+	// the multishot accept cannot be queued, it is retried by the next loop
+	int mNeedAccept;
+} SP_UringAcceptArg_t;
+
+typedef struct tagSP_UringSession {
+	SP_Session * mSession;
+	SP_UringEventArg * mEventArg;
+
+	int mFd;
+} SP_UringSession_t;
+
+class SP_UringEventCallback {
+public:
+
+	// the kind of a request, kept in the top 8 bits of its user data
+	enum { eKeyUnknown, eKeyAccept, eKeyMsgQueue, eKeyRecv, eKeySend, eKeyCancel, eKeyClose };
+
+	// the longest wait of the loop while the accept is not queued
+	enum { eAcceptRetryMsec = 100 };
+
+	static uint64_t makeUserData( int key, SP_Sid_t sid );
+
+	// read the eventfd of the queue in the ring, it is armed again after each wakeup
+	static int addMsgQueue( SP_UringMsgQueue * msgQueue );
+
+	// queue the multishot accept, mark it to be retried if the ring is full
+	static int addAccept( SP_UringAcceptArg_t * acceptArg );
+
+	static int addSession( SP_UringEventArg * eventArg, int fd, SP_Session * session );
+	static int addRecv( SP_Session * session );
+	static int addSend( SP_Session * session );
+
+	// push the idle timeout of the session back
+	static void addTimer( SP_Session * session );
+
+	// cancel the requests and the timer of the session, and close its fd
+	static void delSession( SP_Session * session );
+
+	static void onRecv( SP_Session * session, SP_UringCqe_t * cqe );
+	static void onSend( SP_Session * session, SP_UringCqe_t * cqe );
+	static void onAccept( SP_UringAcceptArg_t * acceptArg, SP_UringCqe_t * cqe );
+	static void onResponse( void * queueData, void * arg );
+
+	static void onTimeout( SP_TimerNode_t * node, void * arg );
+
+	// submit the queued requests, wait at most maxWait msec, -1 : until a completion
+	// or an idle timeout, and process all the completions
+	static int eventLoop( SP_UringEventArg * eventArg, SP_UringAcceptArg_t * acceptArg,
+			int maxWait = -1 );
+
+private:
+	SP_UringEventCallback();
+	~SP_UringEventCallback();
+};
+
+class SP_UringEventHelper {
+public:
+	static void doStart( SP_Session * session );
+	static void start( void * arg );
+
+	static void doWork( SP_Session * session );
+	static void worker( void * arg );
+
+	static void doError( SP_Session * session );
+	static void error( void * arg );
+
+	static void doTimeout( SP_Session * session );
+	static void timeout( void * arg );
+
+	static void doClose( SP_Session * session );
+	static void close( void * arg );
+
+	// return -1 if the request is bad and the session is closed
+	static int doDecodeForWork( SP_Session * session );
+
+	static void doCompletion( SP_UringEventArg * eventArg, SP_Message * msg );
+
+	static int isSystemSid( SP_Sid_t * sid );
+
+private:
+	SP_UringEventHelper();
+	~SP_UringEventHelper();
+};
+
+#endif
+
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "spporting.hpp"
+#include "spthread.hpp"
+
+#include "spuringdispatcher.hpp"
+
+#include "spuringevent.hpp"
+#include "spuringcb.hpp"
+#include "sphandler.hpp"
+#include "spsession.hpp"
+#include "spexecutor.hpp"
+#include "sputils.hpp"
+#include "spioutils.hpp"
+#include "spiochannel.hpp"
+#include "sprequest.hpp"
+#include "sptimerwheel.hpp"
+
+SP_UringDispatcher :: SP_UringDispatcher( SP_CompletionHandler * completionHandler, int maxThreads )
+{
+#ifdef SIGPIPE
+	/* Don't die with SIGPIPE on remote read shutdown. That's dumb. */
+	signal( SIGPIPE, SIG_IGN );
+#endif
+
+	mIsShutdown = 0;
+	mIsRunning = 0;
+
+	mMaxThreads = maxThreads > 0 ? maxThreads : 4;
+
+	mCompletionHandler = completionHandler;
+
+	mEventArg = new SP_UringEventArg( 600 );
+	mPushQueue = NULL;
+
+	if( NULL != mEventArg->getUring() ) {
+		SP_UringMsgQueue * msgQueue = new SP_UringMsgQueue( mEventArg->getUring(),
+				SP_UringEventCallback::onResponse, mEventArg );
+		mEventArg->setResponseQueue( msgQueue );
+
+		mPushQueue = new SP_UringMsgQueue( mEventArg->getUring(), onPush, this );
+	} else {
+		sp_syslog( LOG_ERR, "Cannot create io_uring, dispatcher cannot be started" );
+	}
+
+	mTimerWheel = new SP_TimerWheel( eTimerTickMsec );
+}
+
+SP_UringDispatcher :: ~SP_UringDispatcher()
+{
+	if( 0 == mIsRunning ) sleep( 1 );
+
+	shutdown();
+
+	for( ; mIsRunning; ) sleep( 1 );
+
+	if( NULL != mPushQueue ) delete mPushQueue;
+	mPushQueue = NULL;
+
+	delete mEventArg;
+	mEventArg = NULL;
+
+	delete mTimerWheel;
+	mTimerWheel = NULL;
+}
+
+void SP_UringDispatcher :: setTimeout( int timeout )
+{
+	mEventArg->setTimeout( timeout );
+}
+
+void SP_UringDispatcher :: shutdown()
+{
+	mIsShutdown = 1;
+
+	// wake up the event loop
+	if( NULL != mEventArg->getResponseQueue() ) mEventArg->getResponseQueue()->push( NULL );
+}
+
+int SP_UringDispatcher :: isRunning()
+{
+	return mIsRunning;
+}
+
+int SP_UringDispatcher :: getSessionCount()
+{
+	return mEventArg->getSessionManager()->getCount();
+}
+
+int SP_UringDispatcher :: getReqQueueLength()
+{
+	return mEventArg->getInputResultQueue()->getLength();
+}
+
+int SP_UringDispatcher :: dispatch()
+{
+	int ret = -1;
+
+	if( NULL == mPushQueue ) return -1;
+
+	sp_thread_attr_t attr;
+	sp_thread_attr_init( &attr );
+	assert( sp_thread_attr_setstacksize( &attr, 1024 * 1024 ) == 0 );
+	sp_thread_attr_setdetachstate( &attr, SP_THREAD_CREATE_DETACHED );
+
+	sp_thread_t thread;
+	ret = sp_thread_create( &thread, &attr, eventLoop, this );
+	sp_thread_attr_destroy( &attr );
+	if( 0 == ret ) {
+		sp_syslog( LOG_NOTICE, "Thread #%ld has been created for dispatcher", thread );
+	} else {
+		mIsRunning = 0;
+		sp_syslog( LOG_WARNING, "Unable to create a thread for dispatcher, %s",
+			strerror( errno ) ) ;
+	}
+
+	return ret;
+}
+
+sp_thread_result_t SP_THREAD_CALL SP_UringDispatcher :: eventLoop( void * arg )
+{
+	SP_UringDispatcher * dispatcher = (SP_UringDispatcher*)arg;
+
+	dispatcher->mIsRunning = 1;
+
+	dispatcher->start();
+
+	dispatcher->mIsRunning = 0;
+
+	return 0;
+}
+
+void SP_UringDispatcher :: outputCompleted( void * arg )
+{
+	SP_CompletionHandler * handler = ( SP_CompletionHandler * ) ((void**)arg)[0];
+	SP_Message * msg = ( SP_Message * ) ((void**)arg)[ 1 ];
+
+	handler->completionMessage( msg );
+
+	free( arg );
+}
+
+int SP_UringDispatcher :: start()
+{
+	SP_Executor workerExecutor( mMaxThreads, "work" );
+	SP_Executor actExecutor( 1, "act" );
+
+	SP_UringEventCallback::addMsgQueue( mEventArg->getResponseQueue() );
+	SP_UringEventCallback::addMsgQueue( mPushQueue );
+
+	/* Start the event loop. */
+	while( 0 == mIsShutdown ) {
+		int maxWait = mTimerWheel->getNextTimeout();
+
+		SP_UringEventCallback::eventLoop( mEventArg, NULL, maxWait );
+
+		mTimerWheel->advance();
+
+		for( ; NULL != mEventArg->getInputResultQueue()->top(); ) {
+			SP_Task * task = (SP_Task*)mEventArg->getInputResultQueue()->pop();
+			workerExecutor.execute( task );
+		}
+
+		for( ; NULL != mEventArg->getOutputResultQueue()->top(); ) {
+			SP_Message * msg = (SP_Message*)mEventArg->getOutputResultQueue()->pop();
+
+			void ** arg = ( void** )malloc( sizeof( void * ) * 2 );
+			arg[ 0 ] = (void*)mCompletionHandler;
+			arg[ 1 ] = (void*)msg;
+
+			actExecutor.execute( outputCompleted, arg );
+		}
+	}
+
+	sp_syslog( LOG_NOTICE, "Dispatcher is shutdown." );
+
+	return 0;
+}
+
+typedef struct tagSP_UringPushArg {
+	int mType;      // 0 : fd, 1 : timer
+
+	// for push fd
+	int mFd;
+	SP_Handler * mHandler;
+	int mNeedStart;
+
+	// for push timer
+	struct timeval mTimeout;
+	SP_TimerNode_t mTimerNode;
+	SP_TimerHandler * mTimerHandler;
+	SP_UringEventArg * mEventArg;
+	SP_UringMsgQueue * mPushQueue;
+} SP_UringPushArg_t;
+
+void SP_UringDispatcher :: onPush( void * queueData, void * arg )
+{
+	SP_UringPushArg_t * pushArg = (SP_UringPushArg_t*)queueData;
+	SP_UringDispatcher * dispatcher = (SP_UringDispatcher*)arg;
+	SP_UringEventArg * eventArg = dispatcher->mEventArg;
+
+	if( 0 == pushArg->mType ) {
+		SP_Sid_t sid;
+		sid.mKey = eventArg->getSessionManager()->allocKey( &sid.mSeq );
+		if( 0 == sid.mKey ) {
+			sp_syslog( LOG_WARNING, "Cannot allocate session key, refuse fd %d", pushArg->mFd );
+			sp_close( pushArg->mFd );
+			delete pushArg->mHandler;
+			free( pushArg );
+			return;
+		}
+
+		SP_Session * session = new SP_Session( sid );
+
+		char clientIP[ 32 ] = { 0 };
+		{
+			struct sockaddr_in clientAddr;
+			socklen_t clientLen = sizeof( clientAddr );
+			getpeername( pushArg->mFd, (struct sockaddr *)&clientAddr, &clientLen );
+			SP_IOUtils::inetNtoa( &( clientAddr.sin_addr ), clientIP, sizeof( clientIP ) );
+			session->getRequest()->setClientPort( ntohs( clientAddr.sin_port ) );
+		}
+		session->getRequest()->setClientIP( clientIP );
+
+		session->setHandler( pushArg->mHandler );
+		session->setIOChannel( new SP_DefaultIOChannel() );
+
+		if( 0 == SP_UringEventCallback::addSession( eventArg, pushArg->mFd, session ) ) {
+			eventArg->getSessionManager()->put( sid.mKey, sid.mSeq, session );
+
+			if( pushArg->mNeedStart ) {
+				SP_UringEventHelper::doStart( session );
+			} else {
+				SP_UringEventCallback::addRecv( session );
+			}
+		} else {
+			eventArg->getSessionManager()->remove( sid.mKey, sid.mSeq );
+			delete session;
+		}
+
+		free( pushArg );
+	} else {
+		if( 0 == dispatcher->mTimerWheel->getCount() ) {
+			// the wheel is not advanced when it is empty, bring it up to date first
+			dispatcher->mTimerWheel->advance();
+		}
+
+		SP_TimerWheel::initNode( &( pushArg->mTimerNode ), onTimer, pushArg );
+
+		long long msec = pushArg->mTimeout.tv_sec * 1000LL + pushArg->mTimeout.tv_usec / 1000;
+		dispatcher->mTimerWheel->schedule( &( pushArg->mTimerNode ),
+				msec < 0x7fffffff ? (int)msec : 0x7fffffff );
+	}
+}
+
+int SP_UringDispatcher :: push( int fd, SP_Handler * handler, int needStart )
+{
+	if( NULL == mPushQueue ) return -1;
+
+	SP_UringPushArg_t * arg = (SP_UringPushArg_t*)malloc( sizeof( SP_UringPushArg_t ) );
+	arg->mType = 0;
+	arg->mFd = fd;
+	arg->mHandler = handler;
+	arg->mNeedStart = needStart;
+
+	SP_IOUtils::setNonblock( fd );
+
+	return mPushQueue->push( arg );
+}
+
+void SP_UringDispatcher :: onTimer( SP_TimerNode_t * node, void * arg )
+{
+	SP_UringPushArg_t * pushArg = (SP_UringPushArg_t*)arg;
+
+	pushArg->mEventArg->getInputResultQueue()->push(
+		new SP_SimpleTask( timer, pushArg, 1 ) );
+}
+
+void SP_UringDispatcher :: timer( void * arg )
+{
+	SP_UringPushArg_t * pushArg = (SP_UringPushArg_t*)arg;
+	SP_TimerHandler * handler = pushArg->mTimerHandler;
+	SP_UringEventArg * eventArg = pushArg->mEventArg;
+
+	SP_Sid_t sid;
+	sid.mKey = SP_Sid_t::eTimerKey;
+	sid.mSeq = SP_Sid_t::eTimerSeq;
+	SP_Response * response = new SP_Response( sid );
+	if( 0 == handler->handle( response, &( pushArg->mTimeout ) ) ) {
+		pushArg->mPushQueue->push( arg );
+	} else {
+		delete pushArg->mTimerHandler;
+		free( pushArg );
+	}
+
+	eventArg->getResponseQueue()->push( response );
+}
+
+int SP_UringDispatcher :: push( const struct timeval * timeout, SP_TimerHandler * handler )
+{
+	if( NULL == mPushQueue ) return -1;
+
+	SP_UringPushArg_t * arg = (SP_UringPushArg_t*)malloc( sizeof( SP_UringPushArg_t ) );
+
+	arg->mType = 1;
+	arg->mTimeout = *timeout;
+	arg->mTimerHandler = handler;
+	arg->mEventArg = mEventArg;
+	arg->mPushQueue = mPushQueue;
+
+	return mPushQueue->push( arg );
+}
+
+int SP_UringDispatcher :: push( SP_Response * response )
+{
+	if( NULL == mEventArg->getResponseQueue() ) return -1;
+
+	return mEventArg->getResponseQueue()->push( response );
+}
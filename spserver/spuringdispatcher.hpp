@@ -0,0 +1,91 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spuringdispatcher_hpp__
+#define __spuringdispatcher_hpp__
+
+#include "spporting.hpp"
+#include "spthread.hpp"
+
+class SP_CompletionHandler;
+class SP_Handler;
+class SP_Message;
+class SP_TimerHandler;
+class SP_Response;
+
+class SP_UringEventArg;
+class SP_UringMsgQueue;
+class SP_TimerWheel;
+
+typedef struct tagSP_TimerNode SP_TimerNode_t;
+
+// SP_IocpDispatcher on linux io_uring, the sessions always use SP_DefaultIOChannel
+class SP_UringDispatcher {
+public:
+	SP_UringDispatcher( SP_CompletionHandler * completionHandler, int maxThreads = 64 );
+	~SP_UringDispatcher();
+
+	void setTimeout( int timeout );
+
+	int getSessionCount();
+	int getReqQueueLength();
+
+	void shutdown();
+	int isRunning();
+
+	/**
+	 * @brief  create a thread to run event loop
+	 * @return 0 : OK, -1 : Fail, cannot create thread or io_uring
+	 */
+	int dispatch();
+
+	/**
+	 * @brief register a fd into dispatcher
+	 * @param needStart : 1 - call handler::start, 0 - don't call handler::start
+	 * @return 0 : OK, -1 : Fail, invalid fd
+	 * @note  handler will be deleted by dispatcher when the session is close
+	 */
+	int push( int fd, SP_Handler * handler, int needStart = 1 );
+
+	/**
+	 * @brief register a timer into dispatcher
+	 * @param timeout : the interval for the timer, rounded up to 10 milliseconds
+	 * @note  handler will be deleted by dispatcher when the timer is terminated
+	 */
+	int push( const struct timeval * timeout, SP_TimerHandler * handler );
+
+	/**
+	 * @brief push a response
+	 */
+	int push( SP_Response * response );
+
+private:
+	int mIsShutdown;
+	int mIsRunning;
+	int mMaxThreads;
+
+	SP_UringEventArg * mEventArg;
+	SP_CompletionHandler * mCompletionHandler;
+
+	SP_UringMsgQueue * mPushQueue;
+
+	// the timers pushed by push( timeout, handler ), only used by the event loop thread
+	enum { eTimerTickMsec = 10 };
+	SP_TimerWheel * mTimerWheel;
+
+	int start();
+
+	static sp_thread_result_t SP_THREAD_CALL eventLoop( void * arg );
+
+	static void onPush( void * queueData, void * arg );
+
+	static void outputCompleted( void * arg );
+
+	static void onTimer( SP_TimerNode_t * node, void * arg );
+	static void timer( void * arg );
+};
+
+#endif
+
@@ -0,0 +1,532 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "spporting.hpp"
+
+#include "spuringevent.hpp"
+#include "sputils.hpp"
+#include "spsession.hpp"
+#include "sptimerwheel.hpp"
+
+#include <linux/io_uring.h>
+
+// multishot receive and provided buffer ring, linux 6.0
+#if defined( IORING_RECV_MULTISHOT ) && defined( __NR_io_uring_setup )
+#define SP_HAVE_URING
+#endif
+
+SP_Uring :: SP_Uring()
+{
+	mFd = -1;
+
+	mRing = mSqes = mCqes = mBufRing = NULL;
+	mRingSize = mSqesSize = mBufRingSize = 0;
+
+	mSqHead = mSqTail = mCqHead = mCqTail = NULL;
+	mSqMask = mSqEntries = mSqLocalTail = mCqMask = 0;
+
+	mBufBase = NULL;
+	mBufCount = mBufSize = 0;
+	mBufTail = 0;
+}
+
+SP_Uring :: ~SP_Uring()
+{
+	if( mFd >= 0 ) sp_close( mFd );
+
+	if( NULL != mRing ) munmap( mRing, mRingSize );
+	if( NULL != mSqes ) munmap( mSqes, mSqesSize );
+	if( NULL != mBufRing ) munmap( mBufRing, mBufRingSize );
+
+	if( NULL != mBufBase ) free( mBufBase );
+}
+
+#ifdef SP_HAVE_URING
+
+int SP_Uring :: init( int entries, int bufCount, int bufSize )
+{
+	struct io_uring_params params;
+	memset( &params, 0, sizeof( params ) );
+
+	mFd = syscall( __NR_io_uring_setup, entries, &params );
+	if( mFd < 0 ) {
+		sp_syslog( LOG_WARNING, "io_uring_setup failed, errno %d, %s", errno, strerror( errno ) );
+		return -1;
+	}
+
+	unsigned int needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if( needed != ( params.features & needed ) ) {
+		sp_syslog( LOG_WARNING, "io_uring features 0x%x are not supported", needed );
+		return -1;
+	}
+
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+	mRingSize = sqSize > cqSize ? sqSize : cqSize;
+
+	mRing = mmap( NULL, mRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			mFd, IORING_OFF_SQ_RING );
+	if( MAP_FAILED == mRing ) {
+		mRing = NULL;
+		sp_syslog( LOG_WARNING, "mmap io_uring failed, errno %d, %s", errno, strerror( errno ) );
+		return -1;
+	}
+
+	mSqesSize = params.sq_entries * sizeof( struct io_uring_sqe );
+	mSqes = mmap( NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			mFd, IORING_OFF_SQES );
+	if( MAP_FAILED == mSqes ) {
+		mSqes = NULL;
+		sp_syslog( LOG_WARNING, "mmap io_uring sqes failed, errno %d, %s", errno, strerror( errno ) );
+		return -1;
+	}
+
+	char * ring = (char*)mRing;
+
+	mSqHead = (unsigned int*)( ring + params.sq_off.head );
+	mSqTail = (unsigned int*)( ring + params.sq_off.tail );
+	mSqMask = *(unsigned int*)( ring + params.sq_off.ring_mask );
+	mSqEntries = params.sq_entries;
+	mSqLocalTail = *mSqTail;
+
+	// the sqes are always used in order
+	unsigned int * sqArray = (unsigned int*)( ring + params.sq_off.array );
+	for( unsigned int i = 0; i < mSqEntries; i++ ) sqArray[ i ] = i;
+
+	mCqHead = (unsigned int*)( ring + params.cq_off.head );
+	mCqTail = (unsigned int*)( ring + params.cq_off.tail );
+	mCqMask = *(unsigned int*)( ring + params.cq_off.ring_mask );
+	mCqes = ring + params.cq_off.cqes;
+
+	// the entries of a buffer ring are a power of 2
+	for( mBufCount = 1; mBufCount < bufCount && mBufCount < 32768; ) mBufCount = mBufCount << 1;
+	mBufSize = bufSize;
+
+	mBufRingSize = mBufCount * sizeof( struct io_uring_buf );
+	mBufRing = mmap( NULL, mBufRingSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( MAP_FAILED == mBufRing ) {
+		mBufRing = NULL;
+		sp_syslog( LOG_WARNING, "mmap buffer ring failed, errno %d, %s", errno, strerror( errno ) );
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset( &reg, 0, sizeof( reg ) );
+	reg.ring_addr = (unsigned long)mBufRing;
+	reg.ring_entries = mBufCount;
+	reg.bgid = 0;
+
+	if( 0 != syscall( __NR_io_uring_register, mFd, IORING_REGISTER_PBUF_RING, &reg, 1 ) ) {
+		sp_syslog( LOG_WARNING, "register buffer ring failed, errno %d, %s", errno, strerror( errno ) );
+		return -1;
+	}
+
+	mBufBase = (char*)malloc( (size_t)mBufCount * mBufSize );
+	for( int i = 0; i < mBufCount; i++ ) giveBack( i );
+
+	return 0;
+}
+
+void * SP_Uring :: getSqe()
+{
+	unsigned int head = __atomic_load_n( mSqHead, __ATOMIC_ACQUIRE );
+
+	if( mSqLocalTail - head >= mSqEntries ) {
+		// flush the queue without waiting
+		__atomic_store_n( mSqTail, mSqLocalTail, __ATOMIC_RELEASE );
+		syscall( __NR_io_uring_enter, mFd, mSqLocalTail - head, 0, 0, NULL, 0 );
+
+		head = __atomic_load_n( mSqHead, __ATOMIC_ACQUIRE );
+		if( mSqLocalTail - head >= mSqEntries ) {
+			sp_syslog( LOG_WARNING, "io_uring submission queue is full" );
+			return NULL;
+		}
+	}
+
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)mSqes + ( mSqLocalTail & mSqMask );
+	memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+
+	mSqLocalTail++;
+
+	return sqe;
+}
+
+int SP_Uring :: prepAccept( int fd, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	// one request accepts all the connections
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: prepRecv( int fd, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	// one request receives until error or eof, an idle session holds no buffer
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: prepPoll( int fd, int events, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: prepRead( int fd, void * buffer, int len, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buffer;
+	sqe->len = len;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: prepCancel( uint64_t target, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: prepClose( int fd, uint64_t userData )
+{
+	struct io_uring_sqe * sqe = (struct io_uring_sqe*)getSqe();
+	if( NULL == sqe ) return -1;
+
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+	sqe->user_data = userData;
+
+	return 0;
+}
+
+int SP_Uring :: wait( int timeoutMsec )
+{
+	unsigned int head = __atomic_load_n( mSqHead, __ATOMIC_ACQUIRE );
+	unsigned int toSubmit = mSqLocalTail - head;
+
+	int ready = __atomic_load_n( mCqTail, __ATOMIC_ACQUIRE ) - *mCqHead;
+
+	if( 0 == toSubmit && ready > 0 ) return ready;
+
+	__atomic_store_n( mSqTail, mSqLocalTail, __ATOMIC_RELEASE );
+
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset( &arg, 0, sizeof( arg ) );
+
+	if( timeoutMsec >= 0 ) {
+		ts.tv_sec = timeoutMsec / 1000;
+		ts.tv_nsec = ( timeoutMsec % 1000 ) * 1000000LL;
+		arg.ts = (unsigned long)&ts;
+	}
+
+	// one syscall submits the batch and waits for the completions
+	int ret = syscall( __NR_io_uring_enter, mFd, toSubmit, ready > 0 ? 0 : 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof( arg ) );
+
+	if( ret < 0 && ETIME != errno && EINTR != errno && EBUSY != errno ) {
+		sp_syslog( LOG_WARNING, "io_uring_enter failed, errno %d, %s", errno, strerror( errno ) );
+	}
+
+	return __atomic_load_n( mCqTail, __ATOMIC_ACQUIRE ) - *mCqHead;
+}
+
+int SP_Uring :: next( SP_UringCqe_t * cqe )
+{
+	unsigned int head = *mCqHead;
+
+	if( head == __atomic_load_n( mCqTail, __ATOMIC_ACQUIRE ) ) return 0;
+
+	struct io_uring_cqe * entry = (struct io_uring_cqe*)mCqes + ( head & mCqMask );
+	cqe->mUserData = entry->user_data;
+	cqe->mRes = entry->res;
+	cqe->mFlags = entry->flags;
+
+	__atomic_store_n( mCqHead, head + 1, __ATOMIC_RELEASE );
+
+	return 1;
+}
+
+int SP_Uring :: hasMore( const SP_UringCqe_t * cqe )
+{
+	return 0 != ( cqe->mFlags & IORING_CQE_F_MORE );
+}
+
+int SP_Uring :: getBufferId( const SP_UringCqe_t * cqe )
+{
+	if( 0 == ( cqe->mFlags & IORING_CQE_F_BUFFER ) ) return -1;
+
+	return cqe->mFlags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+const char * SP_Uring :: getBuffer( int bufferId )
+{
+	return mBufBase + (size_t)bufferId * mBufSize;
+}
+
+void SP_Uring :: giveBack( int bufferId )
+{
+	// io_uring_buf_ring::bufs is shifted by the empty struct of __DECLARE_FLEX_ARRAY
+	// in c++, so the ring is used as an array, the tail overlays bufs[0].resv
+	struct io_uring_buf * bufs = (struct io_uring_buf*)mBufRing;
+
+	struct io_uring_buf * buf = &( bufs[ mBufTail & ( mBufCount - 1 ) ] );
+	buf->addr = (unsigned long)( mBufBase + (size_t)bufferId * mBufSize );
+	buf->len = mBufSize;
+	buf->bid = bufferId;
+
+	mBufTail++;
+
+	__atomic_store_n( &( bufs[ 0 ].resv ), mBufTail, __ATOMIC_RELEASE );
+}
+
+#else
+
+int SP_Uring :: init( int entries, int bufCount, int bufSize )
+{
+	sp_syslog( LOG_WARNING, "io_uring is not supported" );
+	return -1;
+}
+
+void * SP_Uring :: getSqe() { return NULL; }
+
+int SP_Uring :: prepAccept( int fd, uint64_t userData ) { return -1; }
+int SP_Uring :: prepRecv( int fd, uint64_t userData ) { return -1; }
+int SP_Uring :: prepPoll( int fd, int events, uint64_t userData ) { return -1; }
+int SP_Uring :: prepRead( int fd, void * buffer, int len, uint64_t userData ) { return -1; }
+int SP_Uring :: prepCancel( uint64_t target, uint64_t userData ) { return -1; }
+int SP_Uring :: prepClose( int fd, uint64_t userData ) { return -1; }
+
+int SP_Uring :: wait( int timeoutMsec ) { return 0; }
+int SP_Uring :: next( SP_UringCqe_t * cqe ) { return 0; }
+
+int SP_Uring :: hasMore( const SP_UringCqe_t * cqe ) { return 0; }
+int SP_Uring :: getBufferId( const SP_UringCqe_t * cqe ) { return -1; }
+const char * SP_Uring :: getBuffer( int bufferId ) { return NULL; }
+void SP_Uring :: giveBack( int bufferId ) {}
+
+#endif
+
+//===================================================================
+
+struct tagSP_UringMsgNode {
+	SP_UringMsgNode_t * mNext;
+	void * mData;
+};
+
+SP_UringMsgQueue :: SP_UringMsgQueue( SP_Uring * uring, QueueFunc_t func, void * arg )
+{
+	mUring = uring;
+	mFunc = func;
+	mArg = arg;
+
+	// blocking, a read of a non-blocking fd fails in the ring instead of waiting
+	mEventFd = eventfd( 0, EFD_CLOEXEC );
+	if( mEventFd < 0 ) {
+		sp_syslog( LOG_ERR, "eventfd failed, errno %d, %s", errno, strerror( errno ) );
+	}
+	mCounter = 0;
+
+	mHead = NULL;
+}
+
+SP_UringMsgQueue :: ~SP_UringMsgQueue()
+{
+	if( mEventFd >= 0 ) sp_close( mEventFd );
+
+	for( SP_UringMsgNode_t * node = mHead; NULL != node; ) {
+		SP_UringMsgNode_t * next = node->mNext;
+		free( node );
+		node = next;
+	}
+	mHead = NULL;
+}
+
+int SP_UringMsgQueue :: push( void * queueData )
+{
+	SP_UringMsgNode_t * node = (SP_UringMsgNode_t*)malloc( sizeof( SP_UringMsgNode_t ) );
+	if( NULL == node ) return -1;
+
+	node->mData = queueData;
+
+	SP_UringMsgNode_t * head = NULL;
+	do {
+		head = mHead;
+		node->mNext = head;
+	} while( ! sp_atomic_cas_ptr( &mHead, head, node ) );
+
+	// only the push which makes the queue non-empty wakes up the event loop
+	if( NULL == head ) {
+		uint64_t one = 1;
+		for( ; write( mEventFd, &one, sizeof( one ) ) < 0 && EINTR == errno; ) ;
+	}
+
+	return 0;
+}
+
+int SP_UringMsgQueue :: arm( uint64_t userData )
+{
+	return mUring->prepRead( mEventFd, &mCounter, sizeof( mCounter ), userData );
+}
+
+int SP_UringMsgQueue :: process()
+{
+	// take all the pending items at once, a later push wakes up the loop again
+	SP_UringMsgNode_t * list = (SP_UringMsgNode_t*)sp_atomic_swap_ptr( &mHead, (SP_UringMsgNode_t*)NULL );
+
+	// the stack is LIFO, reverse it to call in push order
+	SP_UringMsgNode_t * prev = NULL;
+	for( ; NULL != list; ) {
+		SP_UringMsgNode_t * next = list->mNext;
+		list->mNext = prev;
+		prev = list;
+		list = next;
+	}
+
+	for( ; NULL != prev; ) {
+		SP_UringMsgNode_t * node = prev;
+		prev = prev->mNext;
+
+		mFunc( node->mData, mArg );
+		free( node );
+	}
+
+	return 0;
+}
+
+//===================================================================
+
+SP_UringEventArg :: SP_UringEventArg( int timeout )
+{
+	mUring = new SP_Uring();
+	if( 0 != mUring->init( eEntries, eBufCount, eBufSize ) ) {
+		delete mUring;
+		mUring = NULL;
+	}
+
+	// both queues are pushed and popped by the event loop thread only
+	mInputResultQueue = new SP_BlockingQueue( SP_BlockingQueue::eSPSC );
+	mOutputResultQueue = new SP_BlockingQueue( SP_BlockingQueue::eSPSC );
+
+	mResponseQueue = NULL;
+
+	mSessionManager = new SP_SessionManager();
+
+	mTimerWheel = new SP_TimerWheel( 1000 );
+
+	mTimeout = timeout;
+}
+
+SP_UringEventArg :: ~SP_UringEventArg()
+{
+	if( NULL != mInputResultQueue ) delete mInputResultQueue;
+	mInputResultQueue = NULL;
+
+	if( NULL != mOutputResultQueue ) delete mOutputResultQueue;
+	mOutputResultQueue = NULL;
+
+	if( NULL != mResponseQueue ) delete mResponseQueue;
+	mResponseQueue = NULL;
+
+	if( NULL != mTimerWheel ) delete mTimerWheel;
+	mTimerWheel = NULL;
+
+	if( NULL != mSessionManager ) delete mSessionManager;
+	mSessionManager = NULL;
+
+	if( NULL != mUring ) delete mUring;
+	mUring = NULL;
+}
+
+SP_Uring * SP_UringEventArg :: getUring()
+{
+	return mUring;
+}
+
+SP_BlockingQueue * SP_UringEventArg :: getInputResultQueue()
+{
+	return mInputResultQueue;
+}
+
+SP_BlockingQueue * SP_UringEventArg :: getOutputResultQueue()
+{
+	return mOutputResultQueue;
+}
+
+void SP_UringEventArg :: setResponseQueue( SP_UringMsgQueue * responseQueue )
+{
+	mResponseQueue = responseQueue;
+}
+
+SP_UringMsgQueue * SP_UringEventArg :: getResponseQueue()
+{
+	return mResponseQueue;
+}
+
+SP_SessionManager * SP_UringEventArg :: getSessionManager()
+{
+	return mSessionManager;
+}
+
+SP_TimerWheel * SP_UringEventArg :: getTimerWheel()
+{
+	return mTimerWheel;
+}
+
+void SP_UringEventArg :: setTimeout( int timeout )
+{
+	mTimeout = timeout;
+}
+
+int SP_UringEventArg :: getTimeout()
+{
+	return mTimeout;
+}
+
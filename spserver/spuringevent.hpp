@@ -0,0 +1,153 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spuringevent_hpp__
+#define __spuringevent_hpp__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "spthread.hpp"
+
+typedef struct tagSP_UringCqe {
+	uint64_t mUserData;
+	int mRes;
+	unsigned int mFlags;
+} SP_UringCqe_t;
+
+// linux io_uring, used by the raw syscalls; all the methods should be called by
+// the thread of the event loop, the requests are queued and submitted by wait
+// in one batch, a multishot receive picks its buffers from the provided buffers
+class SP_Uring {
+public:
+	SP_Uring();
+	~SP_Uring();
+
+	// return 0 : OK, -1 : Fail, io_uring or one of the needed features is not supported
+	int init( int entries, int bufCount, int bufSize );
+
+	// return 0 : OK, -1 : Fail, the submission queue is full
+	int prepAccept( int fd, uint64_t userData );
+	int prepRecv( int fd, uint64_t userData );
+	int prepPoll( int fd, int events, uint64_t userData );
+	int prepRead( int fd, void * buffer, int len, uint64_t userData );
+	int prepCancel( uint64_t target, uint64_t userData );
+	int prepClose( int fd, uint64_t userData );
+
+	// submit the queued requests, wait for completions at most timeoutMsec, -1 : infinite
+	// return the number of the completions which are ready
+	int wait( int timeoutMsec );
+
+	// return 1 : a completion is taken, 0 : no more
+	int next( SP_UringCqe_t * cqe );
+
+	// the request is still alive, more completions will come
+	static int hasMore( const SP_UringCqe_t * cqe );
+
+	// return the provided buffer of the completion, -1 if no buffer
+	static int getBufferId( const SP_UringCqe_t * cqe );
+	const char * getBuffer( int bufferId );
+	void giveBack( int bufferId );
+
+private:
+	SP_Uring( SP_Uring & );
+	SP_Uring & operator=( SP_Uring & );
+
+	void * getSqe();
+
+	int mFd;
+
+	void * mRing;
+	size_t mRingSize;
+	void * mSqes;
+	size_t mSqesSize;
+
+	unsigned int * mSqHead, * mSqTail, mSqMask, mSqEntries;
+	unsigned int mSqLocalTail;
+
+	unsigned int * mCqHead, * mCqTail, mCqMask;
+	void * mCqes;
+
+	void * mBufRing;
+	size_t mBufRingSize;
+	char * mBufBase;
+	int mBufCount, mBufSize;
+	unsigned short mBufTail;
+};
+
+typedef struct tagSP_UringMsgNode SP_UringMsgNode_t;
+
+// a queue which is pushed by any thread, the event loop is woken up by an
+// eventfd which is read by the ring; lock-free like event_msgqueue, the
+// producers push onto a CAS-linked stack and the event loop takes it at once
+class SP_UringMsgQueue {
+public:
+	typedef void ( * QueueFunc_t ) ( void * queueData, void * arg );
+
+	SP_UringMsgQueue( SP_Uring * uring, QueueFunc_t func, void * arg );
+	~SP_UringMsgQueue();
+
+	int push( void * queueData );
+
+	// queue a read of the eventfd, the completion carries userData
+	int arm( uint64_t userData );
+
+	int process();
+
+private:
+	SP_Uring * mUring;
+	QueueFunc_t mFunc;
+	void * mArg;
+
+	int mEventFd;
+	uint64_t mCounter;
+
+	SP_UringMsgNode_t * volatile mHead;
+};
+
+class SP_BlockingQueue;
+class SP_SessionManager;
+class SP_TimerWheel;
+
+class SP_UringEventArg {
+public:
+	enum { eEntries = 4096, eBufCount = 1024, eBufSize = 8192 };
+
+	SP_UringEventArg( int timeout );
+	~SP_UringEventArg();
+
+	// NULL if the ring cannot be created
+	SP_Uring * getUring();
+
+	SP_BlockingQueue * getInputResultQueue();
+	SP_BlockingQueue * getOutputResultQueue();
+
+	void setResponseQueue( SP_UringMsgQueue * responseQueue );
+	SP_UringMsgQueue * getResponseQueue();
+
+	SP_SessionManager * getSessionManager();
+
+	// the idle timeouts of the sessions
+	SP_TimerWheel * getTimerWheel();
+
+	void setTimeout( int timeout );
+	int getTimeout();
+
+private:
+	SP_Uring * mUring;
+
+	SP_BlockingQueue * mInputResultQueue;
+	SP_BlockingQueue * mOutputResultQueue;
+	SP_UringMsgQueue * mResponseQueue;
+
+	SP_SessionManager * mSessionManager;
+
+	SP_TimerWheel * mTimerWheel;
+
+	int mTimeout;
+};
+
+#endif
+
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "spporting.hpp"
+
+#include "spuringserver.hpp"
+#include "spuringcb.hpp"
+#include "sphandler.hpp"
+#include "spsession.hpp"
+#include "spexecutor.hpp"
+#include "sputils.hpp"
+#include "spioutils.hpp"
+
+SP_UringServer :: SP_UringServer( const char * bindIP, int port,
+		SP_HandlerFactory * handlerFactory )
+{
+	snprintf( mBindIP, sizeof( mBindIP ), "%s", bindIP );
+	mPort = port;
+	mIsShutdown = 0;
+	mIsRunning = 0;
+
+	mHandlerFactory = handlerFactory;
+
+	mTimeout = 600;
+	mMaxThreads = 4;
+	mReqQueueSize = 128;
+	mMaxConnections = 256;
+	mRefusedMsg = strdup( "System busy, try again later." );
+
+	mResponseQueue = NULL;
+}
+
+SP_UringServer :: ~SP_UringServer()
+{
+	shutdown();
+
+	for( ; mIsRunning; ) {
+		shutdown();
+		sleep( 1 );
+	}
+
+	if( NULL != mHandlerFactory ) delete mHandlerFactory;
+	mHandlerFactory = NULL;
+
+	if( NULL != mRefusedMsg ) free( mRefusedMsg );
+	mRefusedMsg = NULL;
+}
+
+void SP_UringServer :: setTimeout( int timeout )
+{
+	mTimeout = timeout;
+}
+
+void SP_UringServer :: setMaxThreads( int maxThreads )
+{
+	mMaxThreads = maxThreads > 0 ? maxThreads : mMaxThreads;
+}
+
+void SP_UringServer :: setMaxConnections( int maxConnections )
+{
+	mMaxConnections = maxConnections > 0 ? maxConnections : mMaxConnections;
+}
+
+void SP_UringServer :: setReqQueueSize( int reqQueueSize, const char * refusedMsg )
+{
+	mReqQueueSize = reqQueueSize > 0 ? reqQueueSize : mReqQueueSize;
+
+	if( NULL != mRefusedMsg ) free( mRefusedMsg );
+	mRefusedMsg = strdup( refusedMsg );
+}
+
+void SP_UringServer :: shutdown()
+{
+	mIsShutdown = 1;
+
+	// wake up the event loop
+	if( NULL != mResponseQueue ) mResponseQueue->push( NULL );
+}
+
+int SP_UringServer :: isRunning()
+{
+	return mIsRunning;
+}
+
+int SP_UringServer :: run()
+{
+	int ret = -1;
+
+	sp_thread_attr_t attr;
+	sp_thread_attr_init( &attr );
+	assert( sp_thread_attr_setstacksize( &attr, 1024 * 1024 ) == 0 );
+	sp_thread_attr_setdetachstate( &attr, SP_THREAD_CREATE_DETACHED );
+
+	sp_thread_t thread;
+	ret = sp_thread_create( &thread, &attr, eventLoop, this );
+	sp_thread_attr_destroy( &attr );
+	if( 0 == ret ) {
+		sp_syslog( LOG_NOTICE, "Thread #%ld has been created to listen on port [%d]", thread, mPort );
+	} else {
+		mIsRunning = 0;
+		sp_syslog( LOG_WARNING, "Unable to create a thread for TCP server on port [%d], %s",
+			mPort, strerror( errno ) ) ;
+	}
+
+	return ret;
+}
+
+void SP_UringServer :: runForever()
+{
+	eventLoop( this );
+}
+
+sp_thread_result_t SP_THREAD_CALL SP_UringServer :: eventLoop( void * arg )
+{
+	SP_UringServer * server = (SP_UringServer*)arg;
+
+	server->mIsRunning = 1;
+
+	server->start();
+
+	server->mIsRunning = 0;
+
+	return NULL;
+}
+
+void SP_UringServer :: outputCompleted( void * arg )
+{
+	SP_CompletionHandler * handler = ( SP_CompletionHandler * ) ((void**)arg)[0];
+	SP_Message * msg = ( SP_Message * ) ((void**)arg)[ 1 ];
+
+	handler->completionMessage( msg );
+
+	free( arg );
+}
+
+int SP_UringServer :: start()
+{
+#ifdef SIGPIPE
+	/* Don't die with SIGPIPE on remote read shutdown. That's dumb. */
+	signal( SIGPIPE, SIG_IGN );
+#endif
+
+	int ret = 0;
+	int listenFD = -1;
+
+	ret = SP_IOUtils::tcpListen( mBindIP, mPort, &listenFD, 0 );
+
+	if( 0 == ret ) {
+
+		SP_UringEventArg eventArg( mTimeout );
+
+		if( NULL == eventArg.getUring() ) {
+			sp_syslog( LOG_ERR, "Cannot create io_uring, server is not started" );
+			sp_close( listenFD );
+			return -1;
+		}
+
+		SP_UringMsgQueue * msgQueue = new SP_UringMsgQueue( eventArg.getUring(),
+				SP_UringEventCallback::onResponse, &eventArg );
+		eventArg.setResponseQueue( msgQueue );
+		SP_UringEventCallback::addMsgQueue( msgQueue );
+
+		SP_UringAcceptArg_t acceptArg;
+		memset( &acceptArg, 0, sizeof( acceptArg ) );
+
+		acceptArg.mHandlerFactory = mHandlerFactory;
+		acceptArg.mReqQueueSize = mReqQueueSize;
+		acceptArg.mMaxConnections = mMaxConnections;
+		acceptArg.mRefusedMsg = mRefusedMsg;
+
+		acceptArg.mEventArg = &eventArg;
+		acceptArg.mListenFd = listenFD;
+
+		// one multishot accept for all the connections
+		SP_UringEventCallback::addAccept( &acceptArg );
+
+		mResponseQueue = msgQueue;
+
+		SP_Executor actExecutor( 1, "act" );
+		SP_Executor workerExecutor( mMaxThreads, "work" );
+		SP_CompletionHandler * completionHandler = mHandlerFactory->createCompletionHandler();
+
+		/* Start the event loop. */
+		while( 0 == mIsShutdown ) {
+			SP_UringEventCallback::eventLoop( &eventArg, &acceptArg );
+
+			for( ; NULL != eventArg.getInputResultQueue()->top(); ) {
+				SP_Task * task = (SP_Task*)eventArg.getInputResultQueue()->pop();
+				workerExecutor.execute( task );
+			}
+
+			for( ; NULL != eventArg.getOutputResultQueue()->top(); ) {
+				SP_Message * msg = (SP_Message*)eventArg.getOutputResultQueue()->pop();
+
+				void ** arg = ( void** )malloc( sizeof( void * ) * 2 );
+				arg[ 0 ] = (void*)completionHandler;
+				arg[ 1 ] = (void*)msg;
+
+				actExecutor.execute( outputCompleted, arg );
+			}
+		}
+
+		mResponseQueue = NULL;
+
+		delete completionHandler;
+
+		sp_syslog( LOG_NOTICE, "Server is shutdown." );
+
+		sp_close( listenFD );
+	}
+
+	return ret;
+}
+
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#ifndef __spuringserver_hpp__
+#define __spuringserver_hpp__
+
+#include "spthread.hpp"
+
+class SP_HandlerFactory;
+class SP_UringMsgQueue;
+
+// half-sync/half-async thread pool server on linux io_uring, a proactor like
+// SP_IocpServer; the data is received into the provided buffers of the ring,
+// so the sessions always use SP_DefaultIOChannel
+class SP_UringServer {
+public:
+	SP_UringServer( const char * bindIP, int port, SP_HandlerFactory * handlerFactory );
+	~SP_UringServer();
+
+	void setTimeout( int timeout );
+	void setMaxConnections( int maxConnections );
+	void setMaxThreads( int maxThreads );
+	void setReqQueueSize( int reqQueueSize, const char * refusedMsg );
+
+	void shutdown();
+	int isRunning();
+	int run();
+	void runForever();
+
+private:
+	SP_HandlerFactory * mHandlerFactory;
+
+	SP_UringMsgQueue * mResponseQueue;
+	char mBindIP[ 64 ];
+	int mPort;
+	int mIsShutdown;
+	int mIsRunning;
+
+	int mTimeout;
+	int mMaxThreads;
+	int mMaxConnections;
+	int mReqQueueSize;
+	char * mRefusedMsg;
+
+	static sp_thread_result_t SP_THREAD_CALL eventLoop( void * arg );
+
+	int start();
+
+	static void outputCompleted( void * arg );
+};
+
+#endif
+
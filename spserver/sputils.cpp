@@ -157,15 +157,148 @@ int SP_CircleQueue :: getLength()
 
 //-------------------------------------------------------------------
 
-SP_BlockingQueue :: SP_BlockingQueue()
+SP_RingQueue :: SP_RingQueue( int type, int capacity )
 {
+	mType = type;
+
+	unsigned long size = 2;
+	for( ; (int)size < capacity; ) size = size << 1;
+
+	mMask = size - 1;
+	mCells = (Cell_t*)malloc( sizeof( Cell_t ) * size );
+	for( unsigned long i = 0; i < size; i++ ) {
+		mCells[ i ].mSeq = (long)i;
+		mCells[ i ].mItem = NULL;
+	}
+
+	mHead = mTail = 0;
+}
+
+SP_RingQueue :: ~SP_RingQueue()
+{
+	free( mCells );
+	mCells = NULL;
+}
+
+int SP_RingQueue :: push( void * item )
+{
+	Cell_t * cell = NULL;
+	long pos = mTail;
+
+	for( ; ; ) {
+		cell = &( mCells[ pos & mMask ] );
+		long diff = (long)( (unsigned long)sp_atomic_get( &cell->mSeq ) - (unsigned long)pos );
+
+		if( 0 == diff ) {
+			if( eSPSC == mType ) {
+				mTail = pos + 1;
+				break;
+			}
+			if( sp_atomic_cas( &mTail, pos, pos + 1 ) ) break;
+			pos = mTail;
+		} else if( diff < 0 ) {
+			return -1;
+		} else {
+			pos = mTail;
+		}
+	}
+
+	cell->mItem = item;
+
+	// publish the item, mSeq becomes pos + 1
+	sp_atomic_add( &cell->mSeq, 1 );
+
+	return 0;
+}
+
+void * SP_RingQueue :: pop()
+{
+	Cell_t * cell = NULL;
+	long pos = mHead;
+
+	for( ; ; ) {
+		cell = &( mCells[ pos & mMask ] );
+		long diff = (long)( (unsigned long)sp_atomic_get( &cell->mSeq ) - (unsigned long)( pos + 1 ) );
+
+		if( 0 == diff ) {
+			if( eSPSC == mType ) {
+				mHead = pos + 1;
+				break;
+			}
+			if( sp_atomic_cas( &mHead, pos, pos + 1 ) ) break;
+			pos = mHead;
+		} else if( diff < 0 ) {
+			return NULL;
+		} else {
+			pos = mHead;
+		}
+	}
+
+	void * item = cell->mItem;
+
+	// release the cell for the next round, mSeq becomes pos + mMask + 1
+	sp_atomic_add( &cell->mSeq, (long)mMask );
+
+	return item;
+}
+
+void * SP_RingQueue :: top()
+{
+	long pos = mHead;
+	Cell_t * cell = &( mCells[ pos & mMask ] );
+
+	if( sp_atomic_get( &cell->mSeq ) == pos + 1 ) return cell->mItem;
+
+	return NULL;
+}
+
+int SP_RingQueue :: getLength()
+{
+	long len = sp_atomic_get( &mTail ) - sp_atomic_get( &mHead );
+
+	return len > 0 ? (int)len : 0;
+}
+
+int SP_RingQueue :: getCapacity()
+{
+	return (int)( mMask + 1 );
+}
+
+//-------------------------------------------------------------------
+
+#if defined( __linux__ ) && !defined( SP_NO_FUTEX )
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define HAVE_FUTEX 1
+
+#endif
+
+SP_BlockingQueue :: SP_BlockingQueue( int type, int capacity )
+{
+	mType = type;
+	mRing = NULL;
+
+	if( eSPSC == mType ) {
+		mRing = new SP_RingQueue( SP_RingQueue::eSPSC, capacity );
+	} else if( eMPMC == mType ) {
+		mRing = new SP_RingQueue( SP_RingQueue::eMPMC, capacity );
+	} else {
+		mType = eMutex;
+	}
+
 	mQueue = new SP_CircleQueue();
 	sp_thread_mutex_init( &mMutex, NULL );
 	sp_thread_cond_init( &mCond, NULL );
+
+	mOverflow = mWaiters = mSignal = 0;
 }
 
 SP_BlockingQueue :: ~SP_BlockingQueue()
 {
+	if( NULL != mRing ) delete mRing;
 	delete mQueue;
 	sp_thread_mutex_destroy( &mMutex );
 	sp_thread_cond_destroy( &mCond );
@@ -173,36 +306,114 @@ SP_BlockingQueue :: ~SP_BlockingQueue()
 
 void SP_BlockingQueue :: push( void * item )
 {
-	sp_thread_mutex_lock( &mMutex );
+	if( eMutex == mType ) {
+		sp_thread_mutex_lock( &mMutex );
 
-	mQueue->push( item );
+		mQueue->push( item );
 
-	sp_thread_cond_signal( &mCond );
+		sp_thread_cond_signal( &mCond );
 
-	sp_thread_mutex_unlock( &mMutex );
+		sp_thread_mutex_unlock( &mMutex );
+
+		return;
+	}
+
+	// once the ring is full, keep spilling until the overflow queue is drained
+	if( 0 != sp_atomic_get( &mOverflow ) || 0 != mRing->push( item ) ) {
+		sp_thread_mutex_lock( &mMutex );
+		mQueue->push( item );
+		sp_atomic_add( &mOverflow, 1 );
+		sp_thread_mutex_unlock( &mMutex );
+	}
+
+	if( sp_atomic_get( &mWaiters ) > 0 ) wakeup();
 }
 
 void * SP_BlockingQueue :: pop()
 {
 	void * ret = NULL;
 
-	sp_thread_mutex_lock( &mMutex );
+	if( eMutex == mType ) {
+		sp_thread_mutex_lock( &mMutex );
 
-	if( mQueue->getLength() == 0 ) {
-		sp_thread_cond_wait( &mCond, &mMutex );
+		if( mQueue->getLength() == 0 ) {
+			sp_thread_cond_wait( &mCond, &mMutex );
+		}
+
+		ret = mQueue->pop();
+
+		sp_thread_mutex_unlock( &mMutex );
+
+		return ret;
 	}
 
-	ret = mQueue->pop();
+	for( ; NULL == ( ret = tryPop() ); ) park();
 
-	sp_thread_mutex_unlock( &mMutex );
+	return ret;
+}
+
+void * SP_BlockingQueue :: tryPop()
+{
+	void * ret = mRing->pop();
+
+	if( NULL == ret && sp_atomic_get( &mOverflow ) > 0 ) {
+		sp_thread_mutex_lock( &mMutex );
+		ret = mQueue->pop();
+		if( NULL != ret ) sp_atomic_add( &mOverflow, -1 );
+		sp_thread_mutex_unlock( &mMutex );
+	}
 
 	return ret;
 }
 
+void SP_BlockingQueue :: park()
+{
+	// read the signal before checking the queue, a push after the check will change it
+	int signal = sp_atomic_get( &mSignal );
+
+	sp_atomic_add( &mWaiters, 1 );
+
+	if( NULL == top() ) {
+#ifdef HAVE_FUTEX
+		syscall( SYS_futex, &mSignal, FUTEX_WAIT_PRIVATE, signal, NULL, NULL, 0 );
+#else
+		sp_thread_mutex_lock( &mMutex );
+		if( signal == mSignal ) sp_thread_cond_wait( &mCond, &mMutex );
+		sp_thread_mutex_unlock( &mMutex );
+#endif
+	}
+
+	sp_atomic_add( &mWaiters, -1 );
+}
+
+void SP_BlockingQueue :: wakeup()
+{
+#ifdef HAVE_FUTEX
+	sp_atomic_add( &mSignal, 1 );
+	syscall( SYS_futex, &mSignal, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+#else
+	sp_thread_mutex_lock( &mMutex );
+	sp_atomic_add( &mSignal, 1 );
+	sp_thread_cond_signal( &mCond );
+	sp_thread_mutex_unlock( &mMutex );
+#endif
+}
+
 void * SP_BlockingQueue :: top()
 {
 	void * ret = NULL;
 
+	if( eMutex != mType ) {
+		ret = mRing->top();
+		if( NULL == ret && sp_atomic_get( &mOverflow ) > 0 ) {
+			sp_thread_mutex_lock( &mMutex );
+			ret = mQueue->top();
+			sp_thread_mutex_unlock( &mMutex );
+		}
+
+		return ret;
+	}
+
 	sp_thread_mutex_lock( &mMutex );
 
 	ret = mQueue->top();
@@ -216,6 +427,10 @@ int SP_BlockingQueue :: getLength()
 {
 	int len = 0;
 
+	if( eMutex != mType ) {
+		return mRing->getLength() + sp_atomic_get( &mOverflow );
+	}
+
 	sp_thread_mutex_lock( &mMutex );
 
 	len = mQueue->getLength();
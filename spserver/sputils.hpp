@@ -49,9 +49,57 @@ private:
 	unsigned int mMaxCount;
 };
 
+// bounded lock-free ring, based on Dmitry Vyukov's bounded MPMC queue
+class SP_RingQueue {
+public:
+	enum { eSPSC = 0, eMPMC = 1 };
+
+	// capacity is rounded up to power of 2
+	SP_RingQueue( int type, int capacity );
+	~SP_RingQueue();
+
+	// non-blocking, if full then return -1
+	int push( void * item );
+
+	// non-blocking, if empty then return NULL
+	void * pop();
+
+	// only can be called by the consumer, if empty then return NULL
+	void * top();
+
+	int getLength();
+	int getCapacity();
+
+private:
+	SP_RingQueue( SP_RingQueue & );
+	SP_RingQueue & operator=( SP_RingQueue & );
+
+	typedef struct tagCell {
+		volatile long mSeq;
+		void * mItem;
+	} Cell_t;
+
+	int mType;
+	unsigned long mMask;
+	Cell_t * mCells;
+
+	// keep the producer and the consumer index in different cache lines
+	char mPad0[ 64 ];
+	volatile long mTail;
+	char mPad1[ 64 ];
+	volatile long mHead;
+	char mPad2[ 64 ];
+};
+
 class SP_BlockingQueue {
 public:
-	SP_BlockingQueue();
+	// eMutex  : mutex and condvar protected queue, unbounded
+	// eSPSC   : lock-free ring, one producer thread and one consumer thread
+	// eMPMC   : lock-free ring, any thread can push and pop
+	// a full ring spills items to a mutex protected queue
+	enum { eMutex = 0, eSPSC = 1, eMPMC = 2 };
+
+	SP_BlockingQueue( int type = eMutex, int capacity = 4096 );
 	virtual ~SP_BlockingQueue();
 
 	// non-blocking
@@ -67,9 +115,21 @@ public:
 	int getLength();
 
 private:
+	void * tryPop();
+	void park();
+	void wakeup();
+
+	int mType;
+	SP_RingQueue * mRing;
+
 	SP_CircleQueue * mQueue;
 	sp_thread_mutex_t mMutex;
 	sp_thread_cond_t mCond;
+
+	// for lock-free mode
+	volatile int mOverflow;
+	volatile int mWaiters;
+	volatile int mSignal;
 };
 
 int sp_strtok( const char * src, int index, char * dest, int len,
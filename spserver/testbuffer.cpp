@@ -0,0 +1,115 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "spporting.hpp"
+#include "spgetopt.h"
+#include "spbuffer.hpp"
+
+typedef const void * ( SP_Buffer::*Accessor_t )() const;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// outbound: a message of exactly 2^n bytes, the accessor is called once per write attempt
+static void testOutbound( const char * name, Accessor_t accessor, int loops, int writes )
+{
+	char chunk[ 4096 ];
+	memset( chunk, 'o', sizeof( chunk ) );
+
+	int moves = 0;
+	double begin = now();
+
+	for( int i = 0; i < loops; i++ ) {
+		SP_Buffer buffer;
+
+		int size = 64 * 1024 << ( i % 5 );
+		for( int len = 0; len < size; len += sizeof( chunk ) ) {
+			buffer.append( chunk, sizeof( chunk ) );
+		}
+
+		int capacity = buffer.getCapacity();
+		for( int j = 0; j < writes; j++ ) {
+			( buffer.*accessor )();
+			if( capacity != buffer.getCapacity() ) moves++;
+			capacity = buffer.getCapacity();
+		}
+	}
+
+	printf( "outbound %-12s : %d loops, %d reallocations, %.3f seconds\n",
+			name, loops, moves, now() - begin );
+}
+
+// inbound: a full buffer with a consumed head, the accessor is called once per decode
+static void testInbound( const char * name, Accessor_t accessor, int loops )
+{
+	char chunk[ 4096 ];
+	memset( chunk, 'i', sizeof( chunk ) );
+
+	int moves = 0;
+	double begin = now();
+
+	SP_Buffer buffer;
+
+	for( int i = 0; i < loops; i++ ) {
+		buffer.reset();
+
+		for( ; buffer.getSize() + sizeof( chunk ) <= (size_t)buffer.getCapacity()
+				|| buffer.getSize() < 256 * 1024; ) {
+			buffer.append( chunk, sizeof( chunk ) );
+		}
+		int room = buffer.getCapacity() - buffer.getSize();
+		if( room > 0 ) buffer.append( chunk, room );
+
+		// the decoder consumed one request, the rest stays in the buffer
+		buffer.erase( 512 );
+
+		const void * prev = buffer.getRawBuffer();
+		const void * data = ( buffer.*accessor )();
+		if( data != prev ) moves++;
+	}
+
+	printf( "inbound  %-12s : %d loops, %d memmoves, %.3f seconds\n",
+			name, loops, moves, now() - begin );
+}
+
+int main( int argc, char * argv[] )
+{
+	int loops = 1000, writes = 16;
+
+	extern char *optarg ;
+	int c ;
+
+	while( ( c = getopt ( argc, argv, "l:w:v" )) != EOF ) {
+		switch ( c ) {
+			case 'l' :
+				loops = atoi( optarg );
+				break;
+			case 'w':
+				writes = atoi( optarg );
+				break;
+			case '?' :
+			case 'v' :
+				printf( "Usage: %s [-l <loops>] [-w <writes per message>]\n", argv[0] );
+				exit( 0 );
+		}
+	}
+
+	testOutbound( "getBuffer", &SP_Buffer::getBuffer, loops, writes );
+	testOutbound( "getRawBuffer", &SP_Buffer::getRawBuffer, loops, writes );
+
+	testInbound( "getBuffer", &SP_Buffer::getBuffer, loops );
+	testInbound( "getRawBuffer", &SP_Buffer::getRawBuffer, loops );
+
+	return 0;
+}
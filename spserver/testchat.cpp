@@ -297,13 +297,13 @@ SP_CompletionHandler * SP_ChatHandlerFactory :: createCompletionHandler() const
 
 int main( int argc, char * argv[] )
 {
-	int port = 5555, maxThreads = 10;
+	int port = 5555, maxThreads = 10, reactorCount = 1, reusePort = 0;
 	const char * serverType = "hahs";
 
 	extern char *optarg ;
 	int c ;
 
-	while( ( c = getopt ( argc, argv, "p:t:s:v" )) != EOF ) {
+	while( ( c = getopt ( argc, argv, "p:t:s:r:uv" )) != EOF ) {
 		switch ( c ) {
 			case 'p' :
 				port = atoi( optarg );
@@ -314,9 +314,15 @@ int main( int argc, char * argv[] )
 			case 's':
 				serverType = optarg;
 				break;
+			case 'r':
+				reactorCount = atoi( optarg );
+				break;
+			case 'u':
+				reusePort = 1;
+				break;
 			case '?' :
 			case 'v' :
-				printf( "Usage: %s [-p <port>] [-t <threads>] [-s <hahs|lf>]\n", argv[0] );
+				printf( "Usage: %s [-p <port>] [-t <threads>] [-s <hahs|lf>] [-r <reactors>] [-u]\n", argv[0] );
 				exit( 0 );
 		}
 	}
@@ -333,6 +339,8 @@ int main( int argc, char * argv[] )
 		server.setTimeout( 60 );
 		server.setMaxThreads( maxThreads );
 		server.setReqQueueSize( 100, "Sorry, server is busy now!\n" );
+		server.setReactorCount( reactorCount );
+		server.setReusePort( reusePort );
 
 		server.runForever();
 	} else {
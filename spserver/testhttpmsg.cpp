@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/time.h>
 
 #include "sphttpmsg.hpp"
 
@@ -42,13 +44,77 @@ void printResponse( SP_HttpResponse * response )
 	printMessage( response );
 }
 
+static double getTime()
+{
+	struct timeval now;
+	gettimeofday( &now, NULL );
+
+	return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+// the lookup before the header index, for comparison
+static const char * scanHeaderValue( SP_HttpMessage * message, const char * name )
+{
+	for( int i = 0; i < message->getHeaderCount(); i++ ) {
+		if( 0 == strcasecmp( name, message->getHeaderName( i ) ) ) {
+			return message->getHeaderValue( i );
+		}
+	}
+
+	return NULL;
+}
+
+// the lookups of SP_HttpHandlerAdapter::handle on a response with 20 headers
+void benchmark()
+{
+	SP_HttpResponse response;
+
+	char name[ 64 ] = { 0 };
+	for( int i = 0; i < 16; i++ ) {
+		snprintf( name, sizeof( name ), "X-Header-%d", i );
+		response.addHeader( name, "value" );
+	}
+	response.addHeader( SP_HttpMessage::HEADER_CONNECTION, "Keep-Alive" );
+	response.addHeader( SP_HttpMessage::HEADER_CONTENT_LENGTH, "1024" );
+	response.addHeader( SP_HttpMessage::HEADER_DATE, "Thu, 01 Jan 1970 00:00:00 GMT" );
+	response.addHeader( SP_HttpMessage::HEADER_SERVER, "sphttp/spserver" );
+
+	const char * names[] = { SP_HttpMessage::HEADER_CONNECTION,
+		SP_HttpMessage::HEADER_CONTENT_LENGTH, SP_HttpMessage::HEADER_DATE,
+		SP_HttpMessage::HEADER_CONTENT_TYPE, SP_HttpMessage::HEADER_SERVER,
+		"content-length", "X-Header-15" };
+	int count = sizeof( names ) / sizeof( names[0] ), loops = 1000000;
+
+	for( int i = 0; i < count; i++ ) {
+		double begin = getTime();
+		long found = 0;
+		for( int j = 0; j < loops; j++ ) {
+			if( NULL != scanHeaderValue( &response, names[i] ) ) found++;
+		}
+		double scan = getTime() - begin;
+
+		begin = getTime();
+		for( int j = 0; j < loops; j++ ) {
+			if( NULL != response.getHeaderValue( names[i] ) ) found++;
+		}
+		double index = getTime() - begin;
+
+		printf( "%-18s scan %6.1f ns, index %6.1f ns, found %ld\n", names[i],
+				scan * 1000000000 / loops, index * 1000000000 / loops, found / 2 );
+	}
+}
+
 int main( int argc, char * argv[] )
 {
 	char * filename = NULL;
 
 	if( argc < 2 ) {
 		printf( "Usage: %s <file>\n", argv[0] );
+		printf( "       %s -b : benchmark the header lookups\n", argv[0] );
 		exit( -1 );
+	} else if( 0 == strcmp( argv[1], "-b" ) ) {
+		benchmark();
+		return 0;
 	} else {
 		filename = argv[1];
 	}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spporting.hpp"
+#include "spthread.hpp"
+#include "spgetopt.h"
+
+#include "spmsgdecoder.hpp"
+#include "spbuffer.hpp"
+
+#include "spserver.hpp"
+#include "sphandler.hpp"
+#include "spresponse.hpp"
+#include "sprequest.hpp"
+
+// the sessions are spread over the reactors, a message sent to all of them
+// is forwarded to every reactor and must be completed exactly once
+
+enum { eMaxMsgs = 1000 };
+
+typedef struct tagSP_TestState {
+	sp_thread_mutex_t mMutex;
+	SP_SidList mOnline;
+	int mMsgSeq;
+
+	int mCompleted[ eMaxMsgs ];
+	int mSuccess[ eMaxMsgs ];
+	int mFailure[ eMaxMsgs ];
+} SP_TestState_t;
+
+static SP_TestState_t gState;
+
+//---------------------------------------------------------
+
+class SP_BroadcastHandler : public SP_Handler {
+public:
+	SP_BroadcastHandler() {}
+	virtual ~SP_BroadcastHandler() {}
+
+	virtual int start( SP_Request * request, SP_Response * response ) {
+		request->setMsgDecoder( new SP_LineMsgDecoder() );
+		response->getReply()->getMsg()->append( "hello\r\n" );
+
+		sp_thread_mutex_lock( &gState.mMutex );
+		gState.mOnline.add( response->getFromSid() );
+		sp_thread_mutex_unlock( &gState.mMutex );
+
+		return 0;
+	}
+
+	virtual int handle( SP_Request * request, SP_Response * response ) {
+		SP_Message * msg = new SP_Message();
+
+		sp_thread_mutex_lock( &gState.mMutex );
+		for( int i = 0; i < gState.mOnline.getCount(); i++ ) {
+			msg->getToList()->add( gState.mOnline.get( i ) );
+		}
+		msg->setCompletionKey( ++gState.mMsgSeq );
+		sp_thread_mutex_unlock( &gState.mMutex );
+
+		msg->getMsg()->append( "bcast\r\n" );
+		response->addMessage( msg );
+
+		return 0;
+	}
+
+	virtual void error( SP_Response * response ) {}
+
+	virtual void timeout( SP_Response * response ) {}
+
+	virtual void close() {}
+};
+
+class SP_CountCompletionHandler : public SP_CompletionHandler {
+public:
+	SP_CountCompletionHandler() {}
+	virtual ~SP_CountCompletionHandler() {}
+
+	virtual void completionMessage( SP_Message * msg ) {
+		int key = msg->getCompletionKey();
+
+		// the replies of start have no key
+		if( key > 0 && key < eMaxMsgs ) {
+			sp_thread_mutex_lock( &gState.mMutex );
+			gState.mCompleted[ key ]++;
+			gState.mSuccess[ key ] += msg->getSuccess()->getCount();
+			gState.mFailure[ key ] += msg->getFailure()->getCount();
+			sp_thread_mutex_unlock( &gState.mMutex );
+		}
+
+		delete msg;
+	}
+};
+
+class SP_BroadcastHandlerFactory : public SP_HandlerFactory {
+public:
+	SP_BroadcastHandlerFactory() {}
+	virtual ~SP_BroadcastHandlerFactory() {}
+
+	virtual SP_Handler * create() const {
+		return new SP_BroadcastHandler();
+	}
+
+	virtual SP_CompletionHandler * createCompletionHandler() const {
+		return new SP_CountCompletionHandler();
+	}
+};
+
+//---------------------------------------------------------
+
+static int readLines( int fd, int lines )
+{
+	char buffer[ 4096 ];
+
+	for( int count = 0; count < lines; ) {
+		int len = recv( fd, buffer, sizeof( buffer ), 0 );
+		if( len <= 0 ) return -1;
+
+		for( int i = 0; i < len; i++ ) {
+			if( '\n' == buffer[ i ] ) count++;
+		}
+	}
+
+	return 0;
+}
+
+static int getOnlineCount()
+{
+	sp_thread_mutex_lock( &gState.mMutex );
+	int count = gState.mOnline.getCount();
+	sp_thread_mutex_unlock( &gState.mMutex );
+
+	return count;
+}
+
+int main( int argc, char * argv[] )
+{
+	int port = 5566, reactorCount = 4, clientCount = 8, msgCount = 100;
+
+	extern char *optarg ;
+	int c ;
+
+	while( ( c = getopt ( argc, argv, "p:r:c:m:v" )) != EOF ) {
+		switch ( c ) {
+			case 'p' :
+				port = atoi( optarg );
+				break;
+			case 'r':
+				reactorCount = atoi( optarg );
+				break;
+			case 'c':
+				clientCount = atoi( optarg );
+				break;
+			case 'm':
+				msgCount = atoi( optarg );
+				break;
+			case '?' :
+			case 'v' :
+				printf( "Usage: %s [-p <port>] [-r <reactors>] [-c <clients>] [-m <messages>]\n", argv[0] );
+				exit( 0 );
+		}
+	}
+
+	if( msgCount >= eMaxMsgs ) msgCount = eMaxMsgs - 1;
+
+	sp_openlog( "testreactor", LOG_CONS | LOG_PID, LOG_USER );
+
+	assert( 0 == sp_initsock() );
+
+	memset( gState.mCompleted, 0, sizeof( gState.mCompleted ) );
+	memset( gState.mSuccess, 0, sizeof( gState.mSuccess ) );
+	memset( gState.mFailure, 0, sizeof( gState.mFailure ) );
+	gState.mMsgSeq = 0;
+	sp_thread_mutex_init( &gState.mMutex, NULL );
+
+	SP_Server server( "127.0.0.1", port, new SP_BroadcastHandlerFactory() );
+	server.setTimeout( 60 );
+	server.setMaxThreads( 4 );
+	server.setReactorCount( reactorCount );
+
+	if( 0 != server.run() ) return 1;
+	sleep( 1 );
+
+	int * fds = (int*)malloc( sizeof( int ) * clientCount );
+
+	for( int i = 0; i < clientCount; i++ ) {
+		struct sockaddr_in addr;
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( port );
+		addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+
+		fds[ i ] = socket( AF_INET, SOCK_STREAM, 0 );
+		if( 0 != connect( fds[ i ], (struct sockaddr*)&addr, sizeof( addr ) )
+				|| 0 != readLines( fds[ i ], 1 ) ) {
+			printf( "FAIL: cannot connect client %d\n", i );
+			return 1;
+		}
+	}
+
+	for( int i = 0; i < 50 && getOnlineCount() < clientCount; i++ ) usleep( 10 * 1000 );
+
+	// every line sent by the first client is broadcast to all the clients
+	for( int i = 0; i < msgCount; i++ ) send( fds[ 0 ], "go\r\n", 4, 0 );
+
+	for( int i = 0; i < clientCount; i++ ) {
+		if( 0 != readLines( fds[ i ], msgCount ) ) {
+			printf( "FAIL: client %d lost the broadcast\n", i );
+			return 1;
+		}
+	}
+
+	// give the extra completions, if any, a chance to show up
+	sleep( 1 );
+
+	int errors = 0;
+
+	sp_thread_mutex_lock( &gState.mMutex );
+	for( int key = 1; key <= msgCount; key++ ) {
+		if( 1 != gState.mCompleted[ key ] || clientCount != gState.mSuccess[ key ]
+				|| 0 != gState.mFailure[ key ] ) {
+			if( errors++ < 10 ) {
+				printf( "FAIL: message %d completed %d times, success %d, failure %d\n",
+						key, gState.mCompleted[ key ], gState.mSuccess[ key ], gState.mFailure[ key ] );
+			}
+		}
+	}
+	sp_thread_mutex_unlock( &gState.mMutex );
+
+	printf( "%s: %d messages to %d clients on %d reactors, %d errors\n",
+			0 == errors ? "PASS" : "FAIL", msgCount, clientCount, reactorCount, errors );
+
+	for( int i = 0; i < clientCount; i++ ) sp_close( fds[ i ] );
+	free( fds );
+
+	server.shutdown();
+	for( int i = 0; i < 50 && server.isRunning(); i++ ) usleep( 100 * 1000 );
+
+	sp_closelog();
+
+	return 0 == errors ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2008 Stephen Liu
+ * For license terms, see the file COPYING along with this library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+
+#include "spporting.hpp"
+
+#include "spmsgdecoder.hpp"
+#include "spbuffer.hpp"
+
+#include "spuringserver.hpp"
+#include "sphandler.hpp"
+#include "spresponse.hpp"
+#include "sprequest.hpp"
+#include "sputils.hpp"
+
+class SP_EchoHandler : public SP_Handler {
+public:
+	SP_EchoHandler(){}
+	virtual ~SP_EchoHandler(){}
+
+	// return -1 : terminate session, 0 : continue
+	virtual int start( SP_Request * request, SP_Response * response ) {
+		request->setMsgDecoder( new SP_MultiLineMsgDecoder() );
+		response->getReply()->getMsg()->append(
+			"Welcome to line echo server, enter 'quit' to quit.\r\n" );
+
+		return 0;
+	}
+
+	// return -1 : terminate session, 0 : continue
+	virtual int handle( SP_Request * request, SP_Response * response ) {
+		SP_MultiLineMsgDecoder * decoder = (SP_MultiLineMsgDecoder*)request->getMsgDecoder();
+		SP_CircleQueue * queue = decoder->getQueue();
+
+		int ret = 0;
+		for( ; NULL != queue->top(); ) {
+			char * line = (char*)queue->pop();
+
+			if( 0 != strcasecmp( line, "quit" ) ) {
+				response->getReply()->getMsg()->append( line );
+				response->getReply()->getMsg()->append( "\r\n" );
+			} else {
+				response->getReply()->getMsg()->append( "Byebye\r\n" );
+				ret = -1;
+			}
+
+			free( line );
+		}
+
+		return ret;
+	}
+
+	virtual void error( SP_Response * response ) {}
+
+	virtual void timeout( SP_Response * response ) {}
+
+	virtual void close() {}
+};
+
+class SP_EchoHandlerFactory : public SP_HandlerFactory {
+public:
+	SP_EchoHandlerFactory() {}
+	virtual ~SP_EchoHandlerFactory() {}
+
+	virtual SP_Handler * create() const {
+		return new SP_EchoHandler();
+	}
+};
+
+//---------------------------------------------------------
+
+int main( int argc, char * argv[] )
+{
+	int port = 3333, maxThreads = 4, maxConnections = 20000;
+	int timeout = 120, reqQueueSize = 10000;
+
+	extern char *optarg ;
+	int c ;
+
+	while( ( c = getopt ( argc, argv, "p:t:o:c:q:v" )) != EOF ) {
+		switch ( c ) {
+			case 'p' :
+				port = atoi( optarg );
+				break;
+			case 't':
+				maxThreads = atoi( optarg );
+				break;
+			case 'c':
+				maxConnections = atoi( optarg );
+				break;
+			case 'o':
+				timeout = atoi( optarg );
+				break;
+			case 'q':
+				reqQueueSize = atoi( optarg );
+				break;
+			case '?' :
+			case 'v' :
+				printf( "Usage: %s [-p <port>] [-t <threads>] [-c <connections>] "
+						"[-o <timeout>] [-q <queue size>]\n", argv[0] );
+				exit( 0 );
+		}
+	}
+
+	sp_openlog( "testuringecho", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER );
+
+	assert( 0 == sp_initsock() );
+
+	SP_UringServer server( "", port, new SP_EchoHandlerFactory() );
+	server.setTimeout( timeout );
+	server.setMaxThreads( maxThreads );
+	server.setReqQueueSize( reqQueueSize, "Byebye\r\n" );
+	server.setMaxConnections( maxConnections );
+	server.runForever();
+
+	return 0;
+}
+
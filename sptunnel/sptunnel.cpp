@@ -8,6 +8,7 @@
 #include <time.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 
 #include "spporting.hpp"
 
@@ -30,13 +31,15 @@
 int main( int argc, char * argv[] )
 {
 	int port = 8080, maxThreads = 10;
-	char * dstHost = "66.249.89.99";
-	int dstPort = 80;
+	char * dstList[ SP_BackendGroup::eMaxBackends ] = { 0 };
+	int dstCount = 0;
+	int plain = 0, checkInterval = 5;
+	int policy = SP_BackendGroup::eRoundRobin;
 
 	extern char *optarg ;
 	int c ;
 
-	while( ( c = getopt ( argc, argv, "p:t:r:v" )) != EOF ) {
+	while( ( c = getopt ( argc, argv, "p:t:r:b:nc:v" )) != EOF ) {
 		switch ( c ) {
 			case 'p' :
 				port = atoi( optarg );
@@ -46,17 +49,38 @@ int main( int argc, char * argv[] )
 				break;
 			case 'r':
 			{
-				dstHost = strdup( optarg );
-				char * pos = strchr( dstHost, ':' );
-				if( NULL != pos ) {
-					dstPort = atoi( pos + 1 );
-					*pos = '\0';
+				// addBackend copies the host, so the list is split in place
+				for( char * pos = strtok( optarg, "," ); NULL != pos; pos = strtok( NULL, "," ) ) {
+					if( dstCount < SP_BackendGroup::eMaxBackends ) dstList[ dstCount++ ] = pos;
 				}
 				break;
 			}
+			case 'b' :
+				if( 0 == strcmp( optarg, "lc" ) ) {
+					policy = SP_BackendGroup::eLeastConn;
+				} else if( 0 == strcmp( optarg, "hash" ) ) {
+					policy = SP_BackendGroup::eHashClientIP;
+				} else {
+					policy = SP_BackendGroup::eRoundRobin;
+				}
+				break;
+#ifndef WIN32
+			case 'n' :
+				plain = 1;
+				break;
+			case 'c' :
+				checkInterval = atoi( optarg );
+				break;
+#endif
 			case '?' :
 			case 'v' :
-				printf( "Usage: %s [-p <port>] [-t <threads>] [-r <backend>]\n", argv[0] );
+				printf( "Usage: %s [-p <port>] [-t <threads>] [-r <backend>[,<backend>...]] [-b rr|lc|hash]\n"
+						"\t\t[-n] [-c <interval>]\n", argv[0] );
+				printf( "\t-r the backend is <ip>:<port>, -r can be given more than once\n" );
+				printf( "\t-b the policy to select a backend, round-robin, least-connections,\n"
+						"\t   or consistent hash by client ip, default is rr\n" );
+				printf( "\t-n plain tcp tunnel, forward in the event loop without ssl\n" );
+				printf( "\t-c check the backends every <interval> seconds, 0 to disable, default is 5\n" );
 				exit( 0 );
 		}
 	}
@@ -69,7 +93,22 @@ int main( int argc, char * argv[] )
 
 	if( 0 != sp_initsock() ) assert( 0 );
 
-	sp_syslog( LOG_NOTICE, "Backend server - %s:%d", dstHost, dstPort );
+	char defaultDst[] = "66.249.89.99:80";
+	if( 0 == dstCount ) dstList[ dstCount++ ] = defaultDst;
+
+	SP_BackendGroup group( policy );
+
+	for( int i = 0; i < dstCount; i++ ) {
+		char * pos = strchr( dstList[i], ':' );
+		int dstPort = NULL != pos ? atoi( pos + 1 ) : 80;
+		if( NULL != pos ) *pos = '\0';
+
+		group.addBackend( dstList[i], dstPort );
+
+		sp_syslog( LOG_NOTICE, "Backend server - %s:%d", dstList[i], dstPort );
+	}
+
+	sp_syslog( LOG_NOTICE, "Backend policy - %s", SP_BackendGroup::getPolicyName( policy ) );
 
 	int maxConnections = 100, reqQueueSize = 100;
 	const char * refusedMsg = "System busy, try again later.";
@@ -82,6 +121,59 @@ int main( int argc, char * argv[] )
 		dispatcher.setTimeout( 60 );
 		dispatcher.dispatch();
 
+#ifndef WIN32
+		if( checkInterval > 0 ) {
+			struct timeval timeout = { checkInterval, 0 };
+			dispatcher.push( &timeout, new SP_HealthChecker( &dispatcher, &group ) );
+		}
+
+		// plain tcp, the data is forwarded between the two fds in the event loop
+		for( ; plain; ) {
+			struct sockaddr_in addr;
+			socklen_t socklen = sizeof( addr );
+			int fd = accept( listenFd, (struct sockaddr*)&addr, &socklen );
+
+			if( fd < 0 ) {
+				// only a broken listen socket ends the tunnel
+				if( EBADF == errno || EINVAL == errno || ENOTSOCK == errno ) {
+					sp_syslog( LOG_ERR, "accept fail, errno %d, %s", errno, strerror( errno ) );
+					break;
+				}
+
+				// out of fds or memory, wait for some sessions to close
+				if( EMFILE == errno || ENFILE == errno || ENOBUFS == errno || ENOMEM == errno ) {
+					sp_syslog( LOG_WARNING, "accept fail, errno %d, %s, retry later",
+							errno, strerror( errno ) );
+					usleep( 100 * 1000 );
+				}
+
+				// EINTR, ECONNABORTED and the network errors of a pending connection
+				continue;
+			}
+
+			char clientIP[ 32 ] = { 0 };
+			SP_IOUtils::inetNtoa( &( addr.sin_addr ), clientIP, sizeof( clientIP ) );
+
+			int index = group.select( clientIP );
+			if( index < 0 ) {
+				close( fd );
+				continue;
+			}
+
+			// the connector closes the client fd if it cannot be queued
+			if( 0 != dispatcher.connect( group.getHost( index ), group.getPort( index ),
+					SP_TunnelHandler::eConnectTimeout,
+					new SP_RelayConnector( &dispatcher, fd, &group, index, clientIP ) ) ) {
+				group.release( index );
+			}
+		}
+
+		if( plain ) {
+			sp_closelog();
+			return 0;
+		}
+#endif
+
 #ifdef	OPENSSL
 		SP_OpensslChannelFactory * sslFactory = new SP_OpensslChannelFactory();
 #else
@@ -109,8 +201,7 @@ int main( int argc, char * argv[] )
 					write( fd, refusedMsg, strlen( refusedMsg ) );
 					close( fd );
 				} else {
-					SP_TunnelHandler * handler = new SP_TunnelHandler(
-							&dispatcher, dstHost, dstPort );
+					SP_TunnelHandler * handler = new SP_TunnelHandler( &dispatcher, &group );
 					dispatcher.push( fd, handler, sslFactory->create() );
 
 					// for non-ssl tunnel
@@ -48,10 +48,15 @@ SP_TunnelArg :: SP_TunnelArg()
 	mTunnelStatus = mBackendStatus = eCreate;
 	memset( &mTunnelSid, 0, sizeof( SP_Sid_t ) );
 	memset( &mBackendSid, 0, sizeof( SP_Sid_t ) );
+
+	mPendingList = new SP_MsgBlockList();
 }
 
 SP_TunnelArg :: ~SP_TunnelArg()
 {
+	delete mPendingList;
+	mPendingList = NULL;
+
 	sp_thread_mutex_destroy( &mMutex );
 }
 
@@ -111,6 +116,33 @@ SP_Sid_t SP_TunnelArg :: getBackendSid()
 	return mBackendSid;
 }
 
+int SP_TunnelArg :: keepPending( SP_TunnelDecoder * decoder )
+{
+	SP_MutexGuard gurad( &mMutex );
+
+	if( eCreate != mBackendStatus ) return 0;
+
+	decoder->takeTo( mPendingList );
+
+	return 1;
+}
+
+int SP_TunnelArg :: startBackend( SP_Sid_t sid, SP_MsgBlockList * blockList )
+{
+	SP_MutexGuard gurad( &mMutex );
+
+	if( eNormal != mTunnelStatus ) return -1;
+
+	mBackendSid = sid;
+	mBackendStatus = eNormal;
+
+	for( ; mPendingList->getCount() > 0; ) {
+		blockList->append( mPendingList->takeItem( 0 ) );
+	}
+
+	return 0;
+}
+
 void SP_TunnelArg :: addRef()
 {
 	SP_MutexGuard gurad( &mMutex );
@@ -134,62 +166,301 @@ void SP_TunnelArg :: release()
 
 SP_TunnelDecoder :: SP_TunnelDecoder()
 {
-	mBuffer = NULL;
+	mChain = new SP_BufferChain();
 }
 
 SP_TunnelDecoder :: ~SP_TunnelDecoder()
 {
-	if( NULL != mBuffer ) delete mBuffer;
-	mBuffer = NULL;
+	delete mChain;
+	mChain = NULL;
 }
 
 int SP_TunnelDecoder :: decode( SP_Buffer * inBuffer )
 {
-	if( inBuffer->getSize() > 0 ) {
-		if( NULL != mBuffer ) {
-			mBuffer->append( inBuffer );
-			inBuffer->reset();
+	mChain->append( inBuffer );
+
+	return mChain->getSize() > 0 ? SP_MsgDecoder::eOK : SP_MsgDecoder::eMoreData;
+}
+
+SP_BufferChain * SP_TunnelDecoder :: getChain()
+{
+	return mChain;
+}
+
+void SP_TunnelDecoder :: takeTo( SP_MsgBlockList * blockList )
+{
+	for( ; mChain->getCount() > 0; ) {
+		blockList->append( new SP_SliceMsgBlock( mChain->takeItem( 0 ), 1 ) );
+	}
+}
+
+//---------------------------------------------------------
+
+SP_BackendGroup :: SP_BackendGroup( int policy )
+{
+	sp_thread_mutex_init( &mMutex, NULL );
+
+	mPolicy = policy;
+
+	memset( mBackendList, 0, sizeof( mBackendList ) );
+	mCount = 0;
+	mNext = 0;
+
+	mRing = NULL;
+	mRingCount = 0;
+}
+
+SP_BackendGroup :: ~SP_BackendGroup()
+{
+	if( NULL != mRing ) free( mRing );
+	mRing = NULL;
+
+	sp_thread_mutex_destroy( &mMutex );
+}
+
+unsigned int SP_BackendGroup :: hash( const char * key )
+{
+	// FNV-1a
+	unsigned int ret = 2166136261U;
+
+	for( const unsigned char * pos = (unsigned char*)key; '\0' != *pos; pos++ ) {
+		ret ^= *pos;
+		ret *= 16777619U;
+	}
+
+	return ret;
+}
+
+int SP_BackendGroup :: cmpNode( const void * node1, const void * node2 )
+{
+	unsigned int hash1 = ((SP_RingNode_t*)node1)->mHash;
+	unsigned int hash2 = ((SP_RingNode_t*)node2)->mHash;
+
+	return hash1 < hash2 ? -1 : ( hash1 > hash2 ? 1 : 0 );
+}
+
+int SP_BackendGroup :: addBackend( const char * host, int port )
+{
+	if( mCount >= eMaxBackends ) return -1;
+
+	SP_RingNode_t * ring = (SP_RingNode_t*)realloc( mRing,
+			sizeof( SP_RingNode_t ) * ( mRingCount + eVirtualNodes ) );
+	if( NULL == ring ) return -1;
+	mRing = ring;
+
+	SP_Backend_t * backend = &( mBackendList[ mCount ] );
+
+	snprintf( backend->mHost, sizeof( backend->mHost ), "%s", host );
+	backend->mPort = port;
+	backend->mAlive = 1;
+	backend->mConnCount = 0;
+
+	// a backend owns many points on the ring, so the clients of a dead
+	// backend are spread over the others instead of moving to one neighbour
+	for( int i = 0; i < eVirtualNodes; i++ ) {
+		char key[ 64 ] = { 0 };
+		snprintf( key, sizeof( key ), "%s:%d#%d", host, port, i );
+
+		mRing[ mRingCount ].mHash = hash( key );
+		mRing[ mRingCount ].mIndex = mCount;
+		mRingCount++;
+	}
+
+	qsort( mRing, mRingCount, sizeof( SP_RingNode_t ), cmpNode );
+
+	mCount++;
+
+	return 0;
+}
+
+int SP_BackendGroup :: getCount()
+{
+	return mCount;
+}
+
+const char * SP_BackendGroup :: getHost( int index )
+{
+	return mBackendList[ index ].mHost;
+}
+
+int SP_BackendGroup :: getPort( int index )
+{
+	return mBackendList[ index ].mPort;
+}
+
+int SP_BackendGroup :: isSelectable( int index, unsigned int tried, int aliveOnly )
+{
+	if( tried & ( 1U << index ) ) return 0;
+
+	return aliveOnly ? mBackendList[ index ].mAlive : 1;
+}
+
+int SP_BackendGroup :: selectRoundRobin( unsigned int tried, int aliveOnly )
+{
+	for( int i = 0; i < mCount; i++ ) {
+		int index = ( mNext + i ) % mCount;
+		if( isSelectable( index, tried, aliveOnly ) ) {
+			mNext = index + 1;
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+int SP_BackendGroup :: selectLeastConn( unsigned int tried, int aliveOnly )
+{
+	int ret = -1;
+
+	// start from a rotating position, so the ties are spread
+	for( int i = 0; i < mCount; i++ ) {
+		int index = ( mNext + i ) % mCount;
+		if( ! isSelectable( index, tried, aliveOnly ) ) continue;
+
+		if( ret < 0 || mBackendList[ index ].mConnCount < mBackendList[ ret ].mConnCount ) {
+			ret = index;
+		}
+	}
+
+	if( ret >= 0 ) mNext++;
+
+	return ret;
+}
+
+int SP_BackendGroup :: selectHash( const char * clientIP, unsigned int tried, int aliveOnly )
+{
+	if( mRingCount <= 0 ) return -1;
+
+	unsigned int key = hash( clientIP );
+
+	// the first node whose hash is not less than the key
+	int low = 0, high = mRingCount;
+	for( ; low < high; ) {
+		int mid = ( low + high ) / 2;
+		if( mRing[ mid ].mHash < key ) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	// walk clockwise, skip the nodes of the unselectable backends
+	for( int i = 0; i < mRingCount; i++ ) {
+		int index = mRing[ ( low + i ) % mRingCount ].mIndex;
+		if( isSelectable( index, tried, aliveOnly ) ) return index;
+	}
+
+	return -1;
+}
+
+int SP_BackendGroup :: select( const char * clientIP, unsigned int tried )
+{
+	SP_MutexGuard gurad( &mMutex );
+
+	int ret = -1;
+
+	// the health state may be stale, try the dead backends before giving up
+	for( int aliveOnly = 1; aliveOnly >= 0 && ret < 0; aliveOnly-- ) {
+		if( eLeastConn == mPolicy ) {
+			ret = selectLeastConn( tried, aliveOnly );
+		} else if( eHashClientIP == mPolicy && NULL != clientIP ) {
+			ret = selectHash( clientIP, tried, aliveOnly );
 		} else {
-			mBuffer = inBuffer->take();
+			ret = selectRoundRobin( tried, aliveOnly );
 		}
 	}
 
-	int ret = SP_MsgDecoder::eMoreData;
-	if( NULL != mBuffer && mBuffer->getSize() > 0 ) ret = SP_MsgDecoder::eOK;
+	if( ret >= 0 ) mBackendList[ ret ].mConnCount++;
 
 	return ret;
 }
 
-SP_Buffer * SP_TunnelDecoder :: getBuffer()
+void SP_BackendGroup :: release( int index )
 {
-	return mBuffer;
+	SP_MutexGuard gurad( &mMutex );
+
+	if( mBackendList[ index ].mConnCount > 0 ) mBackendList[ index ].mConnCount--;
+}
+
+int SP_BackendGroup :: failover( int index, const char * clientIP, unsigned int * tried )
+{
+	release( index );
+	setAlive( index, 0 );
+
+	*tried |= 1U << index;
+
+	return select( clientIP, *tried );
+}
+
+void SP_BackendGroup :: setAlive( int index, int alive )
+{
+	SP_Backend_t * backend = &( mBackendList[ index ] );
+
+	int changed = 0;
+
+	sp_thread_mutex_lock( &mMutex );
+	if( ( alive ? 1 : 0 ) != backend->mAlive ) {
+		backend->mAlive = alive ? 1 : 0;
+		changed = 1;
+	}
+	sp_thread_mutex_unlock( &mMutex );
+
+	if( changed ) {
+		sp_syslog( LOG_NOTICE, "backend %s:%d is %s",
+				backend->mHost, backend->mPort, alive ? "alive" : "dead" );
+	}
 }
 
-SP_Buffer * SP_TunnelDecoder :: takeBuffer()
+int SP_BackendGroup :: isAlive( int index )
 {
-	SP_Buffer * buffer = mBuffer;
+	SP_MutexGuard gurad( &mMutex );
+
+	return mBackendList[ index ].mAlive;
+}
 
-	mBuffer = NULL;
+const char * SP_BackendGroup :: getPolicyName( int policy )
+{
+	if( eLeastConn == policy ) return "least-connections";
+	if( eHashClientIP == policy ) return "hash-by-client-ip";
 
-	return buffer;
+	return "round-robin";
 }
 
 //---------------------------------------------------------
 
-SP_BackendHandler :: SP_BackendHandler( SP_TunnelArg * tunnelArg )
+SP_BackendHandler :: SP_BackendHandler( SP_TunnelArg * tunnelArg,
+		SP_BackendGroup * group, int index )
 {
 	mArg = tunnelArg;
+
+	mGroup = group;
+	mIndex = index;
 }
 
 SP_BackendHandler :: ~SP_BackendHandler()
 {
+	mGroup->release( mIndex );
+
 	mArg->release();
 }
 
 int SP_BackendHandler :: start( SP_Request * request, SP_Response * response )
 {
-	mArg->setBackendSid( response->getFromSid() );
-	mArg->setBackendStatus( SP_TunnelArg::eNormal );
+	// send the data which arrived from client before the backend is started
+	SP_Message * msg = new SP_Message();
+	msg->getToList()->add( response->getFromSid() );
+
+	// the client has gone while connecting, close the backend at once
+	if( 0 != mArg->startBackend( response->getFromSid(), msg->getFollowBlockList() ) ) {
+		delete msg;
+		return -1;
+	}
+
+	if( msg->getTotalSize() > 0 ) {
+		response->addMessage( msg );
+	} else {
+		delete msg;
+	}
 
 	request->setMsgDecoder( new SP_TunnelDecoder() );
 
@@ -199,11 +470,10 @@ int SP_BackendHandler :: start( SP_Request * request, SP_Response * response )
 int SP_BackendHandler :: handle( SP_Request * request, SP_Response * response )
 {
 	SP_TunnelDecoder * decoder = (SP_TunnelDecoder*)request->getMsgDecoder();
-	SP_Buffer * buffer = decoder->takeBuffer();
 
 	SP_Message * msg = new SP_Message();
 	msg->getToList()->add( mArg->getTunnelSid() );
-	msg->getFollowBlockList()->append( new SP_BufferMsgBlock( buffer, 1 ) );
+	decoder->takeTo( msg->getFollowBlockList() );
 	response->addMessage( msg );
 
 	return SP_TunnelArg::eNormal == mArg->getTunnelStatus() ? 0 : -1;
@@ -226,25 +496,197 @@ void SP_BackendHandler :: close()
 
 //---------------------------------------------------------
 
-SP_TunnelHandler :: SP_TunnelHandler( SP_MyDispatcher * dispatcher,
-		const char * dstHost, int dstPort )
+#ifndef WIN32
+
+SP_BackendConnector :: SP_BackendConnector( SP_MyDispatcher * dispatcher,
+		SP_TunnelArg * tunnelArg, SP_BackendGroup * group, int index,
+		const char * clientIP, unsigned int tried )
 {
 	mDispatcher = dispatcher;
-	mArg = SP_TunnelArg::create();
+	mArg = tunnelArg;
+	mArg->addRef();
+
+	mGroup = group;
+	mIndex = index;
+	snprintf( mClientIP, sizeof( mClientIP ), "%s", clientIP );
+	mTried = tried;
+}
+
+SP_BackendConnector :: ~SP_BackendConnector()
+{
+	mArg->release();
+	mArg = NULL;
+}
+
+void SP_BackendConnector :: handle( int fd, int error, SP_Response * response )
+{
+	SP_Sid_t sid = mArg->getTunnelSid();
 
-	mMsgBlockList = new SP_MsgBlockList();
+	if( fd >= 0 && SP_TunnelArg::eNormal != mArg->getTunnelStatus() ) {
+		// the client has gone while connecting, the backend is not needed
+		::close( fd );
+		mGroup->release( mIndex );
+		mArg->setBackendStatus( SP_TunnelArg::eDestroy );
+		return;
+	}
+
+	if( fd >= 0 ) {
+		mArg->addRef();
+		SP_BackendHandler * handler = new SP_BackendHandler( mArg, mGroup, mIndex );
+		if( 0 == mDispatcher->push( fd, handler ) ) return;
+
+		sp_syslog( LOG_WARNING, "session(%d.%d) cannot push backend fd %d", sid.mKey, sid.mSeq, fd );
+
+		// the handler releases the connection counted for the backend
+		delete handler;
+		::close( fd );
+	} else {
+		sp_syslog( LOG_WARNING, "session(%d.%d) cannot connect to backend %s:%d, errno %d, %s",
+				sid.mKey, sid.mSeq, mGroup->getHost( mIndex ), mGroup->getPort( mIndex ),
+				error, strerror( error ) );
+
+		int index = mGroup->failover( mIndex, mClientIP, &mTried );
+
+		if( index >= 0 && SP_TunnelArg::eNormal == mArg->getTunnelStatus() ) {
+			if( 0 == mDispatcher->connect( mGroup->getHost( index ), mGroup->getPort( index ),
+					SP_TunnelHandler::eConnectTimeout,
+					new SP_BackendConnector( mDispatcher, mArg, mGroup, index, mClientIP, mTried ) ) ) {
+				return;
+			}
+		}
+
+		if( index >= 0 ) mGroup->release( index );
+	}
+
+	mArg->setBackendStatus( SP_TunnelArg::eDestroy );
+	response->getToCloseList()->add( sid );
+}
+
+//---------------------------------------------------------
+
+SP_RelayConnector :: SP_RelayConnector( SP_MyDispatcher * dispatcher, int clientFd,
+		SP_BackendGroup * group, int index, const char * clientIP, unsigned int tried )
+{
+	mDispatcher = dispatcher;
+	mClientFd = clientFd;
 
-	snprintf( mHost, sizeof( mHost ), "%s", dstHost );
-	mPort = dstPort;
+	mGroup = group;
+	mIndex = index;
+	snprintf( mClientIP, sizeof( mClientIP ), "%s", clientIP );
+	mTried = tried;
+}
+
+SP_RelayConnector :: ~SP_RelayConnector()
+{
+	if( mClientFd >= 0 ) ::close( mClientFd );
+	mClientFd = -1;
+}
+
+void SP_RelayConnector :: handle( int fd, int error, SP_Response * response )
+{
+	if( fd >= 0 ) {
+		// the connection is counted until the relay is finished
+		if( 0 != mDispatcher->relay( mClientFd, fd, new SP_RelayCounter( mGroup, mIndex ) ) ) {
+			mGroup->release( mIndex );
+			::close( fd );
+			return;
+		}
+
+		mClientFd = -1;
+		return;
+	}
+
+	sp_syslog( LOG_WARNING, "fd %d cannot connect to backend %s:%d, errno %d, %s",
+			mClientFd, mGroup->getHost( mIndex ), mGroup->getPort( mIndex ),
+			error, strerror( error ) );
+
+	int index = mGroup->failover( mIndex, mClientIP, &mTried );
+	if( index >= 0 ) {
+		// the new connector owns the client fd, it is closed with the connector on failure
+		if( 0 != mDispatcher->connect( mGroup->getHost( index ), mGroup->getPort( index ),
+				SP_TunnelHandler::eConnectTimeout,
+				new SP_RelayConnector( mDispatcher, mClientFd, mGroup, index, mClientIP, mTried ) ) ) {
+			mGroup->release( index );
+		}
+		mClientFd = -1;
+	}
+}
+
+//---------------------------------------------------------
+
+SP_RelayCounter :: SP_RelayCounter( SP_BackendGroup * group, int index )
+{
+	mGroup = group;
+	mIndex = index;
+}
+
+SP_RelayCounter :: ~SP_RelayCounter()
+{
+}
+
+void SP_RelayCounter :: close()
+{
+	mGroup->release( mIndex );
+}
+
+//---------------------------------------------------------
+
+SP_HealthConnector :: SP_HealthConnector( SP_BackendGroup * group, int index )
+{
+	mGroup = group;
+	mIndex = index;
+}
+
+SP_HealthConnector :: ~SP_HealthConnector()
+{
+}
+
+void SP_HealthConnector :: handle( int fd, int error, SP_Response * response )
+{
+	if( fd >= 0 ) ::close( fd );
+
+	mGroup->setAlive( mIndex, fd >= 0 );
+}
+
+//---------------------------------------------------------
+
+SP_HealthChecker :: SP_HealthChecker( SP_MyDispatcher * dispatcher, SP_BackendGroup * group )
+{
+	mDispatcher = dispatcher;
+	mGroup = group;
+}
+
+SP_HealthChecker :: ~SP_HealthChecker()
+{
+}
+
+int SP_HealthChecker :: handle( SP_Response * response, struct timeval * timeout )
+{
+	// the results come back to the worker threads, the timer is not blocked
+	for( int i = 0; i < mGroup->getCount(); i++ ) {
+		mDispatcher->connect( mGroup->getHost( i ), mGroup->getPort( i ),
+				eCheckTimeout, new SP_HealthConnector( mGroup, i ) );
+	}
+
+	return 0;
+}
+
+#endif
+
+//---------------------------------------------------------
+
+SP_TunnelHandler :: SP_TunnelHandler( SP_MyDispatcher * dispatcher, SP_BackendGroup * group )
+{
+	mDispatcher = dispatcher;
+	mArg = SP_TunnelArg::create();
+
+	mGroup = group;
 }
 
 SP_TunnelHandler :: ~SP_TunnelHandler()
 {
 	mArg->release();
 	mArg = NULL;
-
-	delete mMsgBlockList;
-	mMsgBlockList = NULL;
 }
 
 int SP_TunnelHandler :: start( SP_Request * request, SP_Response * response )
@@ -254,48 +696,70 @@ int SP_TunnelHandler :: start( SP_Request * request, SP_Response * response )
 
 	request->setMsgDecoder( new SP_TunnelDecoder() );
 
+	int index = mGroup->select( request->getClientIP() );
+	if( index < 0 ) {
+		sp_syslog( LOG_WARNING, "No backend" );
+		return -1;
+	}
+
+#ifdef WIN32
 	int ret = 0;
 
+	const char * host = mGroup->getHost( index );
+	int port = mGroup->getPort( index );
+
 	int socketFd = socket( AF_INET, SOCK_STREAM, IPPROTO_IP );
 	if( socketFd >= 0 ) {
 		struct sockaddr_in inAddr;
 		inAddr.sin_family = AF_INET;
-		inAddr.sin_addr.s_addr = inet_addr( mHost );
-		inAddr.sin_port = htons( mPort );
+		inAddr.sin_addr.s_addr = inet_addr( host );
+		inAddr.sin_port = htons( port );
 
 		ret = connect( socketFd, (struct sockaddr*)&inAddr, sizeof( inAddr ) );
 		if( 0 == ret ) {
 			mArg->addRef();
-			mDispatcher->push( socketFd, new SP_BackendHandler( mArg ) );
+			SP_BackendHandler * handler = new SP_BackendHandler( mArg, mGroup, index );
+			ret = mDispatcher->push( socketFd, handler );
+			if( 0 != ret ) {
+				// the handler releases the connection counted for the backend
+				delete handler;
+				::close( socketFd );
+			}
 		} else {
-			sp_syslog( LOG_WARNING, "Cannot connect to %s:%d", mHost, mPort );
+			sp_syslog( LOG_WARNING, "Cannot connect to %s:%d", host, port );
+			mGroup->release( index );
+			mGroup->setAlive( index, 0 );
 			::close( socketFd );
 		}
 	} else {
 		ret = -1;
+		mGroup->release( index );
 		sp_syslog( LOG_WARNING, "Cannot open socket, errno %d, %s",
 			errno, strerror( errno ) );
 	}
 
 	return ret;
+#else
+	// the data from client is kept in mArg until the backend is started
+	int ret = mDispatcher->connect( mGroup->getHost( index ), mGroup->getPort( index ),
+			eConnectTimeout, new SP_BackendConnector( mDispatcher, mArg, mGroup, index,
+				request->getClientIP() ) );
+	if( 0 != ret ) mGroup->release( index );
+
+	return ret;
+#endif
 }
 
 int SP_TunnelHandler :: handle( SP_Request * request, SP_Response * response )
 {
 	SP_TunnelDecoder * decoder = (SP_TunnelDecoder*)request->getMsgDecoder();
-	SP_Buffer * buffer = decoder->takeBuffer();
 
-	if( SP_TunnelArg::eCreate == mArg->getBackendStatus() ) {
-		mMsgBlockList->append( new SP_BufferMsgBlock( buffer, 1 ) );
-	} else {
+	// before the backend is started, the data is kept and sent by the backend handler
+	if( 0 == mArg->keepPending( decoder ) ) {
 		SP_Message * msg = new SP_Message();
 		msg->getToList()->add( mArg->getBackendSid() );
 
-		for( ; mMsgBlockList->getCount() > 0; ) {
-			msg->getFollowBlockList()->append( mMsgBlockList->takeItem( 0 ) );
-		}
-
-		msg->getFollowBlockList()->append( new SP_BufferMsgBlock( buffer, 1 ) );
+		decoder->takeTo( msg->getFollowBlockList() );
 		response->addMessage( msg );
 	}
 
@@ -305,11 +769,20 @@ int SP_TunnelHandler :: handle( SP_Request * request, SP_Response * response )
 void SP_TunnelHandler :: error( SP_Response * response )
 {
 	mArg->setTunnelStatus( SP_TunnelArg::eDestroy );
+
+	// close the backend after the pending data is sent, instead of waiting for its timeout
+	if( SP_TunnelArg::eNormal == mArg->getBackendStatus() ) {
+		response->getToCloseList()->add( mArg->getBackendSid() );
+	}
 }
 
 void SP_TunnelHandler :: timeout( SP_Response * response )
 {
 	mArg->setTunnelStatus( SP_TunnelArg::eDestroy );
+
+	if( SP_TunnelArg::eNormal == mArg->getBackendStatus() ) {
+		response->getToCloseList()->add( mArg->getBackendSid() );
+	}
 }
 
 void SP_TunnelHandler :: close()
@@ -12,6 +12,9 @@
 #include "sphandler.hpp"
 #include "spresponse.hpp"
 
+class SP_TunnelDecoder;
+class SP_MsgBlockList;
+
 class SP_TunnelArg {
 public:
 	static SP_TunnelArg * create();
@@ -30,6 +33,14 @@ public:
 	void setBackendSid( SP_Sid_t sid );
 	SP_Sid_t getBackendSid();
 
+	// keep the data from client while the backend is not started,
+	// return 1 if the data is kept, 0 if the backend has been started
+	int keepPending( SP_TunnelDecoder * decoder );
+
+	// mark the backend started, move the kept data into blockList
+	// return -1 if the client is gone, the backend is not started
+	int startBackend( SP_Sid_t sid, SP_MsgBlockList * blockList );
+
 	void addRef();
 	void release();
 
@@ -40,28 +51,106 @@ private:
 	unsigned char mTunnelStatus, mBackendStatus;
 	SP_Sid_t mTunnelSid, mBackendSid;
 
+	SP_MsgBlockList * mPendingList;
+
 	SP_TunnelArg();
 	~SP_TunnelArg();
 };
 
+class SP_BufferChain;
+
 class SP_TunnelDecoder : public SP_MsgDecoder {
 public:
 	SP_TunnelDecoder();
 	virtual ~SP_TunnelDecoder();
 
+	// move the data of inBuffer into the chain, no copy
 	virtual int decode( SP_Buffer * inBuffer );
 
-	SP_Buffer * getBuffer();
+	SP_BufferChain * getChain();
 
-	SP_Buffer * takeBuffer();
+	// move all the slices to msg as SP_SliceMsgBlock
+	void takeTo( SP_MsgBlockList * blockList );
 
 private:
-	SP_Buffer * mBuffer;
+	SP_BufferChain * mChain;
+};
+
+// the backends of the tunnel, all the methods can be called by any thread
+class SP_BackendGroup {
+public:
+	enum { eRoundRobin, eLeastConn, eHashClientIP };
+	enum { eMaxBackends = 32, eVirtualNodes = 100 };
+
+	SP_BackendGroup( int policy = eRoundRobin );
+	~SP_BackendGroup();
+
+	// must be called before the group is used
+	// return 0 : OK, -1 : too many backends
+	int addBackend( const char * host, int port );
+
+	int getCount();
+	const char * getHost( int index );
+	int getPort( int index );
+
+	// select a backend which is alive and not in the tried mask, and count
+	// a connection to it; a dead one is selected only if no backend is alive
+	// return the index, -1 if all the backends have been tried
+	int select( const char * clientIP, unsigned int tried = 0 );
+
+	// the connection counted by select is closed
+	void release( int index );
+
+	// release the failed backend and mark it dead, then select another one
+	int failover( int index, const char * clientIP, unsigned int * tried );
+
+	void setAlive( int index, int alive );
+	int isAlive( int index );
+
+	static const char * getPolicyName( int policy );
+
+private:
+	SP_BackendGroup( SP_BackendGroup & );
+	SP_BackendGroup & operator=( SP_BackendGroup & );
+
+	typedef struct tagSP_Backend {
+		char mHost[ 32 ];
+		int mPort;
+		int mAlive;
+		int mConnCount;
+	} SP_Backend_t;
+
+	typedef struct tagSP_RingNode {
+		unsigned int mHash;
+		int mIndex;
+	} SP_RingNode_t;
+
+	static unsigned int hash( const char * key );
+	static int cmpNode( const void * node1, const void * node2 );
+
+	// return -1 if no backend is selectable
+	int selectRoundRobin( unsigned int tried, int aliveOnly );
+	int selectLeastConn( unsigned int tried, int aliveOnly );
+	int selectHash( const char * clientIP, unsigned int tried, int aliveOnly );
+
+	int isSelectable( int index, unsigned int tried, int aliveOnly );
+
+	sp_thread_mutex_t mMutex;
+
+	int mPolicy;
+
+	SP_Backend_t mBackendList[ eMaxBackends ];
+	int mCount;
+	unsigned int mNext;
+
+	// the consistent hash ring, sorted by hash
+	SP_RingNode_t * mRing;
+	int mRingCount;
 };
 
 class SP_BackendHandler : public SP_Handler {
 public:
-	SP_BackendHandler( SP_TunnelArg * tunnelArg );
+	SP_BackendHandler( SP_TunnelArg * tunnelArg, SP_BackendGroup * group, int index );
 	virtual ~SP_BackendHandler();
 
 	// return -1 : terminate session, 0 : continue
@@ -78,6 +167,9 @@ public:
 
 private:
 	SP_TunnelArg * mArg;
+
+	SP_BackendGroup * mGroup;
+	int mIndex;
 };
 
 #ifdef WIN32
@@ -86,12 +178,96 @@ typedef class SP_IocpDispatcher SP_MyDispatcher;
 typedef class SP_Dispatcher SP_MyDispatcher;
 #endif
 
-class SP_MsgBlockList;
+#ifndef WIN32
+
+// push the backend fd into dispatcher when it is connected,
+// try another backend if the connect fails
+class SP_BackendConnector : public SP_ConnectHandler {
+public:
+	SP_BackendConnector( SP_MyDispatcher * dispatcher, SP_TunnelArg * tunnelArg,
+			SP_BackendGroup * group, int index, const char * clientIP, unsigned int tried = 0 );
+	virtual ~SP_BackendConnector();
+
+	virtual void handle( int fd, int error, SP_Response * response );
+
+private:
+	SP_MyDispatcher * mDispatcher;
+	SP_TunnelArg * mArg;
+
+	SP_BackendGroup * mGroup;
+	int mIndex;
+	char mClientIP[ 32 ];
+	unsigned int mTried;
+};
+
+// relay the client fd and the backend fd when the backend is connected,
+// try another backend if the connect fails
+class SP_RelayConnector : public SP_ConnectHandler {
+public:
+	SP_RelayConnector( SP_MyDispatcher * dispatcher, int clientFd,
+			SP_BackendGroup * group, int index, const char * clientIP, unsigned int tried = 0 );
+	virtual ~SP_RelayConnector();
+
+	virtual void handle( int fd, int error, SP_Response * response );
+
+private:
+	SP_MyDispatcher * mDispatcher;
+	int mClientFd;
+
+	SP_BackendGroup * mGroup;
+	int mIndex;
+	char mClientIP[ 32 ];
+	unsigned int mTried;
+};
+
+// release the connection counted for the backend when the relay is finished
+class SP_RelayCounter : public SP_RelayHandler {
+public:
+	SP_RelayCounter( SP_BackendGroup * group, int index );
+	virtual ~SP_RelayCounter();
+
+	virtual void close();
+
+private:
+	SP_BackendGroup * mGroup;
+	int mIndex;
+};
+
+// mark the backend alive or dead by the result of a connect
+class SP_HealthConnector : public SP_ConnectHandler {
+public:
+	SP_HealthConnector( SP_BackendGroup * group, int index );
+	virtual ~SP_HealthConnector();
+
+	virtual void handle( int fd, int error, SP_Response * response );
+
+private:
+	SP_BackendGroup * mGroup;
+	int mIndex;
+};
+
+// connect to every backend periodically, register it with SP_Dispatcher::push( timeout, handler )
+class SP_HealthChecker : public SP_TimerHandler {
+public:
+	enum { eCheckTimeout = 3 };
+
+	SP_HealthChecker( SP_MyDispatcher * dispatcher, SP_BackendGroup * group );
+	virtual ~SP_HealthChecker();
+
+	virtual int handle( SP_Response * response, struct timeval * timeout );
+
+private:
+	SP_MyDispatcher * mDispatcher;
+	SP_BackendGroup * mGroup;
+};
+
+#endif
 
 class SP_TunnelHandler : public SP_Handler {
 public:
-	SP_TunnelHandler( SP_MyDispatcher * dispatcher,
-			const char * dstHost, int dstPort );
+	enum { eConnectTimeout = 10 };
+
+	SP_TunnelHandler( SP_MyDispatcher * dispatcher, SP_BackendGroup * group );
 
 	virtual ~SP_TunnelHandler();
 
@@ -111,10 +287,7 @@ private:
 	SP_MyDispatcher * mDispatcher;
 	SP_TunnelArg * mArg;
 
-	SP_MsgBlockList * mMsgBlockList;
-
-	char mHost[ 32 ];
-	int mPort;
+	SP_BackendGroup * mGroup;
 };
 
 #endif
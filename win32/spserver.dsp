@@ -145,6 +145,10 @@ SOURCE=..\spserver\spresponse.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\spserver\spscan.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\spserver\spsession.cpp
 # End Source File
 # Begin Source File
@@ -161,6 +165,10 @@ SOURCE=..\spserver\spthreadpool.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\spserver\sptimerwheel.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\spserver\sputils.cpp
 # End Source File
 # Begin Source File
@@ -245,6 +253,10 @@ SOURCE=..\spserver\spresponse.hpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\spserver\spscan.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\spserver\spsession.hpp
 # End Source File
 # Begin Source File
@@ -261,6 +273,10 @@ SOURCE=..\spserver\spthreadpool.hpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\spserver\sptimerwheel.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\spserver\sputils.hpp
 # End Source File
 # Begin Source File